@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <time.h>
+
+// 微基准测试的公共工具
+// 每个测试用BENCH_CASE定义，自动注册到全局列表，由bench_main统一运行
+
+typedef void (*bench_fn)();
+
+struct bench_registrar {
+    bench_registrar(const char* name, bench_fn fn);
+};
+
+#define BENCH_CASE(name)                                                       \
+    static void            name();                                            \
+    static bench_registrar name##_registrar(#name, name);                     \
+    static void            name()
+
+// 单调时钟，纳秒
+inline uint64_t bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 阻止编译器把结果当作无用代码优化掉
+template <typename T> inline void bench_keep(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// 输出一条结果，每行一个JSON对象
+void bench_report(const char* name, long iterations, uint64_t elapsed_ns);
+
+#endif
@@ -0,0 +1,94 @@
+#include "bench.h"
+#include "http_header.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// 响应头构造: 原来每行一次vsnprintf的路径 和 常量片段+查表的路径对比
+
+static const int ITERATIONS  = 2000000;
+static const int BUFFER_SIZE = 1024;
+
+struct legacy_writer {
+    char buf[BUFFER_SIZE];
+    int  idx;
+
+    // 与改造前的http_conn::add_response一致
+    bool add_response(const char* format, ...)
+    {
+        if (idx >= BUFFER_SIZE) {
+            return false;
+        }
+        va_list arg_list;
+        va_start(arg_list, format);
+        int len = vsnprintf(
+            buf + idx, BUFFER_SIZE - 1 - idx, format, arg_list);
+        va_end(arg_list);
+        if (len >= (BUFFER_SIZE - 1 - idx)) {
+            return false;
+        }
+        idx += len;
+        return true;
+    }
+};
+
+struct builder_writer {
+    char buf[BUFFER_SIZE];
+    int  idx;
+
+    bool add_bytes(const char* data, int len)
+    {
+        if (len > BUFFER_SIZE - 1 - idx) {
+            return false;
+        }
+        memcpy(buf + idx, data, len);
+        idx += len;
+        return true;
+    }
+};
+
+BENCH_CASE(header_vsnprintf)
+{
+    legacy_writer w;
+    uint64_t      start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        w.idx = 0;
+        w.add_response("%s %d %s\r\n", "HTTP/1.1", 200, "OK");
+        w.add_response("Content-Length: %d\r\n", 1000 + (i & 0xffff));
+        w.add_response("Content-Type:%s\r\n", "text/html");
+        w.add_response("Connection: %s\r\n", (i & 1) ? "keep-alive" : "close");
+        w.add_response("%s", "\r\n");
+        bench_keep(w.idx);
+    }
+    bench_report("header_vsnprintf", ITERATIONS, bench_now_ns() - start);
+}
+
+BENCH_CASE(header_builder)
+{
+    builder_writer w;
+    uint64_t       start = bench_now_ns();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        w.idx = 0;
+        int         len;
+        const char* line = http_status_line(200, &len);
+        w.add_bytes(line, len);
+        line = http_date_header(&len);
+        w.add_bytes(line, len);
+        char num[40] = "Content-Length: ";
+        int  n       = sizeof("Content-Length: ") - 1;
+        n += format_uint(num + n, 1000 + (i & 0xffff));
+        num[n++] = '\r';
+        num[n++] = '\n';
+        w.add_bytes(num, n);
+        w.add_bytes(HDR_FRAGMENT("Content-Type: text/html\r\n"));
+        if (i & 1) {
+            w.add_bytes(HDR_FRAGMENT("Connection: keep-alive\r\n"));
+        }
+        else {
+            w.add_bytes(HDR_FRAGMENT("Connection: close\r\n"));
+        }
+        w.add_bytes(HDR_FRAGMENT("\r\n"));
+        bench_keep(w.idx);
+    }
+    bench_report("header_builder", ITERATIONS, bench_now_ns() - start);
+}
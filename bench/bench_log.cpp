@@ -0,0 +1,101 @@
+#include "bench.h"
+#include "log.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Log::write_log: 同步写(访问日志实例)和阻塞队列异步写(全局实例，
+// 写线程固定服务全局实例)，1个和4个线程并发写，按调用者看到的每条开销计。
+// 异步模式队列满时退化为同步写，这部分也算在里面
+
+static const int LINES = 200000;  // 每个线程写的条数
+
+struct log_writer {
+    Log* log;
+    int  lines;
+};
+
+static void* write_lines(void* arg)
+{
+    log_writer* w = (log_writer*)arg;
+    for (int i = 0; i < w->lines; ++i) {
+        LOG_WRITE_TO(
+            w->log, 1, "deal with the client(%s) fd %d request %d",
+            "192.168.1.100", 42, i);
+    }
+    return nullptr;
+}
+
+static uint64_t run_writers(Log* log, int threads)
+{
+    std::vector<pthread_t> tids(threads);
+    log_writer             w = {log, LINES};
+    uint64_t               start = bench_now_ns();
+    for (int i = 0; i < threads; ++i) {
+        pthread_create(&tids[i], NULL, write_lines, &w);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    return bench_now_ns() - start;
+}
+
+static std::string make_log_dir()
+{
+    char dir[] = "/tmp/webserver_bench_log_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    return dir;
+}
+
+// 日志文件名带日期，目录里的文件全部删掉
+static void remove_log_dir(const std::string& dir)
+{
+    DIR* d = opendir(dir.c_str());
+    if (d) {
+        while (struct dirent* e = readdir(d)) {
+            if (e->d_name[0] != '.') {
+                unlink((dir + "/" + e->d_name).c_str());
+            }
+        }
+        closedir(d);
+    }
+    rmdir(dir.c_str());
+}
+
+static void run_log_bench(Log* log, const char* mode, int queue_size)
+{
+    std::string dir = make_log_dir();
+    // 行数切分设得很大，测的是写入本身而不是换文件
+    log->init((dir + "/bench").c_str(), 8192, 100000000, queue_size);
+    log->set_level(0);
+    const int threads[] = {1, 4};
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+        uint64_t elapsed = run_writers(log, threads[i]);
+        char     name[64];
+        snprintf(name, sizeof(name), "log_write_%s_%dt", mode, threads[i]);
+        bench_report(name, (long)threads[i] * LINES, elapsed);
+    }
+    // 异步的写线程可能还在写，等它写完再删
+    while (log->pending_percent() > 0) {
+        usleep(1000);
+    }
+    log->set_level(4);
+    remove_log_dir(dir);
+}
+
+BENCH_CASE(log_write_sync)
+{
+    run_log_bench(Log::get_access_log(), "sync", 0);
+}
+
+BENCH_CASE(log_write_async)
+{
+    run_log_bench(Log::get_instance(), "async", 10000);
+}
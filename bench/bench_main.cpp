@@ -0,0 +1,45 @@
+#include "bench.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+struct bench_entry {
+    const char* name;
+    bench_fn    fn;
+};
+
+static std::vector<bench_entry>& bench_list()
+{
+    static std::vector<bench_entry> list;
+    return list;
+}
+
+bench_registrar::bench_registrar(const char* name, bench_fn fn)
+{
+    bench_list().push_back({name, fn});
+}
+
+void bench_report(const char* name, long iterations, uint64_t elapsed_ns)
+{
+    printf(
+        "{\"bench\":\"%s\",\"iterations\":%ld,\"total_ns\":%llu,"
+        "\"ns_per_op\":%.2f}\n",
+        name, iterations, (unsigned long long)elapsed_ns,
+        iterations ? (double)elapsed_ns / iterations : 0.0);
+    fflush(stdout);
+}
+
+// 用法: webserver_bench [名字子串...]，不带参数运行全部
+int main(int argc, char* argv[])
+{
+    for (const bench_entry& e : bench_list()) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc && !selected; ++i) {
+            selected = strstr(e.name, argv[i]) != nullptr;
+        }
+        if (selected) {
+            e.fn();
+        }
+    }
+    return 0;
+}
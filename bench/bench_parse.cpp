@@ -0,0 +1,131 @@
+#include "bench.h"
+#include "captured_requests.h"
+#include "http_conn.h"
+#include "log.h"
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+// 请求解析: 用抓到的几种典型请求直接驱动http_conn的解析状态机，不经过socket
+// parse_line        只切分行
+// process_read      完整解析，包括do_request的stat/open/mmap
+// process_read_write 再加上process_write构造响应头
+
+extern const char*                        doc_root;
+extern std::map<std::string, std::string> users;
+
+static const int LINE_ITERATIONS    = 1000000;
+static const int REQUEST_ITERATIONS = 200000;
+
+struct http_conn_bench {
+    // 请求放进读缓冲区，连接状态和刚从socket读完时一样
+    static void load(http_conn& c, const char* text, int len)
+    {
+        c.init();
+        c.m_sockfd = -1;
+        c.attach_buffers();
+        memcpy(c.m_read_buf, text, len);
+        c.m_read_idx = len;
+    }
+    // 只恢复行切分用到的状态，parse_line会把行尾改成'\0'
+    static void reload(http_conn& c, const char* text, int len)
+    {
+        memcpy(c.m_read_buf, text, len);
+        c.m_read_idx    = len;
+        c.m_checked_idx = 0;
+        c.m_start_line  = 0;
+    }
+    static int split_lines(http_conn& c)
+    {
+        int lines = 0;
+        while (c.parse_line() == http_conn::LINE_OK) {
+            c.m_start_line = c.m_checked_idx;
+            ++lines;
+        }
+        return lines;
+    }
+    static int process_read(http_conn& c)
+    {
+        return c.process_read();
+    }
+    static bool process_write(http_conn& c, int ret)
+    {
+        return c.process_write((http_conn::HTTP_CODE)ret);
+    }
+    // 响应发完之后的清理: 流式响应(比如边压缩边发)的生产者和文件映射
+    static void finish(http_conn& c)
+    {
+        c.end_stream();
+        c.unmap();
+    }
+};
+
+BENCH_CASE(parse_line)
+{
+    http_conn* c = new http_conn;
+    for (int r = 0; r < CAPTURED_REQUESTS; ++r) {
+        const char* text  = captured_requests[r].text;
+        int         len   = strlen(text);
+        long        lines = 0;
+        http_conn_bench::load(*c, text, len);
+        uint64_t start = bench_now_ns();
+        for (int i = 0; i < LINE_ITERATIONS; ++i) {
+            http_conn_bench::reload(*c, text, len);
+            lines += http_conn_bench::split_lines(*c);
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        bench_keep(lines);
+        std::string name = std::string("parse_line_") + captured_requests[r].name;
+        bench_report(name.c_str(), LINE_ITERATIONS, elapsed);
+    }
+    delete c;
+}
+
+// 解析每个请求，with_write时再构造响应头，最后像发完响应一样清理
+static void run_requests(const char* prefix, bool with_write)
+{
+    // 每行一条INFO日志会盖过解析本身，这里关掉，只测解析
+    Log::get_instance()->set_level(4);
+    std::string root     = make_doc_root();
+    const char* old_root = doc_root;
+    doc_root             = root.c_str();
+    users["bench"]       = "bench";
+
+    http_conn* c = new http_conn;
+    for (int r = 0; r < CAPTURED_REQUESTS; ++r) {
+        const char* text = captured_requests[r].text;
+        int         len  = strlen(text);
+        long        sum  = 0;
+        uint64_t    start = bench_now_ns();
+        for (int i = 0; i < REQUEST_ITERATIONS; ++i) {
+            http_conn_bench::load(*c, text, len);
+            int ret = http_conn_bench::process_read(*c);
+            if (with_write) {
+                sum += http_conn_bench::process_write(*c, ret);
+            }
+            http_conn_bench::finish(*c);
+            sum += ret;
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        bench_keep(sum);
+        std::string name = std::string(prefix) + captured_requests[r].name;
+        bench_report(name.c_str(), REQUEST_ITERATIONS, elapsed);
+    }
+    delete c;
+
+    users.erase("bench");
+    doc_root = old_root;
+    remove_doc_root(root);
+}
+
+BENCH_CASE(process_read)
+{
+    run_requests("process_read_", false);
+}
+
+BENCH_CASE(process_read_write)
+{
+    run_requests("process_read_write_", true);
+}
@@ -0,0 +1,56 @@
+#include "bench.h"
+#include "threadPool.h"
+#include <atomic>
+#include <iostream>
+#include <sched.h>
+#include <stdio.h>
+#include <vector>
+
+// 线程池: 主线程append空任务，从第一次append到最后一个任务执行完的时间，
+// 即每个任务的入队、唤醒和出队开销。连接池没有初始化，工作线程拿到的连接是NULL
+
+static const int TASKS = 1000000;
+
+struct noop_task {
+    MYSQL*             mysql;
+    std::atomic<long>* done;
+
+    void process()
+    {
+        done->fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+BENCH_CASE(thread_pool_append)
+{
+    const int workers[] = {1, 4, 8};
+    std::vector<noop_task> tasks(TASKS);
+    for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+        std::atomic<long> done(0);
+        for (int i = 0; i < TASKS; ++i) {
+            tasks[i].done = &done;
+        }
+        // 构造时每个线程打印一行，不能混进结果里
+        std::streambuf* out = std::cout.rdbuf(nullptr);
+        // 线程已经分离，析构后还会在信号量上等待，所以一直不释放
+        threadPool<noop_task>* pool = new threadPool<noop_task>(
+            connection_pool::GetInstance(), workers[w]);
+        std::cout.rdbuf(out);
+        std::cout.clear();
+
+        uint64_t start = bench_now_ns();
+        for (int i = 0; i < TASKS; ++i) {
+            // 队列满时append失败，让出CPU等工作线程取走
+            while (!pool->append(&tasks[i])) {
+                sched_yield();
+            }
+        }
+        while (done.load(std::memory_order_relaxed) < TASKS) {
+            sched_yield();
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        char     name[64];
+        snprintf(name, sizeof(name), "thread_pool_append_%dw", workers[w]);
+        bench_report(name, TASKS, elapsed);
+    }
+}
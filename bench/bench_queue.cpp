@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "block_queue.h"
+#include "lockfree_queue.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <vector>
+
+// 日志队列的场景: 多个生产者push，一个消费者取出
+// 对比 逐个pop、批量pop_all、无锁队列的pop_all 三种消费方式，
+// 再看block_queue在不同生产者数下的锁竞争
+
+static const int PRODUCERS  = 4;
+static const int PER_THREAD = 500000;
+static const int QUEUE_SIZE = 4096;
+
+template <class Q> struct queue_bench {
+    Q    queue;
+    bool batch;
+    int  producers;
+
+    queue_bench(bool b, int p = PRODUCERS)
+        : queue(QUEUE_SIZE), batch(b), producers(p)
+    {
+    }
+
+    static void* produce(void* arg)
+    {
+        queue_bench* self = (queue_bench*)arg;
+        for (int i = 0; i < PER_THREAD; ++i) {
+            // 队列满时让出CPU重试，测的是完整交付全部元素的时间
+            while (!self->queue.push(i)) {
+                sched_yield();
+            }
+        }
+        return nullptr;
+    }
+
+    uint64_t run()
+    {
+        std::vector<pthread_t> tids(producers);
+        uint64_t               start = bench_now_ns();
+        for (int i = 0; i < producers; ++i) {
+            pthread_create(&tids[i], NULL, produce, this);
+        }
+        long             total = (long)producers * PER_THREAD;
+        long             got   = 0;
+        long             sum   = 0;
+        std::vector<int> items;
+        items.reserve(QUEUE_SIZE);
+        while (got < total) {
+            if (batch) {
+                items.clear();
+                queue.pop_all(items);
+                for (size_t k = 0; k < items.size(); ++k) {
+                    sum += items[k];
+                }
+                got += items.size();
+            }
+            else {
+                int item = 0;
+                queue.pop(item);
+                sum += item;
+                ++got;
+            }
+        }
+        bench_keep(sum);
+        for (int i = 0; i < producers; ++i) {
+            pthread_join(tids[i], NULL);
+        }
+        return bench_now_ns() - start;
+    }
+};
+
+BENCH_CASE(queue_block_pop)
+{
+    queue_bench<block_queue<int> > b(false);
+    bench_report("queue_block_pop", (long)PRODUCERS * PER_THREAD, b.run());
+}
+
+BENCH_CASE(queue_block_pop_all)
+{
+    queue_bench<block_queue<int> > b(true);
+    bench_report("queue_block_pop_all", (long)PRODUCERS * PER_THREAD, b.run());
+}
+
+BENCH_CASE(queue_lockfree_pop)
+{
+    queue_bench<lockfree_queue<int> > b(false);
+    bench_report("queue_lockfree_pop", (long)PRODUCERS * PER_THREAD, b.run());
+}
+
+BENCH_CASE(queue_lockfree_pop_all)
+{
+    queue_bench<lockfree_queue<int> > b(true);
+    bench_report(
+        "queue_lockfree_pop_all", (long)PRODUCERS * PER_THREAD, b.run());
+}
+
+BENCH_CASE(queue_block_contention)
+{
+    const int counts[] = {1, 2, 8, 16};
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        queue_bench<block_queue<int> > b(false, counts[i]);
+        char                           name[64];
+        snprintf(name, sizeof(name), "queue_block_pop_%dp", counts[i]);
+        bench_report(name, (long)counts[i] * PER_THREAD, b.run());
+    }
+}
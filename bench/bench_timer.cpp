@@ -0,0 +1,112 @@
+#include "bench.h"
+#include <netinet/in.h>  // lst_timer.h 用到sockaddr_in但没有自己包含
+#include "lst_timer.h"
+#include <vector>
+
+// 升序链表定时器: 链表里已有N个定时器时 add/adjust/tick 的单次开销
+// add和adjust要从头或者从原位置往后找插入点，开销随N线性增长，
+// 所以操作次数按N缩小，保证每组大约走1亿个节点
+
+static const long NODE_BUDGET = 100000000;
+static const int  SIZES[]     = {10000, 100000, 1000000};
+
+static void expire_noop(client_data*) {}
+
+static util_timer* new_timer(time_t expire)
+{
+    util_timer* t = new util_timer;
+    t->expire     = expire;
+    t->cb_func    = expire_noop;
+    t->user_data  = nullptr;
+    return t;
+}
+
+// 建一个有n个定时器的链表，到期时间为base到base+n-1，
+// 倒序插入，每次都插在表头，建表是O(n)
+static void fill_list(
+    sort_timer_list&          list,
+    std::vector<util_timer*>& timers,
+    int                       n,
+    time_t                    base)
+{
+    timers.resize(n);
+    for (int i = n - 1; i >= 0; --i) {
+        timers[i] = new_timer(base + i);
+        list.add_timer(timers[i]);
+    }
+}
+
+static long ops_for(int n)
+{
+    long ops = NODE_BUDGET / n;
+    return ops < 100 ? 100 : ops;
+}
+
+// 新连接的定时器: 到期时间最晚，插到表尾
+BENCH_CASE(timer_add)
+{
+    time_t base = time(NULL) + 3600;
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+        sort_timer_list          list;
+        std::vector<util_timer*> timers;
+        fill_list(list, timers, SIZES[s], base);
+        long                     ops = ops_for(SIZES[s]);
+        std::vector<util_timer*> added(ops);
+        for (long i = 0; i < ops; ++i) {
+            added[i] = new_timer(base + SIZES[s] + i);
+        }
+        uint64_t start = bench_now_ns();
+        for (long i = 0; i < ops; ++i) {
+            list.add_timer(added[i]);
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        char     name[64];
+        snprintf(name, sizeof(name), "timer_add_%d", SIZES[s]);
+        bench_report(name, ops, elapsed);
+    }
+}
+
+// 连接有活动时刷新定时器: 随机挑一个，到期时间改成最晚，往表尾挪
+BENCH_CASE(timer_adjust)
+{
+    time_t base = time(NULL) + 3600;
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+        sort_timer_list          list;
+        std::vector<util_timer*> timers;
+        fill_list(list, timers, SIZES[s], base);
+        long     ops    = ops_for(SIZES[s]);
+        uint64_t rng    = 88172645463325252ull;
+        time_t   expire = base + SIZES[s];
+        uint64_t start  = bench_now_ns();
+        for (long i = 0; i < ops; ++i) {
+            rng ^= rng << 13;
+            rng ^= rng >> 7;
+            rng ^= rng << 17;
+            util_timer* t = timers[rng % SIZES[s]];
+            t->expire     = expire++;
+            list.adjust_timer(t);
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        char     name[64];
+        snprintf(name, sizeof(name), "timer_adjust_%d", SIZES[s]);
+        bench_report(name, ops, elapsed);
+    }
+}
+
+// 一次tick处理全部到期的定时器，按每个到期定时器计
+BENCH_CASE(timer_tick)
+{
+    Log::get_instance()->set_level(4);  // tick里的INFO日志不计入
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); ++s) {
+        sort_timer_list          list;
+        std::vector<util_timer*> timers;
+        fill_list(list, timers, SIZES[s], 0);
+        uint64_t start = bench_now_ns();
+        list.tick();
+        uint64_t elapsed = bench_now_ns() - start;
+        bench_keep(list.size());
+        char name[64];
+        snprintf(name, sizeof(name), "timer_tick_%d", SIZES[s]);
+        bench_report(name, SIZES[s], elapsed);
+    }
+}
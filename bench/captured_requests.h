@@ -0,0 +1,87 @@
+#ifndef CAPTURED_REQUESTS_H
+#define CAPTURED_REQUESTS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+// 基准测试共用的几种典型请求，和一个放着它们要访问的文件的临时网站根目录
+
+struct captured_request {
+    const char* name;
+    const char* text;
+};
+
+static const captured_request captured_requests[] = {
+    {"curl",
+     "GET /page.html HTTP/1.1\r\n"
+     "Host: 127.0.0.1:10000\r\n"
+     "User-Agent: curl/8.5.0\r\n"
+     "Accept: */*\r\n"
+     "\r\n"},
+    {"browser",
+     "GET /page.html HTTP/1.1\r\n"
+     "Host: 127.0.0.1:10000\r\n"
+     "Connection: keep-alive\r\n"
+     "Cache-Control: max-age=0\r\n"
+     "sec-ch-ua: \"Chromium\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+     "sec-ch-ua-mobile: ?0\r\n"
+     "sec-ch-ua-platform: \"Linux\"\r\n"
+     "Upgrade-Insecure-Requests: 1\r\n"
+     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+     "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+     "image/avif,image/webp,*/*;q=0.8\r\n"
+     "Sec-Fetch-Site: none\r\n"
+     "Sec-Fetch-Mode: navigate\r\n"
+     "Sec-Fetch-Dest: document\r\n"
+     "Accept-Encoding: gzip, deflate, br\r\n"
+     "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+     "\r\n"},
+    {"post_login",
+     "POST /2 HTTP/1.1\r\n"
+     "Host: 127.0.0.1:10000\r\n"
+     "Connection: keep-alive\r\n"
+     "Content-Type: application/x-www-form-urlencoded\r\n"
+     "Content-Length: 25\r\n"
+     "\r\n"
+     "user=bench&password=bench"},
+};
+
+static const int CAPTURED_REQUESTS =
+    sizeof(captured_requests) / sizeof(captured_requests[0]);
+
+// 临时的网站根目录，放解析后要打开的几个文件
+static inline std::string make_doc_root()
+{
+    char dir[] = "/tmp/webserver_bench_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    const char* files[] = {"page.html", "welcome.html", "logError.html"};
+    std::string page(1024, 'x');
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        std::string path = std::string(dir) + "/" + files[i];
+        FILE*       f    = fopen(path.c_str(), "w");
+        if (!f) {
+            perror(path.c_str());
+            exit(1);
+        }
+        fputs(page.c_str(), f);
+        fclose(f);
+    }
+    return dir;
+}
+
+static inline void remove_doc_root(const std::string& dir)
+{
+    const char* files[] = {"page.html", "welcome.html", "logError.html"};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+        unlink((dir + "/" + files[i]).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+#endif
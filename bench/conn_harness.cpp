@@ -0,0 +1,436 @@
+#include "captured_requests.h"
+#include "http_conn.h"
+#include "log.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// 单连接处理路径的进程内测试: 用socketpair的一端作为连接socket，
+// 按主线程和工作线程的顺序调用 read() -> process() -> write()，不经过epoll_wait、
+// 线程池和定时器。对方一端负责发请求和收响应，这部分不计时。
+// 每条请求输出一行JSON: 耗时、计时区间内的malloc次数和字节数、响应字节数
+//
+// 用法: webserver_harness [-f corpus] [-r doc_root] [-n iterations] [-p]
+//   -f 语料文件，原样拼接的若干个HTTP请求，按空行和Content-Length切分；
+//      不给时用内置的几种典型请求和一个临时网站根目录
+//   -r 网站根目录，用-f时需要
+//   -n 每条请求重复的次数，默认20000
+//   -p 不测性能，检查流水线: 内置请求一次发出，每个请求都要有响应，
+//      失败时退出码为1
+
+extern const char*                        doc_root;
+extern std::map<std::string, std::string> users;
+
+// 计数的malloc: 转给glibc的实现，只在g_counting时统计。测试是单线程的
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void  __libc_free(void* p);
+}
+
+static bool     g_counting    = false;
+static uint64_t g_alloc_count = 0;
+static uint64_t g_alloc_bytes = 0;
+
+extern "C" void* malloc(size_t size)
+{
+    if (g_counting) {
+        ++g_alloc_count;
+        g_alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    if (g_counting) {
+        ++g_alloc_count;
+        g_alloc_bytes += n * size;
+    }
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size)
+{
+    if (g_counting) {
+        ++g_alloc_count;
+        g_alloc_bytes += size;
+    }
+    return __libc_realloc(p, size);
+}
+
+extern "C" void free(void* p)
+{
+    __libc_free(p);
+}
+
+static uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// http_conn把它声明为友元，这里只用来看连接是否已经被关闭
+struct http_conn_bench {
+    static bool closed(const http_conn& c)
+    {
+        return c.m_sockfd == -1;
+    }
+};
+
+struct harness_stats {
+    uint64_t ns;
+    uint64_t allocs;
+    uint64_t alloc_bytes;
+    uint64_t response_bytes;
+    long     requests;
+    long     reconnects;
+};
+
+// 一条被测的连接和它的对端
+struct harness_conn {
+    http_conn* conn;
+    int        peer;
+};
+
+static void connect_conn(harness_conn& h)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    fcntl(sv[1], F_SETFL, fcntl(sv[1], F_GETFL) | O_NONBLOCK);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    h.conn->init(sv[0], addr);  // 设为非阻塞并加入epoll
+    h.peer = sv[1];
+}
+
+static void disconnect_conn(harness_conn& h)
+{
+    h.conn->close_conn();
+    if (h.peer >= 0) {
+        close(h.peer);
+        h.peer = -1;
+    }
+}
+
+// 收走对端已经收到的响应，返回字节数
+static uint64_t drain_peer(int peer)
+{
+    char     buf[65536];
+    uint64_t total = 0;
+    while (true) {
+        ssize_t n = recv(peer, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+static void counting_start()
+{
+    g_counting = true;
+}
+
+static void counting_stop()
+{
+    g_counting = false;
+}
+
+// 处理一个请求，计时和计数只包括连接这一侧的调用
+static void run_once(harness_conn& h, const std::string& req, harness_stats& st)
+{
+    if (h.peer < 0) {
+        connect_conn(h);
+        ++st.reconnects;
+    }
+    if (send(h.peer, req.data(), req.size(), 0) != (ssize_t)req.size()) {
+        perror("send");
+        exit(1);
+    }
+
+    uint64_t start = now_ns();
+    counting_start();
+    bool ok = h.conn->read();
+    if (ok) {
+        h.conn->enqueue();
+        h.conn->process();
+        ok = !http_conn_bench::closed(*h.conn);
+    }
+    while (ok) {
+        ok = h.conn->write();
+        if (!ok || h.conn->keepalive_idle()) {
+            break;
+        }
+        // 对端缓冲区满了，收走之后接着写，收的时间不算
+        counting_stop();
+        st.ns += now_ns() - start;
+        st.response_bytes += drain_peer(h.peer);
+        start = now_ns();
+        counting_start();
+    }
+    counting_stop();
+    st.ns += now_ns() - start;
+
+    st.response_bytes += drain_peer(h.peer);
+    ++st.requests;
+    if (!ok) {
+        // 短连接、出错或者服务器主动关闭，下一次重新建立连接
+        disconnect_conn(h);
+    }
+}
+
+// 响应里的状态行个数，响应体后面紧跟着下一个状态行，前面没有换行
+static int count_responses(const std::string& out)
+{
+    int    n   = 0;
+    size_t pos = 0;
+    while ((pos = out.find("HTTP/1.1 ", pos)) != std::string::npos) {
+        ++n;
+        pos += 9;
+    }
+    return n;
+}
+
+// 流水线: 几个请求一次发出，连接按顺序处理，每个响应发完之后缓冲区里
+// 剩下的请求由主线程直接交给线程池，这里直接调用process
+static bool check_pipelining(harness_conn& h)
+{
+    // POST后面紧跟GET，检查请求体末尾被截断的字节能还原
+    const int   order[] = {0, 2, 0, 1, 0};
+    const int   count   = sizeof(order) / sizeof(order[0]);
+    std::string burst;
+    for (int i = 0; i < count; ++i) {
+        burst += captured_requests[order[i]].text;
+    }
+    connect_conn(h);
+    if (send(h.peer, burst.data(), burst.size(), 0) != (ssize_t)burst.size()) {
+        perror("send");
+        exit(1);
+    }
+
+    std::string out;
+    char        buf[65536];
+    bool        ok = h.conn->read();
+    while (ok) {
+        h.conn->enqueue();
+        h.conn->process();
+        ok = !http_conn_bench::closed(*h.conn);
+        while (ok) {
+            ok = h.conn->write();
+            ssize_t n;
+            while ((n = recv(h.peer, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+                out.append(buf, n);
+            }
+            if (!ok || h.conn->keepalive_idle() || h.conn->pipelined()) {
+                break;
+            }
+        }
+        if (!ok || !h.conn->pipelined()) {
+            break;
+        }
+    }
+    int responses = count_responses(out);
+    printf(
+        "{\"check\":\"pipelining\",\"requests\":%d,\"responses\":%d,"
+        "\"ok\":%s}\n",
+        count, responses, responses == count ? "true" : "false");
+    fflush(stdout);
+    disconnect_conn(h);
+    return responses == count;
+}
+
+// 语料文件: 头部以空行结束，后面跟Content-Length字节的请求体
+static bool load_corpus(const char* path, std::vector<std::string>& out)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    std::string data;
+    char        buf[65536];
+    size_t      n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(f);
+
+    size_t pos = 0;
+    while (pos < data.size()) {
+        // 请求之间多余的换行
+        if (data[pos] == '\r' || data[pos] == '\n') {
+            ++pos;
+            continue;
+        }
+        size_t end = data.find("\r\n\r\n", pos);
+        if (end == std::string::npos) {
+            fprintf(stderr, "%s: incomplete request at offset %zu\n", path, pos);
+            break;
+        }
+        end += 4;
+        std::string head = data.substr(pos, end - pos);
+        for (size_t i = 0; i < head.size(); ++i) {
+            head[i] = tolower((unsigned char)head[i]);
+        }
+        size_t body = 0;
+        size_t cl   = head.find("\r\ncontent-length:");
+        if (cl != std::string::npos) {
+            body = strtoul(head.c_str() + cl + 17, NULL, 10);
+        }
+        if (end + body > data.size()) {
+            fprintf(stderr, "%s: truncated body at offset %zu\n", path, pos);
+            break;
+        }
+        std::string req = data.substr(pos, end + body - pos);
+        if (req.size() >= (size_t)http_conn::READ_BUFFER_SIZE) {
+            fprintf(stderr, "%s: skip request of %zu bytes at offset %zu\n",
+                    path, req.size(), pos);
+        }
+        else {
+            out.push_back(req);
+        }
+        pos = end + body;
+    }
+    return true;
+}
+
+// 请求行，作为结果里这条请求的名字
+static std::string request_name(const std::string& req)
+{
+    std::string line = req.substr(0, req.find("\r\n"));
+    std::string out;
+    for (size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '"' || line[i] == '\\') {
+            out += '\\';
+        }
+        out += line[i];
+    }
+    return out;
+}
+
+static void report(const char* name, const harness_stats& st)
+{
+    double n = st.requests > 0 ? st.requests : 1;
+    printf(
+        "{\"request\":\"%s\",\"iterations\":%ld,\"reconnects\":%ld,"
+        "\"ns_per_request\":%.1f,\"allocs_per_request\":%.2f,"
+        "\"alloc_bytes_per_request\":%.1f,\"response_bytes\":%.1f}\n",
+        name, st.requests, st.reconnects, st.ns / n, st.allocs / n,
+        st.alloc_bytes / n, st.response_bytes / n);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* corpus     = nullptr;
+    const char* root       = nullptr;
+    long        iterations = 20000;
+    bool        pipelining = false;
+    int         opt;
+    while ((opt = getopt(argc, argv, "f:r:n:ph")) != -1) {
+        switch (opt) {
+        case 'f': corpus = optarg; break;
+        case 'r': root = optarg; break;
+        case 'n': iterations = atol(optarg); break;
+        case 'p': pipelining = true; break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-f corpus] [-r doc_root] [-n iterations] "
+                    "[-p]\n",
+                    argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    std::vector<std::string> requests;
+    std::vector<std::string> names;
+    std::string              temp_root;
+    if (corpus && !pipelining) {
+        if (!load_corpus(corpus, requests) || requests.empty()) {
+            fprintf(stderr, "no requests in %s\n", corpus);
+            return 1;
+        }
+        for (size_t i = 0; i < requests.size(); ++i) {
+            names.push_back(request_name(requests[i]));
+        }
+    }
+    else {
+        for (int i = 0; i < CAPTURED_REQUESTS; ++i) {
+            requests.push_back(captured_requests[i].text);
+            names.push_back(captured_requests[i].name);
+        }
+        temp_root = make_doc_root();
+        root      = temp_root.c_str();
+    }
+    if (root) {
+        doc_root = root;
+    }
+
+    // 日志会盖过请求处理本身，关掉
+    Log::get_instance()->set_level(4);
+    users["bench"]                      = "bench";
+    http_conn::m_max_keepalive_requests = 0;
+    // 连接会加入这个epoll，但不会有人在上面等待
+    http_conn::m_epollfd = epoll_create(5);
+
+    harness_conn h = {new http_conn, -1};
+    if (pipelining) {
+        bool passed = check_pipelining(h);
+        delete h.conn;
+        close(http_conn::m_epollfd);
+        remove_doc_root(temp_root);
+        return passed ? 0 : 1;
+    }
+
+    harness_stats total = {};
+    for (size_t r = 0; r < requests.size(); ++r) {
+        harness_stats st = {};
+        // 先跑一次，让文件缓存、压缩库等初始化不算进结果
+        run_once(h, requests[r], st);
+        st              = harness_stats();
+        g_alloc_count   = 0;
+        g_alloc_bytes   = 0;
+        for (long i = 0; i < iterations; ++i) {
+            run_once(h, requests[r], st);
+        }
+        st.allocs      = g_alloc_count;
+        st.alloc_bytes = g_alloc_bytes;
+        report(names[r].c_str(), st);
+
+        total.ns += st.ns;
+        total.allocs += st.allocs;
+        total.alloc_bytes += st.alloc_bytes;
+        total.response_bytes += st.response_bytes;
+        total.requests += st.requests;
+        total.reconnects += st.reconnects;
+    }
+    report("total", total);
+
+    disconnect_conn(h);
+    delete h.conn;
+    close(http_conn::m_epollfd);
+    if (!temp_root.empty()) {
+        remove_doc_root(temp_root);
+    }
+    return 0;
+}
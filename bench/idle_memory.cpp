@@ -0,0 +1,167 @@
+#include "captured_requests.h"
+#include "http_conn.h"
+#include "log.h"
+#include "lst_timer.h"
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// 空闲长连接的内存: 建N个连接，每个按main.cpp的方式配好client_data和定时器，
+// 处理一个请求之后变成空闲的长连接，看进程RSS增加了多少，分别在
+// 缓冲区常驻(默认)和空闲时还给缓冲区池(-k)两种模式下测。
+// 每次测量在单独的子进程里做，互不影响。每行输出一个JSON对象
+//
+// 用法: webserver_idlemem [连接数...]，默认 10000 100000 1000000
+// 估计内存不够时跳过这一项
+
+extern const char*                        doc_root;
+extern std::map<std::string, std::string> users;
+
+// http_conn把它声明为友元，用来不经过socket处理一个请求
+struct http_conn_bench {
+    static void serve(http_conn& c, const char* text, int len)
+    {
+        c.init();
+        c.m_sockfd = -1;
+        c.attach_buffers();
+        memcpy(c.m_read_buf, text, len);
+        c.m_read_idx = len;
+        c.process_write(c.process_read());
+        c.end_stream();
+        c.unmap();
+        // 响应发完，和write()里一样重置成等待下一个请求的状态
+        c.init();
+    }
+};
+
+static void expire_noop(client_data*) {}
+
+// 当前进程的常驻内存，KB
+static long rss_kb()
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    long  pages = 0, resident = 0;
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long mem_available_kb()
+{
+    FILE* f = fopen("/proc/meminfo", "r");
+    char  line[256];
+    long  kb = 0;
+    while (f && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    return kb;
+}
+
+// 在子进程里建n个空闲连接并输出结果
+static void measure(long n, bool compact, const char* request)
+{
+    http_conn::m_compact_idle = compact;
+    int  len    = strlen(request);
+    long before = rss_kb();
+
+    http_conn*       conns  = new http_conn[n];
+    client_data*     data   = new client_data[n];
+    sort_timer_list* timers = new sort_timer_list;
+    time_t           base   = time(NULL) + 3600;
+    // 倒序插入，每个定时器都插在表头，建表是O(n)
+    for (long i = n - 1; i >= 0; --i) {
+        http_conn_bench::serve(conns[i], request, len);
+        util_timer* t     = new util_timer;
+        t->expire         = base + i;
+        t->cb_func        = expire_noop;
+        t->user_data      = &data[i];
+        data[i].sockfd    = (int)i;
+        data[i].timer     = t;
+        memset(&data[i].address, 0, sizeof(data[i].address));
+        timers->add_timer(t);
+    }
+
+    long after = rss_kb();
+    printf(
+        "{\"bench\":\"idle_memory\",\"compact\":%s,\"connections\":%ld,"
+        "\"rss_kb\":%ld,\"bytes_per_conn\":%.0f,\"buffers_in_use\":%ld,"
+        "\"buffers_free\":%d}\n",
+        compact ? "true" : "false", n, after - before,
+        n > 0 ? (after - before) * 1024.0 / n : 0.0,
+        http_conn::buffers().in_use(),
+        http_conn::buffers().free_count());
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<long> sizes;
+    for (int i = 1; i < argc; ++i) {
+        sizes.push_back(atol(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes.push_back(10000);
+        sizes.push_back(100000);
+        sizes.push_back(1000000);
+    }
+
+    Log::get_instance()->set_level(4);
+    std::string root = make_doc_root();
+    doc_root         = root.c_str();
+    users["bench"]   = "bench";
+    // curl的请求，响应是小文件，不走压缩
+    const char* request = captured_requests[0].text;
+
+    printf(
+        "{\"bench\":\"idle_memory_sizes\",\"http_conn\":%zu,"
+        "\"buffer_block\":%d,\"client_data\":%zu,\"util_timer\":%zu}\n",
+        sizeof(http_conn), http_conn::BUFFER_BLOCK_SIZE, sizeof(client_data),
+        sizeof(util_timer));
+    fflush(stdout);
+
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        for (int compact = 0; compact < 2; ++compact) {
+            long n = sizes[s];
+            // 连接本身、缓冲区块(常驻模式)和每个连接的定时器、malloc开销
+            long need = n * (sizeof(http_conn) + sizeof(client_data) +
+                             sizeof(util_timer) + 32 +
+                             (compact ? 0 : http_conn::BUFFER_BLOCK_SIZE)) /
+                        1024;
+            if (need > mem_available_kb() * 8 / 10) {
+                printf(
+                    "{\"bench\":\"idle_memory\",\"compact\":%s,"
+                    "\"connections\":%ld,\"skipped\":\"needs about %ld MB\"}\n",
+                    compact ? "true" : "false", n, need / 1024);
+                fflush(stdout);
+                continue;
+            }
+            pid_t pid = fork();
+            if (pid == 0) {
+                measure(n, compact, request);
+                _exit(0);
+            }
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "measure %ld connections failed\n", n);
+            }
+        }
+    }
+
+    users.erase("bench");
+    remove_doc_root(root);
+    return 0;
+}
@@ -0,0 +1,342 @@
+#include <netinet/in.h>  // lst_timer.h 用到sockaddr_in但没有自己包含
+#include "lst_timer.h"
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// 定时器模拟: 用模拟时钟重放连接的建立、请求和关闭，定时器用和main.cpp
+// 同一个conn_timer_list维护(建连和收到请求时超时为3个TIMESLOT，响应发完后
+// 为keep-alive超时，每个TIMESLOT tick一次)，不用真的等待。收到请求之后
+// 过了处理时间才发完响应，这时连接没有别的请求在处理就按空闲刷新。
+// 输出一行JSON: 各种定时器操作的实际耗时，以及到期的准确程度
+// (tick时比应到期时间晚了多少)
+//
+// 用法: webserver_timersim [-c conns] [-a rate] [-q requests] [-g gap]
+//                          [-x close%] [-s slot] [-k keepalive] [-v service]
+//                          [-f trace]
+//   -c 连接数，默认20000       -a 每秒新建的连接数，默认1000
+//   -q 每个连接的请求数，默认5  -g 请求间隔在0到gap秒之间均匀分布，默认10
+//   -x 最后一个请求之后由客户端关闭的连接比例，其余等超时，默认50
+//   -s TIMESLOT，默认5          -k keep-alive超时，默认15
+//   -v 处理一个请求的时间(秒)，默认1
+//   -f 从文件读事件而不是生成，每行"秒 open|active|close 连接号"
+
+// SIM_DONE是SIM_ACTIVE之后过了处理时间、响应发完，由模拟器自己生成
+enum sim_op { SIM_OPEN, SIM_ACTIVE, SIM_DONE, SIM_CLOSE };
+
+struct sim_event {
+    time_t t;
+    int    op;
+    int    conn;
+};
+
+struct sim_conn {
+    client_data data;
+    bool        alive;
+    int         pending;   // 收到了、响应还没发完的请求数
+    time_t      deadline;  // 按规则应该到期的时间
+};
+
+struct sim_options {
+    int  conns;
+    int  rate;
+    int  requests;
+    int  gap;
+    int  close_percent;
+    int  slot;
+    int  keepalive;
+    int  service;
+    const char* trace;
+};
+
+// 操作次数和累计耗时
+struct sim_cost {
+    long     ops;
+    uint64_t ns;
+};
+
+static time_t                g_now = 0;
+static std::vector<sim_conn> g_conns;
+static long                  g_expired      = 0;
+static long                  g_late_total   = 0;
+static long                  g_late_max     = 0;
+static long                  g_late_overdue = 0;  // 晚了一个TIMESLOT以上
+static long                  g_early        = 0;
+static int                   g_slot         = 5;
+
+static time_t sim_clock()
+{
+    return g_now;
+}
+
+static uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 定时器到期: 对应main.cpp的cb_func，这里记录到期的时间差
+static void sim_expire(client_data* data)
+{
+    sim_conn& c    = g_conns[data->sockfd];
+    long      late = g_now - c.deadline;
+    c.alive        = false;
+    ++g_expired;
+    if (late < 0) {
+        ++g_early;
+        return;
+    }
+    g_late_total += late;
+    g_late_max = std::max(g_late_max, late);
+    if (late >= g_slot) {
+        ++g_late_overdue;
+    }
+}
+
+static unsigned next_rand(uint64_t& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return (unsigned)(s >> 32);
+}
+
+// 连接i在第i/rate秒建立，之后每隔0到gap秒来一个请求
+static void generate(const sim_options& o, std::vector<sim_event>& events)
+{
+    uint64_t rng = 88172645463325252ull;
+    for (int i = 0; i < o.conns; ++i) {
+        time_t t = i / o.rate;
+        events.push_back({t, SIM_OPEN, i});
+        for (int r = 0; r < o.requests; ++r) {
+            if (r > 0) {
+                t += next_rand(rng) % (o.gap + 1);
+            }
+            events.push_back({t, SIM_ACTIVE, i});
+        }
+        if ((int)(next_rand(rng) % 100) < o.close_percent) {
+            t += next_rand(rng) % (o.gap + 1);
+            events.push_back({t, SIM_CLOSE, i});
+        }
+    }
+}
+
+static bool event_before(const sim_event& a, const sim_event& b)
+{
+    return a.t < b.t;
+}
+
+static bool load_trace(const char* path, std::vector<sim_event>& events,
+                       int& conns)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    std::map<long, int> ids;  // 文件里的连接号映射到从0开始的下标
+    char                op[16];
+    long                t, id;
+    int                 line = 0;
+    while (fscanf(f, "%ld %15s %ld", &t, op, &id) == 3) {
+        ++line;
+        sim_event e = {t, SIM_OPEN, 0};
+        if (strcmp(op, "active") == 0) {
+            e.op = SIM_ACTIVE;
+        }
+        else if (strcmp(op, "close") == 0) {
+            e.op = SIM_CLOSE;
+        }
+        else if (strcmp(op, "open") != 0) {
+            fprintf(stderr, "%s:%d: unknown event %s\n", path, line, op);
+            fclose(f);
+            return false;
+        }
+        std::map<long, int>::iterator it = ids.find(id);
+        if (it == ids.end()) {
+            it = ids.insert(std::make_pair(id, (int)ids.size())).first;
+        }
+        e.conn = it->second;
+        events.push_back(e);
+    }
+    fclose(f);
+    conns = ids.size();
+    return true;
+}
+
+// 每个请求过了处理时间之后响应发完
+static void add_done_events(std::vector<sim_event>& events, int service)
+{
+    size_t n = events.size();
+    for (size_t i = 0; i < n; ++i) {
+        if (events[i].op == SIM_ACTIVE) {
+            events.push_back({events[i].t + service, SIM_DONE, events[i].conn});
+        }
+    }
+}
+
+// 刷新定时器，对应main.cpp的refresh_timer
+static void refresh(conn_timer_list& timers, sim_conn& c, bool idle,
+                    sim_cost& cost)
+{
+    uint64_t start = now_ns();
+    timers.refresh(c.data.timer, idle);
+    cost.ns += now_ns() - start;
+    ++cost.ops;
+    c.deadline = c.data.timer->expire;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(stderr,
+            "usage: %s [-c conns] [-a rate] [-q requests] [-g gap] "
+            "[-x close%%] [-s slot] [-k keepalive] [-v service] "
+            "[-f trace]\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    sim_options o = {20000, 1000, 5, 10, 50, 5, 15, 1, nullptr};
+    int         opt;
+    while ((opt = getopt(argc, argv, "c:a:q:g:x:s:k:v:f:h")) != -1) {
+        switch (opt) {
+        case 'c': o.conns = atoi(optarg); break;
+        case 'a': o.rate = atoi(optarg); break;
+        case 'q': o.requests = atoi(optarg); break;
+        case 'g': o.gap = atoi(optarg); break;
+        case 'x': o.close_percent = atoi(optarg); break;
+        case 's': o.slot = atoi(optarg); break;
+        case 'k': o.keepalive = atoi(optarg); break;
+        case 'v': o.service = atoi(optarg); break;
+        case 'f': o.trace = optarg; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (o.conns <= 0 || o.rate <= 0 || o.requests < 0 || o.gap < 0 ||
+        o.slot <= 0 || o.keepalive <= 0 || o.service < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    g_slot = o.slot;
+
+    std::vector<sim_event> events;
+    if (o.trace) {
+        if (!load_trace(o.trace, events, o.conns)) {
+            return 1;
+        }
+    }
+    else {
+        generate(o, events);
+    }
+    add_done_events(events, o.service);
+    std::stable_sort(events.begin(), events.end(), event_before);
+
+    // tick里每次写一条INFO日志，不计入
+    Log::get_instance()->set_level(4);
+    g_conns.resize(o.conns);
+    for (int i = 0; i < o.conns; ++i) {
+        g_conns[i].data.sockfd = i;
+        g_conns[i].data.timer  = nullptr;
+        g_conns[i].alive       = false;
+        g_conns[i].pending     = 0;
+    }
+
+    conn_timer_list timers(o.slot, sim_clock);
+    timers.set_keepalive(o.keepalive);
+    sim_cost        add = {}, adjust = {}, del = {}, tick = {};
+    long            dropped  = 0;  // 连接已经被定时器关闭之后客户端的事件
+    int             max_size = 0;
+    g_now                    = events.empty() ? 0 : events[0].t;
+    time_t   next_tick       = g_now + o.slot;
+    uint64_t wall_start      = now_ns();
+
+    size_t i = 0;
+    while (i < events.size() || timers.size() > 0) {
+        // 下一个事件之前的tick，事件处理完之后一直tick到全部到期
+        if (i == events.size() || next_tick <= events[i].t) {
+            g_now          = next_tick;
+            uint64_t start = now_ns();
+            timers.tick();
+            tick.ns += now_ns() - start;
+            ++tick.ops;
+            next_tick += o.slot;
+            continue;
+        }
+        const sim_event& e = events[i++];
+        sim_conn&        c = g_conns[e.conn];
+        g_now              = e.t;
+        if (e.op == SIM_OPEN) {
+            if (c.alive) {
+                continue;  // 文件里重复的open
+            }
+            util_timer* timer = new util_timer;
+            timer->user_data  = &c.data;
+            timer->cb_func    = sim_expire;
+            c.data.timer      = timer;
+            c.alive           = true;
+            c.pending         = 0;
+            uint64_t start    = now_ns();
+            timers.add(timer);
+            add.ns += now_ns() - start;
+            ++add.ops;
+            c.deadline = timer->expire;
+            max_size   = std::max(max_size, timers.size());
+        }
+        else if (!c.alive) {
+            // 被定时器关闭的连接上客户端的事件，服务器自己的不算
+            if (e.op != SIM_DONE) {
+                ++dropped;
+            }
+        }
+        else if (e.op == SIM_ACTIVE) {
+            // 收到请求，处理期间的超时
+            ++c.pending;
+            refresh(timers, c, false, adjust);
+        }
+        else if (e.op == SIM_DONE) {
+            // 响应发完，没有别的请求在处理就变成空闲的长连接
+            if (c.pending > 0) {
+                --c.pending;
+            }
+            refresh(timers, c, c.pending == 0, adjust);
+        }
+        else {
+            uint64_t start = now_ns();
+            timers.del(c.data.timer);
+            del.ns += now_ns() - start;
+            ++del.ops;
+            c.alive = false;
+        }
+    }
+    uint64_t wall_ns = now_ns() - wall_start;
+
+    double sim_s  = events.empty() ? 0 : (double)(g_now - events[0].t);
+    double wall_s = wall_ns / 1e9;
+    printf(
+        "{\"connections\":%d,\"events\":%zu,\"sim_seconds\":%.0f,"
+        "\"wall_seconds\":%.3f,\"speedup\":%.0f,\"max_timers\":%d,"
+        "\"add\":{\"ops\":%ld,\"ns_per_op\":%.1f},"
+        "\"adjust\":{\"ops\":%ld,\"ns_per_op\":%.1f},"
+        "\"del\":{\"ops\":%ld,\"ns_per_op\":%.1f},"
+        "\"tick\":{\"ops\":%ld,\"ns_per_op\":%.1f,\"ns_per_expired\":%.1f},"
+        "\"expiry\":{\"expired\":%ld,\"avg_late_s\":%.2f,\"max_late_s\":%ld,"
+        "\"overdue\":%ld,\"early\":%ld},\"dropped_events\":%ld}\n",
+        o.conns, events.size(), sim_s, wall_s,
+        wall_s > 0 ? sim_s / wall_s : 0.0, max_size, add.ops,
+        add.ops ? (double)add.ns / add.ops : 0.0, adjust.ops,
+        adjust.ops ? (double)adjust.ns / adjust.ops : 0.0, del.ops,
+        del.ops ? (double)del.ns / del.ops : 0.0, tick.ops,
+        tick.ops ? (double)tick.ns / tick.ops : 0.0,
+        g_expired ? (double)tick.ns / g_expired : 0.0, g_expired,
+        g_expired ? (double)g_late_total / g_expired : 0.0, g_late_max,
+        g_late_overdue, g_early, dropped);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <netinet/in.h>
+#include <time.h>
+
+// 访问日志: 每个请求一行，写到单独的Log实例(每线程缓冲后端)
+// 字段: 客户端 方法 路径 状态码 发送字节数 排队时间 处理时间 总时间 CPU时间(微秒)
+// 排队时间为交给线程池到工作线程开始处理，处理时间为工作线程解析和生成响应，
+// 总时间为收到请求的第一批数据到响应发完，CPU时间为主线程和工作线程之和
+//
+// 采样: 每个线程每sample个请求记录一个，5xx和超过slow_ms的慢请求总是记录。
+// 4xx多由客户端造成，和普通请求一样采样，避免扫描流量把日志写满
+// 慢请求另外在服务器日志里写一条WARN，带上各阶段的耗时
+
+// 初始化访问日志，sample为0时只记录错误和慢请求
+bool access_log_init(const char* filename, int sample, int slow_ms, bool binary);
+
+// 单调时钟，微秒，用于请求各阶段的计时
+inline long long access_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 当前线程用掉的CPU时间，微秒。不走vDSO，每次是一次系统调用
+inline long long access_cpu_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 一个已经完成的请求，时间都是微秒
+struct access_record {
+    const sockaddr_in* addr;
+    const char*        method;
+    const char*        path;
+    const char*        route;  // do_request分派到的路由
+    int                status;
+    long               bytes;
+    long long          recv_us;        // 第一批数据到请求收完
+    long long          queue_us;       // 在线程池队列里等待
+    long long          parse_us;       // 解析，不含do_request
+    long long          do_request_us;  // do_request
+    long long          build_us;       // 生成响应头
+    long long          service_us;     // 工作线程处理的总时间
+    long long          write_us;       // 生成响应之后到发送完毕
+    long long          total_us;       // 第一批数据到响应发完
+    long long          reactor_cpu_us;  // 主线程读写的CPU时间
+    long long          worker_cpu_us;   // 工作线程的CPU时间
+};
+
+// 是否超过了慢请求的阈值
+bool access_log_slow(long long total_us);
+
+// 记录一个已经完成的请求，是否写入由采样规则决定
+void access_log_request(const access_record& r);
+
+#endif
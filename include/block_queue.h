@@ -1,6 +1,7 @@
 /*************************************************************
  *循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;
  *线程安全，每个操作前都要先加互斥锁，操作完后，再解锁
+ *单消费者的场景可以用lockfree_queue.h中接口相同的无锁队列
  **************************************************************/
 
 #ifndef BLOCK_QUEUE_H
@@ -11,6 +12,8 @@
 #include <pthread.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <utility>
+#include <vector>
 
 template <class T> class block_queue {
 private:
@@ -94,14 +97,14 @@ public:
         return tmp;
     }
 
-    //往队列添加元素，需要将所有使用队列的线程先唤醒
+    //往队列添加元素，队列满时返回false，调用者不需要先调用full()
     //当有元素push进队列,相当于生产者生产了一个元素
-    //若当前没有线程等待条件变量,则唤醒无意义
+    //一个元素只够一个消费者处理，只唤醒一个等待的线程而不是全部，
+    //没有线程等待时signal不进内核
     bool push(const T& item)
     {
         m_mutex.lock();
         if (m_size >= m_max_size) {
-            m_cond.broadcast();
             m_mutex.unlock();
             return false;
         }
@@ -109,7 +112,7 @@ public:
         m_back          = (m_back + 1) % m_max_size;
         m_array[m_back] = item;
         m_size++;
-        m_cond.broadcast();
+        m_cond.signal();
         m_mutex.unlock();
         return true;
     }
@@ -163,6 +166,38 @@ public:
         m_mutex.unlock();
         return true;
     }
+
+    // 一次加锁取走队列里的全部元素，追加到items，队列为空时等待
+    // 消费者每批只竞争一次锁，元素用swap取出，不复制
+    bool pop_all(std::vector<T>& items)
+    {
+        return pop_batch(items, m_max_size);
+    }
+
+    // 同pop_all，但一次最多取max_items个
+    bool pop_batch(std::vector<T>& items, int max_items)
+    {
+        m_mutex.lock();
+        while (m_size <= 0) {
+            if (!m_cond.wait(m_mutex.get())) {
+                m_mutex.unlock();
+                return false;
+            }
+        }
+        int n = m_size < max_items ? m_size : max_items;
+        for (int i = 0; i < n; ++i) {
+            m_front = (m_front + 1) % m_max_size;
+            items.push_back(T());
+            std::swap(items.back(), m_array[m_front]);
+        }
+        m_size -= n;
+        // 取完后还有剩余，交给其他等待的消费者
+        if (m_size > 0) {
+            m_cond.signal();
+        }
+        m_mutex.unlock();
+        return true;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef BODY_PRODUCER_H
+#define BODY_PRODUCER_H
+
+#include <string.h>
+#include <string>
+
+// 流式响应体的生产者，由具体的处理函数实现
+// 连接以 Transfer-Encoding: chunked 发送，只有上一块完全写进socket之后
+// 才会要下一块，所以内存占用只和一块的大小有关，与响应体总长度无关
+class body_producer {
+public:
+    virtual ~body_producer() {}
+
+    // 往buf写入不超过len字节，返回写入的字节数
+    // 返回0表示响应体结束，返回-1表示出错(连接会被关闭)
+    virtual int produce(char* buf, int len) = 0;
+
+    // 响应体已经全部交出，下一次produce一定返回0。不确定时返回false，
+    // HTTP/2的流控窗口用完时据此决定能否发出结束流的空DATA帧
+    virtual bool done() const
+    {
+        return false;
+    }
+};
+
+// 内容已经一次生成好的响应体，比如 /metrics，按块发送
+class string_producer : public body_producer {
+public:
+    string_producer() : m_pos(0) {}
+
+    std::string& text()
+    {
+        return m_text;
+    }
+
+    int produce(char* buf, int len)
+    {
+        size_t n = m_text.size() - m_pos;
+        if (n > (size_t)len) {
+            n = len;
+        }
+        memcpy(buf, m_text.data() + m_pos, n);
+        m_pos += n;
+        return n;
+    }
+
+    bool done() const
+    {
+        return m_pos >= m_text.size();
+    }
+
+private:
+    std::string m_text;
+    size_t      m_pos;
+};
+
+#endif
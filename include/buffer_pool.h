@@ -0,0 +1,39 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "lock.h"
+#include <atomic>
+#include <vector>
+
+// 定长内存块的共享池: 长连接空闲时把读写缓冲区还回来，读到新请求时再取，
+// 内存随同时在处理的连接数增长，而不是随连接总数增长。
+// 池里最多留max_free个空闲块，多出来的直接释放。主线程和工作线程都会调用，加锁
+class buffer_pool {
+public:
+    buffer_pool(int block_size, int max_free);
+    ~buffer_pool();
+
+    char* get();
+    void  put(char* block);
+
+    int block_size() const
+    {
+        return m_block_size;
+    }
+    // 被连接占用的块数
+    long in_use() const
+    {
+        return m_in_use.load(std::memory_order_relaxed);
+    }
+    // 池里的空闲块数
+    int free_count();
+
+private:
+    locker             m_lock;
+    std::vector<char*> m_free;
+    int                m_block_size;
+    int                m_max_free;
+    std::atomic<long>  m_in_use;
+};
+
+#endif
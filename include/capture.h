@@ -0,0 +1,50 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+/*
+    流量抓取: 把每个连接从socket读到的原始请求字节和读到的时间写进一个
+    二进制文件，wsreplay 按原来的时间间隔(或者加速)重放，压测用真实的请求。
+    默认关闭，启动时用 -C 文件名 打开，关闭时每次read只有一次判断
+
+    文件格式，整数都是小端:
+      文件头   capture_file_header
+      若干记录 capture_record + len字节数据，一次recv读到的数据一条记录
+    连接号从1开始按连接建立的顺序分配，fd复用时也不同，
+    同一个连接的记录按时间先后出现在文件里
+
+    只在主线程(read)调用，不加锁。HTTP/2连接升级之后的数据不抓取
+*/
+
+extern bool g_capture_enabled;  // 启动时设置，之后只读
+
+#define CAPTURE_ENABLED() __builtin_expect(g_capture_enabled, 0)
+
+static const char     CAPTURE_MAGIC[8]  = {'W', 'S', 'C', 'A', 'P', 'T', 'R', '1'};
+static const uint64_t CAPTURE_MAX_BYTES = 1ULL << 30;  // 写满这么多就停止抓取
+
+struct capture_file_header {
+    char    magic[8];
+    int64_t start_unix_us;  // 开始抓取的时间，只用于显示
+};
+
+struct capture_record {
+    uint32_t conn;       // 连接号
+    uint32_t len;        // 后面的数据长度
+    uint64_t offset_us;  // 距离开始抓取的时间，单调时钟，微秒
+};
+
+// 打开抓取文件并写入文件头，成功后打开g_capture_enabled
+bool capture_open(const char* path);
+
+// 写完缓冲区里的记录并关闭文件
+void capture_close();
+
+// 给新建立的连接分配连接号
+uint32_t capture_new_conn();
+
+// 记录连接读到的一段数据
+void capture_data(uint32_t conn, const char* data, int len);
+
+#endif
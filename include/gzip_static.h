@@ -0,0 +1,34 @@
+#ifndef GZIP_STATIC_H
+#define GZIP_STATIC_H
+
+#include "body_producer.h"
+
+// 静态资源的gzip预压缩，以及动态内容的即时压缩
+// 预压缩的文件以 原文件名.gz 的形式放在原文件旁边，
+// 只有当 .gz 文件不比原文件旧时才会被使用
+
+// 小于该长度的内容不值得压缩
+#define GZIP_MIN_LENGTH 256
+
+// 根据文件扩展名得到MIME类型，未知类型返回application/octet-stream
+const char* mime_type(const char* path);
+
+// 该类型的文件是否值得压缩(文本类资源)
+bool is_compressible(const char* path);
+
+// 解析Accept-Encoding头的值: 按逗号分项，编码名精确比较(不区分大小写)，
+// q值按数字解析。gzip(没有列出时看 * )的q值大于0时返回true
+bool accept_gzip(const char* value);
+
+// 启动一个分离的后台线程，为root目录下所有可压缩文件生成 .gz 变体
+void start_gzip_precompress(const char* root);
+
+// 使用当前线程私有的deflate上下文把in压缩成gzip格式
+// 返回压缩后的长度，out空间不够或者出错返回-1
+int gzip_compress(const char* in, int in_len, char* out, int out_len);
+
+// 对一段内存(通常是mmap的文件)做流式gzip压缩的生产者，用于没有预压缩变体的文件
+// data在生产者销毁之前必须一直有效，失败返回nullptr
+body_producer* new_gzip_producer(const char* data, long len);
+
+#endif
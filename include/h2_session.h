@@ -0,0 +1,176 @@
+#ifndef H2_SESSION_H
+#define H2_SESSION_H
+
+#include "body_producer.h"
+#include "hpack.h"
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class http_conn;
+
+/*
+    HTTP/2明文(h2c)会话，挂在http_conn上，支持两种进入方式:
+    1. 先验知识: 连接上的第一批数据就是连接前言 "PRI * HTTP/2.0..."
+    2. 升级: HTTP/1.1请求带 Upgrade: h2c 和 HTTP2-Settings，回复101后切换
+
+    线程分工和HTTP/1.1一致，依靠EPOLLONESHOT保证同一时刻只有一个线程操作会话:
+    主线程 recv_from 把数据读进输入缓冲区，send_to 把输出缓冲区写进socket;
+    工作线程 process 解析帧、调用http_conn的路由生成响应、按流控窗口生成帧
+*/
+
+// 一个HTTP/2流，请求部分由会话解析填充，响应部分由http_conn::serve_h2_stream填充
+struct h2_stream {
+    h2_stream(uint32_t stream_id, int32_t window);
+    ~h2_stream();
+
+    uint32_t id;
+
+    // 请求
+    std::string method;
+    std::string path;
+    bool        accept_gzip;
+    std::string body;        // POST的请求体
+    bool        end_stream;  // 请求已经完整收到
+
+    // 响应
+    bool           responded;     // 响应已经生成，可以开始发送
+    bool           headers_sent;  // HEADERS帧已发送
+    int            status;
+    const char*    content_type;
+    bool           gzip;
+    bool           vary;
+    std::string    inline_body;   // 错误页等小响应体
+    char*          file_address;  // mmap的文件，流结束时解除映射
+    long           file_size;
+    bool           use_file;      // 响应体直接取自mmap的文件
+    body_producer* producer;      // 流式响应体，长度未知
+    long           body_offset;   // 已经发送的响应体字节数
+    int32_t        send_window;   // 流级别的发送窗口
+
+    // 统计，流的最后一帧发出去之后交给http_conn::h2_stream_done
+    long long read_us;        // 收到请求头所在那批数据的时间
+    long long recv_us;        // 收到请求头到请求收完交给线程池
+    long long queue_us;       // 生成响应的那一批在线程池队列里等待的时间
+    long long start_us;       // 开始生成响应的时间
+    long long do_request_us;  // do_request耗时
+    long long service_us;     // 生成响应的耗时
+    long long worker_cpu_us;  // 生成响应的CPU时间
+    int       route;          // do_request分派到的路由，METRICS_ROUTE
+    long      bytes_sent;     // 这个流的HEADERS和DATA帧的字节数，含帧头
+};
+
+class h2_session {
+public:
+    h2_session(http_conn* conn, int sockfd);
+    ~h2_session();
+
+    // 主线程: 把socket上的数据全部读入输入缓冲区，对端关闭或出错返回false
+    bool recv_from(int fd);
+    // 工作线程: 处理收到的帧，为完整的请求生成响应，出现连接错误返回false
+    bool process();
+    // 主线程: 发送输出，-1出错，0全部发完，1 socket写满需要等待EPOLLOUT
+    int send_to(int fd);
+
+    // 放入已经被HTTP/1.1读缓冲区读走的数据
+    void feed(const char* data, int len);
+    // 通过Upgrade进入时调用: 应用HTTP2-Settings，写101响应，返回请求所在的流1
+    h2_stream* upgrade(const char* settings_b64);
+
+    bool want_write() const
+    {
+        return m_out_pos < m_out.size();
+    }
+    // 没有进行中的流且输出已发完
+    bool idle() const
+    {
+        return m_streams.empty() && !want_write();
+    }
+    // 已经发送或收到GOAWAY，并且所有流都处理完了，可以关闭连接
+    bool closing() const
+    {
+        return (m_goaway_sent || m_goaway_received) && idle();
+    }
+
+    static const char   PREFACE[];
+    static const int    PREFACE_LEN      = 24;
+    static const int    MAX_STREAMS      = 100;         // 允许的最大并发流数
+    static const size_t MAX_INPUT        = 256 * 1024;  // 输入缓冲区上限
+    static const size_t MAX_REQUEST_BODY = 64 * 1024;   // 单个请求体上限
+
+private:
+    bool handle_frame(
+        uint8_t        type,
+        uint8_t        flags,
+        uint32_t       stream_id,
+        const uint8_t* payload,
+        uint32_t       len);
+    bool on_headers(
+        uint8_t        flags,
+        uint32_t       stream_id,
+        const uint8_t* payload,
+        uint32_t       len);
+    bool on_header_block(uint32_t stream_id);
+    bool on_data(
+        uint8_t        flags,
+        uint32_t       stream_id,
+        const uint8_t* payload,
+        uint32_t       len);
+    bool on_settings(uint8_t flags, const uint8_t* payload, uint32_t len);
+    bool on_window_update(
+        uint32_t       stream_id,
+        const uint8_t* payload,
+        uint32_t       len);
+
+    uint32_t apply_setting(uint16_t id, uint32_t value);
+    void write_frame_header(
+        uint32_t len,
+        uint8_t  type,
+        uint8_t  flags,
+        uint32_t stream_id);
+    void write_settings();
+    void write_window_update(uint32_t stream_id, uint32_t increment);
+    void write_rst_stream(uint32_t stream_id, uint32_t error);
+    void goaway(uint32_t error);
+    bool write_headers(h2_stream* s);
+    int  write_data(h2_stream* s, int max_len);
+    void fill_output();
+    void close_stream(uint32_t id);
+    void finish_stream(h2_stream* s);
+    void report_sent();
+    // 对端还没有打开过的流，客户端的流id递增，大于已打开的最大id即为idle
+    bool idle_stream(uint32_t id) const
+    {
+        return id > m_last_stream_id;
+    }
+
+private:
+    http_conn* m_conn;
+    int        m_sockfd;
+
+    std::string m_in;       // 输入缓冲区
+    std::string m_out;      // 待发送的帧
+    size_t      m_out_pos;  // m_out中已经发送的位置
+    // 最后一帧已经生成、还没有发完的流，first为这一帧在m_out中的结束位置
+    std::vector<std::pair<size_t, h2_stream*>> m_finished;
+
+    bool m_preface_received;
+    bool m_settings_sent;
+    bool m_goaway_sent;
+    bool m_goaway_received;
+
+    std::map<uint32_t, h2_stream*> m_streams;
+    uint32_t                       m_last_stream_id;  // 对端开启的最大流id
+
+    hpack_decoder m_decoder;
+    std::string   m_header_block;         // 正在拼接的头部块
+    uint32_t      m_continuation_stream;  // 等待CONTINUATION的流，0表示没有
+    uint8_t       m_header_flags;         // 头部块第一个帧的标志
+
+    int32_t  m_send_window;          // 连接级别的发送窗口
+    int32_t  m_peer_initial_window;  // 对端的SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t m_peer_max_frame;       // 对端的SETTINGS_MAX_FRAME_SIZE
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// HTTP/2的头部压缩(RFC 7541)
+// 解码器完整支持静态表、动态表和Huffman编码;
+// 编码器只使用静态表加"不索引的字面量"，不维护动态表，实现简单且不需要同步状态
+
+typedef std::vector<std::pair<std::string, std::string> > header_list;
+
+class hpack_decoder {
+public:
+    hpack_decoder(size_t max_table_size = 4096);
+
+    // 解码一个完整的头部块，结果追加到headers，格式错误返回false
+    bool decode(const uint8_t* data, size_t len, header_list& headers);
+
+    // 对端通过SETTINGS_HEADER_TABLE_SIZE允许的动态表上限
+    void set_max_table_size(size_t size)
+    {
+        m_max_allowed = size;
+    }
+
+private:
+    bool lookup(size_t index, std::string& name, std::string& value);
+    void insert(const std::string& name, const std::string& value);
+    void evict();
+
+private:
+    std::deque<std::pair<std::string, std::string> > m_table;  // 动态表，新的在前
+    size_t m_table_size;   // 动态表当前大小，每项为name+value+32
+    size_t m_max_size;     // 动态表当前上限
+    size_t m_max_allowed;  // 上限的上限
+};
+
+// 编码 :status 伪头部
+void hpack_encode_status(std::string& out, int status);
+
+// 编码一个头部，name用静态表下标引用，value不做Huffman编码
+void hpack_encode_header(
+    std::string& out,
+    int          name_index,
+    const char*  value,
+    size_t       len);
+
+// 编码器用到的静态表下标
+enum HPACK_STATIC_NAME {
+    HPACK_CONTENT_ENCODING = 26,
+    HPACK_CONTENT_LENGTH   = 28,
+    HPACK_CONTENT_TYPE     = 31,
+    HPACK_DATE             = 33,
+    HPACK_VARY             = 59
+};
+
+#endif
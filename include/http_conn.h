@@ -1,8 +1,13 @@
 #ifndef HTTP_CONN_H
 #define HTTP_CONN_H
 
+#include "body_producer.h"
+#include "buffer_pool.h"
+#include "h2_session.h"
 #include "lock.h"
+#include "metrics.h"
 #include "sql_connection_pool.h"
+#include <atomic>
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
@@ -23,6 +28,9 @@
 #include <unistd.h>
 
 class http_conn {
+    // bench/bench_parse.cpp 绕过socket直接驱动解析和响应构造
+    friend struct http_conn_bench;
+
     // HTTP请求方法，这里只支持get
     enum METHOD { GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT };
 
@@ -46,6 +54,7 @@ class http_conn {
         NO_RESOURCE         :   表示服务器没有资源
         FORBIDDEN_REQUEST   :   表示客户对资源没有足够的访问权限
         FILE_REQUEST        :   文件请求,获取文件成功
+        STREAM_REQUEST      :   流式响应，响应体由m_producer分块产生
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
     */
@@ -57,6 +66,7 @@ class http_conn {
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        STREAM_REQUEST,
         INTERNAL_ERROR,
         CLOSE_CONNECTION
     };
@@ -73,12 +83,43 @@ public:
     void init(int sockfd, const sockaddr_in& addr);  //初始化新的连接
     void close_conn(bool real_close = true);         // 关闭
     void process();                                  // 处理新的连接
+    void enqueue();  // 主线程交给线程池之前调用，记下排队开始的时间
+    // 定时器要关闭连接时调用。工作线程正在处理时返回true，不能关闭fd，
+    // 否则fd被新连接复用后init会释放工作线程还在用的会话和文件，
+    // 由工作线程处理完之后关闭
+    bool close_after_worker();
     bool read();                                     // 非阻塞读
     bool write();                                    // 非阻塞写
     sockaddr_in* get_address()  // 获取客户端的端口和ip
     {
         return &m_address;
     }
+    // 响应已经发完、正在等待下一个请求的长连接
+    bool keepalive_idle() const
+    {
+        if (m_h2) {
+            return m_h2->idle();
+        }
+        return m_request_count > 0 && m_read_idx == 0 && bytes_to_send == 0 &&
+               !m_producer;
+    }
+    // 响应已经发完，读缓冲区里还有客户端流水线发来的下一个请求，
+    // 主线程不等EPOLLIN，直接交给线程池
+    bool pipelined() const
+    {
+        return !m_h2 && m_read_idx > 0 && bytes_to_send == 0 && !m_producer;
+    }
+    // 统计一个请求，返回false表示本连接已经到达请求数上限
+    bool count_request();
+    // HTTP/2: 用HTTP/1.1的路由和文件逻辑为一个请求已经收完的流生成响应
+    void serve_h2_stream(h2_stream* s);
+    // HTTP/2: 流的最后一帧已经发出，记录指标和访问日志
+    void h2_stream_done(const h2_stream* s);
+    // 最近一次从socket读到数据的时间
+    long long read_us() const
+    {
+        return m_read_us;
+    }
 
     //同步线程初始化数据库读取表
     void initmysql_result(connection_pool* connPool);
@@ -87,15 +128,32 @@ public:
 
 public:
     static int m_epollfd;     // 所有连接所对应的epoll对象
-    static int m_user_count;  // 统计连接的数量
+    static std::atomic<int> m_user_count;  // 统计连接的数量，工作线程也会修改
+    static int m_max_keepalive_requests;  // 每个长连接最多处理的请求数，0不限制
+    static int m_keepalive_timeout;  // 长连接空闲超时(秒)，在Keep-Alive头里告诉客户端
+    static bool m_conn_et;  // 连接socket是否边沿触发，由main根据-e设置
+    static bool m_compact_idle;  // 空闲长连接把读写缓冲区还给缓冲区池，由main根据-k设置
+    static std::atomic<long> m_total_conns;     // 累计建立的连接数
+    static std::atomic<long> m_total_requests;  // 累计处理的请求数
+    static std::atomic<long> m_reused_requests;  // 在已用过的连接上处理的请求数
     MYSQL*     mysql;
     // 常量
     static const int READ_BUFFER_SIZE  = 2048;  // 读缓冲区的大小
     static const int WRITE_BUFFER_SIZE = 1024;  // 写缓冲区的大小
     static const int FILENAME_LEN      = 200;   // 文件名字的最大长度
+    static const int CHUNK_SIZE        = 16384;  // 流式响应每块的最大数据量
+    // 读写缓冲区和文件名放在同一块里
+    static const int BUFFER_BLOCK_SIZE =
+        READ_BUFFER_SIZE + WRITE_BUFFER_SIZE + FILENAME_LEN;
+
+    // 所有连接共用的缓冲区池
+    static buffer_pool& buffers();
 
 private:
     void      init();
+    void      attach_buffers();   // 从缓冲区池取一块，已经有了就不取
+    void      release_buffers();  // 把缓冲区还给池
+    void      rearm(int ev);  // 工作线程处理完，重新注册事件把连接交回主线程
     HTTP_CODE process_read();           // 解析HTTP请求
     bool process_write(HTTP_CODE ret);  // 根据读的结果填充HTTP响应
 
@@ -104,6 +162,7 @@ private:
     HTTP_CODE parse_headers(char* text);
     HTTP_CODE parse_content(char* text);
     HTTP_CODE do_request();
+    HTTP_CODE timed_do_request();  // 记录do_request的耗时
     char*     get_line()
     {
         return m_read_buf + m_start_line;
@@ -113,33 +172,71 @@ private:
     void unmap();
     bool add_response(const char* format, ...);
     bool add_content(const char* content);
+    bool add_bytes(const char* data, int len);
+    bool add_body(const char* content);
     bool add_content_type();
+    bool add_content_encoding();
     bool add_status_line(int status, const char* title);
     bool add_headers(int content_length);
     bool add_content_length(int content_length);
     bool add_linger();
+    bool add_keepalive();
     bool add_blank_line();
+    bool add_stream_headers();
+    // 流式响应: 取下一块数据并加上chunked编码的头尾
+    bool next_chunk();
+    bool write_stream();
+    void end_stream();
+    // HTTP/2相关
+    void process_h2();
+    void upgrade_h2c(HTTP_CODE ret, long long cpu_start);
+    void make_h2_response(HTTP_CODE ret, h2_stream* s);
+    void h2_stream_stats(h2_stream* s, long long cpu_start);
+    // 响应发完后记录指标和访问日志
+    void request_done();
+    // 把从m_cpu_mark开始的主线程CPU时间记到本请求上
+    void cpu_stop();
+
+    // 作用域内主线程为本请求用掉的CPU时间，
+    // 请求在作用域中途发完时由request_done提前结算
+    class cpu_scope {
+    public:
+        explicit cpu_scope(http_conn* conn);
+        ~cpu_scope()
+        {
+            m_conn->cpu_stop();
+        }
+
+    private:
+        http_conn* m_conn;
+    };
 
 private:
     int         m_sockfd;   // 该http连接对应的fd
     sockaddr_in m_address;  // 对应的地址
 
-    char m_read_buf[READ_BUFFER_SIZE];  // 读缓冲区
+    char* m_read_buf;  // 读缓冲区，和下面两个都指向缓冲区池里的一块，没有取到时为空
     int  m_read_idx;  // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位置
     int m_checked_idx;  // 当前正在分析的字符在读缓冲区中的位置
     int m_start_line;   // 当前正在解析的行的起始位置
 
     CHECK_STATE m_check_state;  // 主状态机当前所处状态
     METHOD      m_method;       // 请求方法
-    char        m_real_file[FILENAME_LEN];  // 客户请求的目标文件的完整路径，其内容等于
+    char*       m_real_file;  // 客户请求的目标文件的完整路径，其内容等于
                                      // doc_root + m_url, doc_root是网站根目录
     char* m_url;             // 客户请求的目标文件的文件名
-    char* m_version;         // HTTP协议版本号，我们仅支持HTTP1.1
+    char* m_version;         // HTTP协议版本号，支持HTTP/1.0和HTTP/1.1
+    bool  m_http11;          // 是否为HTTP/1.1请求，决定默认是否保持连接和能否分块
     char* m_host;            // 主机名
     int   m_content_length;  // HTTP请求的消息总长度
     bool  m_linger;          // HTTP请求是否要求保持连接
+    int   m_request_count;   // 本连接已处理的请求数
+    bool  m_accept_gzip;     // 客户端是否接受gzip编码
+    bool  m_gzip;            // 本次响应体是否为gzip编码
+    bool  m_vary;            // 响应内容是否随Accept-Encoding变化
+    const char* m_content_type;  // 响应体的MIME类型
 
-    char  m_write_buf[WRITE_BUFFER_SIZE];  // 写缓冲区
+    char* m_write_buf;  // 写缓冲区
     int   m_write_idx;  // 写缓冲区中待发送的字节数
     char* m_file_address;  // 客户请求的目标文件被mmap到内存中的起始位置
     struct stat
@@ -151,8 +248,37 @@ private:
     int bytes_to_send;    // 将要发送的数据的字节数
     int bytes_have_send;  // 已经发送的字节数
 
+    body_producer* m_producer;    // 流式响应体的生产者，非流式响应为空
+    char*          m_chunk_buf;   // 流式响应的分块缓冲区，只在流式发送期间存在
+    bool           m_chunk_done;  // 结束块是否已经生成
+    bool           m_chunked;  // 是否用chunked编码，HTTP/1.0客户端靠关闭连接表示结束
+
     int   cgi;       // 是否启用post
     char* m_string;  //存储请求的头部
+    char  m_body_next;  // 请求体后面一个字节改成'\0'之前的值，可能是下一个请求
+
+    h2_session* m_h2;           // 切换到HTTP/2之后的会话，HTTP/1.x为空
+    bool        m_upgrade_h2c;  // 请求带了 Upgrade: h2c
+    char*       m_h2_settings;  // HTTP2-Settings头的值
+
+    // 访问日志的字段，时间都是单调时钟的微秒
+    int       m_status;      // 响应状态码
+    long long m_read_us;     // 收到本请求第一批数据的时间
+    long long m_queued_us;   // 交给线程池的时间
+    long long m_start_us;    // 工作线程开始处理的时间
+    long long m_service_us;  // 工作线程处理耗时
+    long long m_accept_us;      // 连接建立的时间
+    long long m_do_request_us;  // do_request耗时
+    long long m_parse_us;       // 解析耗时，不含do_request
+    long long m_build_us;       // process_write耗时
+    METRICS_ROUTE m_route;      // do_request分派到的路由
+    long long m_reactor_cpu_us;  // 主线程读写本请求的CPU时间
+    long long m_worker_cpu_us;   // 工作线程处理本请求的CPU时间
+    long long m_cpu_mark;  // 主线程正在计时的作用域开始时的CPU时间，0表示没有
+    uint32_t  m_capture_id;  // 流量抓取的连接号，没有打开抓取时为0
+    // m_in_worker的取值: 不在工作线程、工作线程处理中、处理完后需要关闭
+    enum { WORKER_NONE = 0, WORKER_BUSY, WORKER_CLOSE };
+    std::atomic<int> m_in_worker;  // 已经交给线程池、工作线程还没有处理完
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <string.h>
+#include <time.h>
+
+// 不经过vsnprintf的响应头构造工具
+// 状态行和常用头部都是预先拼好的常量片段，直接memcpy到写缓冲区;
+// 整数用两位一组查表转换; Date头每个线程每秒只重新生成一次
+
+// 常量片段，长度在编译期确定
+#define HDR_FRAGMENT(s) s, (int)(sizeof(s) - 1)
+
+// 根据状态码返回完整的状态行，如 "HTTP/1.1 200 OK\r\n"，len返回长度
+// 不认识的状态码返回nullptr
+const char* http_status_line(int status, int* len);
+
+// 返回当前时间的Date头 "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+// 结果缓存在线程私有存储中，同一秒内的调用直接复用
+const char* http_date_header(int* len);
+
+extern const char http_digit_pairs[201];
+
+// 把无符号整数转为十进制写到out，返回写入的字节数，out至少20字节
+inline int format_uint(char* out, unsigned long value)
+{
+    char  tmp[20];
+    char* p = tmp + sizeof(tmp);
+    // 每次处理两位，循环次数和除法次数减半
+    while (value >= 100) {
+        unsigned long idx = (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = http_digit_pairs[idx];
+        p[1] = http_digit_pairs[idx + 1];
+    }
+    if (value >= 10) {
+        p -= 2;
+        p[0] = http_digit_pairs[value * 2];
+        p[1] = http_digit_pairs[value * 2 + 1];
+    }
+    else {
+        *--p = (char)('0' + value);
+    }
+    int len = (int)(tmp + sizeof(tmp) - p);
+    memcpy(out, p, len);
+    return len;
+}
+
+#endif
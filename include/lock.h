@@ -145,4 +145,30 @@ private:
     sem_t m_sem;
 };
 
+// 自旋锁，用于临界区极短、几乎没有竞争的场合，避免互斥锁陷入内核
+class spinlock {
+public:
+    spinlock()
+    {
+        if (pthread_spin_init(&m_lock, PTHREAD_PROCESS_PRIVATE) != 0) {
+            throw std::exception();
+        }
+    }
+    ~spinlock()
+    {
+        pthread_spin_destroy(&m_lock);
+    }
+    bool lock()
+    {
+        return pthread_spin_lock(&m_lock) == 0;
+    }
+    bool unlock()
+    {
+        return pthread_spin_unlock(&m_lock) == 0;
+    }
+
+private:
+    pthread_spinlock_t m_lock;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,229 @@
+/*************************************************************
+ *无锁的有界环形队列，接口与block_queue相同，可以直接替换
+ *多个生产者、一个消费者(MPSC)，单生产者时就是SPSC:
+ *每个槽位带一个序号，生产者用CAS抢占写入位置，写完后发布序号，
+ *消费者只有一个，读位置不需要CAS
+ *push不加锁，消费者取空后才在条件变量上睡眠，生产者只在有消费者睡眠时才加锁唤醒
+ **************************************************************/
+
+#ifndef LOCKFREE_QUEUE_H
+#define LOCKFREE_QUEUE_H
+
+#include "lock.h"
+#include <atomic>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <utility>
+#include <vector>
+
+template <class T> class lockfree_queue {
+private:
+    struct slot {
+        std::atomic<size_t> seq;  // 等于位置时可写，等于位置+1时可读
+        T                   item;
+    };
+
+    slot*  m_slots;
+    size_t m_mask;      // 容量向上取整为2的幂，减1
+    int    m_max_size;  // 构造时要求的容量
+
+    // 生产者和消费者各自修改的位置放在不同的缓存行，避免互相失效
+    alignas(64) std::atomic<size_t> m_back;   // 下一个写入位置
+    alignas(64) std::atomic<size_t> m_front;  // 下一个读取位置，只有消费者修改
+
+    alignas(64) std::atomic<bool> m_sleeping;  // 消费者正在条件变量上等待
+    locker m_mutex;
+    cond   m_cond;
+
+public:
+    lockfree_queue(int max_size = 1000)
+    {
+        if (max_size <= 0) {
+            exit(-1);
+        }
+        size_t cap = 1;
+        while (cap < (size_t)max_size) {
+            cap <<= 1;
+        }
+        m_max_size = max_size;
+        m_mask     = cap - 1;
+        m_slots    = new slot[cap];
+        for (size_t i = 0; i < cap; ++i) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_back.store(0, std::memory_order_relaxed);
+        m_front.store(0, std::memory_order_relaxed);
+        m_sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    ~lockfree_queue()
+    {
+        delete[] m_slots;
+    }
+
+    // 只能由消费者调用
+    void clear()
+    {
+        T item;
+        while (try_pop(item)) {
+        }
+    }
+
+    bool full()
+    {
+        return size() >= m_max_size;
+    }
+
+    bool empty()
+    {
+        return size() == 0;
+    }
+
+    // 并发修改时只是一个近似值
+    int size()
+    {
+        size_t back  = m_back.load(std::memory_order_acquire);
+        size_t front = m_front.load(std::memory_order_acquire);
+        return back > front ? (int)(back - front) : 0;
+    }
+
+    int max_size()
+    {
+        return m_max_size;
+    }
+
+    // 队列满时返回false，任意多个线程可以同时调用
+    bool push(const T& item)
+    {
+        size_t pos = m_back.load(std::memory_order_relaxed);
+        slot*  s;
+        for (;;) {
+            s          = &m_slots[pos & m_mask];
+            size_t seq = s->seq.load(std::memory_order_acquire);
+            long   dif = (long)(seq - pos);
+            // 环形数组向上取整到了2的幂，按构造时要求的容量限制，
+            // 和full()、size()、max_size()一致
+            if ((long)(pos - m_front.load(std::memory_order_acquire)) >=
+                m_max_size) {
+                return false;
+            }
+            if (dif == 0) {
+                if (m_back.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (dif < 0) {
+                return false;  // 这个槽位上一轮的元素还没被取走，队列满
+            }
+            else {
+                pos = m_back.load(std::memory_order_relaxed);
+            }
+        }
+        s->item = item;
+        s->seq.store(pos + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    // 以下出队操作只能由一个消费者线程调用
+
+    // 不等待，队列为空返回false
+    bool try_pop(T& item)
+    {
+        size_t pos = m_front.load(std::memory_order_relaxed);
+        slot*  s   = &m_slots[pos & m_mask];
+        if (s->seq.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        std::swap(item, s->item);
+        s->seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_front.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        while (!try_pop(item)) {
+            wait(-1);
+        }
+        return true;
+    }
+
+    bool pop(T& item, int ms_timeout)
+    {
+        if (try_pop(item)) {
+            return true;
+        }
+        wait(ms_timeout);
+        return try_pop(item);
+    }
+
+    bool pop_all(std::vector<T>& items, int ms_timeout = -1)
+    {
+        return pop_batch(items, m_max_size, ms_timeout);
+    }
+
+    // 取走最多max_items个元素追加到items，队列为空时等待，
+    // ms_timeout不小于0时最多等这么多毫秒，仍然为空返回false
+    bool pop_batch(std::vector<T>& items, int max_items, int ms_timeout = -1)
+    {
+        T item;
+        while (!try_pop(item)) {
+            if (ms_timeout >= 0) {
+                wait(ms_timeout);
+                if (!try_pop(item)) {
+                    return false;
+                }
+                break;
+            }
+            wait(-1);
+        }
+        items.push_back(T());
+        std::swap(items.back(), item);
+        for (int i = 1; i < max_items && try_pop(item); ++i) {
+            items.push_back(T());
+            std::swap(items.back(), item);
+        }
+        return true;
+    }
+
+private:
+    // 消费者先声明要睡眠，再检查一次队列，和生产者的 发布元素->检查m_sleeping
+    // 顺序相反，两边都用顺序一致的原子操作，保证至少有一方看到对方，不会丢失唤醒
+    void wait(int ms_timeout)
+    {
+        m_mutex.lock();
+        m_sleeping.store(true);
+        size_t pos = m_front.load(std::memory_order_relaxed);
+        if (m_slots[pos & m_mask].seq.load() != pos + 1) {
+            if (ms_timeout < 0) {
+                m_cond.wait(m_mutex.get());
+            }
+            else {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                long nsec = now.tv_usec * 1000L;
+                nsec += (ms_timeout % 1000) * 1000000L;
+                struct timespec t;
+                t.tv_sec  = now.tv_sec + ms_timeout / 1000 + nsec / 1000000000L;
+                t.tv_nsec = nsec % 1000000000L;
+                m_cond.timewait(m_mutex.get(), t);
+            }
+        }
+        m_sleeping.store(false, std::memory_order_relaxed);
+        m_mutex.unlock();
+    }
+
+    void wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_sleeping.load(std::memory_order_relaxed)) {
+            m_mutex.lock();
+            m_cond.signal();
+            m_mutex.unlock();
+        }
+    }
+};
+
+#endif
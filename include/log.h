@@ -1,12 +1,65 @@
 #ifndef LOG_H
 #define LOG_H
 
-#include "block_queue.h"
+#include "lockfree_queue.h"
+#include "log_binary.h"
+#include "log_mmap.h"
+#include <atomic>
 #include <iostream>
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
+
+// 编译期的日志级别下限(0 debug, 1 info, 2 warn, 3 error)，
+// 低于它的LOG_*调用连参数都不会求值，由CMake的LOG_COMPILE_LEVEL设置
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+// 日志的持久化策略: 什么时候把缓冲的日志写进内核，什么时候fdatasync落盘
+// 默认每秒刷新一次、ERROR立即刷新，调用者显式的flush()不做任何事。
+// 写日志时检查一次；配置了刷新或fdatasync间隔时没有新日志也按间隔检查:
+// 阻塞队列和每线程缓冲模式由写线程定时醒来，同步模式另起一个刷新线程
+struct log_flush_policy {
+    int  interval_ms      = 1000;   // 距上次刷新超过这么多毫秒就刷新，0不按时间
+    int  bytes            = 0;      // 未刷新的数据超过这么多字节就刷新，0不按大小
+    bool on_error         = true;   // ERROR级别的日志立即刷新
+    int  sync_interval_ms = 0;      // 组提交: 每隔这么多毫秒fdatasync一次，0不做
+    bool explicit_flush   = false;  // 是否响应调用者显式的flush()
+    bool mmap_file        = false;  // 写入内存映射的文件而不是stdio
+};
+
+// 阻塞队列里的一行日志，带上级别让写线程按策略处理ERROR
+struct log_line {
+    int         level;
+    std::string text;
+};
+
+// 每线程双缓冲后端使用的日志缓冲区
+struct log_buffer {
+    char*     data;
+    int       len;    // 已写入的字节数
+    int       cap;    // 容量
+    long long lines;  // 已写入的行数，用于按行数切分文件
+    long      base;   // 二进制模式下最近一条TIME记录的秒数
+};
+
+// 二进制日志的一个调用点
+struct log_site {
+    int         level;
+    int         line;
+    std::string format;
+    std::string file;
+    std::string signature;  // 参数类型串
+};
+
+// 一个线程在一个Log实例上的写入状态，只有写线程换缓冲区时才会和本线程竞争锁
+struct thread_log_buffer {
+    spinlock    lock;
+    log_buffer* cur;  // 当前正在写的缓冲区
+};
 
 class Log {
 private:
@@ -17,10 +70,50 @@ private:
     long long m_count;         //日志行数记录
     int       m_today;  //因为按天分类,记录当前时间是那一天
     FILE*     m_fp;     //打开log的文件指针
+    log_mmap_file m_mmap;  // 使用内存映射文件时代替m_fp
     char*     m_buf;
-    block_queue<std::string>* m_log_queue;  //阻塞队列
+    lockfree_queue<log_line>* m_log_queue;  //无锁队列，只有写线程一个消费者
     bool                      m_is_async;   //是否同步标志位
     locker                    m_mutex;
+    std::atomic<int>          m_level;  // 运行期的最低日志级别
+    log_flush_policy          m_policy;
+    long long                 m_unflushed;      // 上次刷新之后写入的字节数
+    long long                 m_last_flush_ms;  // 上次刷新的时间
+    long long                 m_last_sync_ms;   // 上次fdatasync的时间
+    bool                      m_unsynced;  // 有刷新进内核还没fdatasync的数据
+    bool                      m_flusher;   // 同步模式的刷新线程是否在运行
+
+    // 每线程双缓冲后端: 各线程写自己的缓冲区，写满后交给写线程批量写入文件
+    bool                            m_thread_buffer;  // 是否使用该后端
+    int                             m_id;  // 实例编号，用于索引线程私有缓冲区
+    locker                          m_threads_mutex;  // 保护m_threads
+    std::vector<thread_log_buffer*> m_threads;  // 所有写过日志、还没退出的线程
+    locker                          m_buf_mutex;  // 保护下面几个成员
+    cond                            m_buf_cond;   // 有写满的缓冲区时通知写线程
+    bool                            m_stop;
+    bool                            m_urgent;  // 需要立即写入(ERROR或显式刷新)
+    pthread_t                       m_writer;  // 写线程，同步模式下是刷新线程
+    std::vector<log_buffer*>        m_full;     // 写满等待写入的缓冲区
+    std::vector<log_buffer*>        m_free;     // 写完回收的空闲缓冲区
+
+    // 二进制模式，只能和每线程缓冲后端一起使用
+    bool                   m_binary;
+    locker                 m_site_mutex;     // 保护m_sites
+    std::vector<log_site>  m_sites;          // 所有注册过的调用点，下标为id
+    size_t                 m_sites_written;  // 当前文件已经写入的调用点数
+
+    static const int BUFFER_SIZE      = 1024 * 1024;  // 每块缓冲区的大小
+    static const int MAX_FULL_BUFFERS = 64;  // 积压超过这么多块时丢弃
+    static const int MAX_FREE_BUFFERS = 16;  // 最多保留的空闲缓冲区
+    static const int MAX_INSTANCES    = 4;   // 最多的Log实例数
+    static std::atomic<int> s_instances;
+
+    // 一个线程在各个实例上的缓冲区，线程退出时析构，交还给各自的实例
+    struct thread_buffers {
+        Log*               logs[MAX_INSTANCES];
+        thread_log_buffer* buffers[MAX_INSTANCES];
+        ~thread_buffers();
+    };
 
 public:
     // c++11之后，局部变量懒汉不需要加锁
@@ -29,6 +122,12 @@ public:
         static Log instance;
         return &instance;
     }
+    // 访问日志单独使用一个实例，写到自己的文件
+    static Log* get_access_log()
+    {
+        static Log instance;
+        return &instance;
+    }
 
     // 异步写入日志
     static void *flush_log_thread(void* args)
@@ -36,42 +135,173 @@ public:
         Log::get_instance()->async_write_log();
     }
 
+    // 每线程双缓冲后端的写线程
+    static void* buffer_write_thread(void* args)
+    {
+        ((Log*)args)->buffer_write_loop();
+        return nullptr;
+    }
+
+    // 同步模式下按策略的间隔刷新的线程
+    static void* flush_timer_thread(void* args)
+    {
+        ((Log*)args)->flush_timer_loop();
+        return nullptr;
+    }
+
+    // thread_buffer为true时使用每线程双缓冲后端，此时忽略max_queue_size
     bool init(
-        const char* filename,
-        int         log_buffer_size = 8192,
-        int         split_lines     = 5000000,
-        int         max_queue_size  = 0);  // 为0代表同步
+        const char*             filename,
+        int                     log_buffer_size = 8192,
+        int                     split_lines     = 5000000,
+        int                     max_queue_size  = 0,  // 为0代表同步
+        bool                    thread_buffer   = false,
+        const log_flush_policy& policy          = log_flush_policy(),
+        bool                    binary          = false);
 
     void write_log(int level, const char* format, ...);
     void flush(void);
+    // 等待写入文件的积压占容量的百分比: 每线程缓冲后端为写满的缓冲区，
+    // 异步队列为队列里的日志，同步写为0
+    int pending_percent();
+
+    // 低于运行期级别的日志在格式化之前就被丢弃
+    void set_level(int level)
+    {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+    bool enabled(int level) const
+    {
+        return level >= m_level.load(std::memory_order_relaxed);
+    }
+    bool binary() const
+    {
+        return m_binary;
+    }
+
+    // 二进制模式的写入: 第一次调用时注册调用点，之后只写id、时间戳和参数字节
+    // site是调用点的静态变量，保存分配到的id
+    template <typename... Args>
+    void write_binary(
+        std::atomic<int>& site,
+        int               level,
+        const char*       format,
+        const char*       file,
+        int               line,
+        Args... args)
+    {
+        int id = site.load(std::memory_order_acquire);
+        if (id < 0) {
+            id = register_site(
+                site, level, format, file, line, log_signature<Args...>::get());
+        }
+        thread_log_buffer* tl;
+        char* p = begin_event(id, log_args_size(args...), &tl);
+        end_event(tl, level, log_args_encode(p, args...));
+    }
 
     
 
 private:
     Log();
     virtual ~Log();
+    // 日志文件的打开、写入和刷新，按策略使用stdio或者内存映射文件
+    bool open_file(const char* path);
+    void close_file();
+    void write_file(const char* data, size_t len);
+    void flush_file();
+    int  file_fd();
+    void open_rotated_file(const struct tm& my_tm);
+    void apply_policy(int level, int bytes);
+    int  policy_period_ms() const;
+    void sync_if_due(long long now_ms);
+    void flush_timer_loop();
+    void write_buffered(int level, const char* format, va_list valst);
+    log_buffer* reserve(thread_log_buffer* tl, int need);
+    int         register_site(
+                std::atomic<int>& site,
+                int               level,
+                const char*       format,
+                const char*       file,
+                int               line,
+                const char*       signature);
+    char* begin_event(int id, int args_len, thread_log_buffer** tl);
+    void  end_event(thread_log_buffer* tl, int level, char* end);
+    void  write_new_sites();
+    thread_log_buffer* local_buffer();
+    void               release_local_buffer(thread_log_buffer* tl);
+    log_buffer*        take_buffer();
+    void               recycle_buffer(log_buffer* buf);
+    void               buffer_write_loop();
+    void               write_buffers(std::vector<log_buffer*>& buffers);
     void *async_write_log()
     {
-        std::string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log)) {
+        std::vector<log_line> logs;
+        int                   period = policy_period_ms();
+        //从队列中一次取出全部日志，一次加锁写入文件。配置了间隔时最多等
+        //一个间隔，队列一直为空也会按策略刷新
+        while (true) {
+            if (period > 0) {
+                m_log_queue->pop_all(logs, period);
+            }
+            else {
+                m_log_queue->pop_all(logs);
+            }
+            int bytes = 0;
+            int level = -1;
             m_mutex.lock();
-            // str，一个数组，包含了要写入的以空字符终止的字符序列。
-            // stream，指向FILE对象的指针，该FILE对象标识了要被写入字符串的流。
-            fputs(single_log.c_str(), m_fp);
+            for (size_t i = 0; i < logs.size(); ++i) {
+                write_file(logs[i].text.data(), logs[i].text.size());
+                bytes += logs[i].text.size();
+                if (logs[i].level > level) {
+                    level = logs[i].level;
+                }
+            }
+            apply_policy(level, bytes);
             m_mutex.unlock();
+            logs.clear();
         }
     }
 };
 
-// 可变参数宏
-#define LOG_DEBUG(format, ...)                                                 \
-    Log::get_instance()->write_log(0, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...)                                                  \
-    Log::get_instance()->write_log(1, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...)                                                  \
-    Log::get_instance()->write_log(2, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...)                                                 \
-    Log::get_instance()->write_log(3, format, ##__VA_ARGS__)
+// 可变参数宏，先判断运行期级别再格式化
+#define LOG_WRITE(level, format, ...)                                          \
+    LOG_WRITE_TO(Log::get_instance(), level, format, ##__VA_ARGS__)
+// 写到指定的Log实例，二进制模式下一个调用点只能写一个实例
+#define LOG_WRITE_TO(log, level, format, ...)                                  \
+    do {                                                                       \
+        Log* log_ = (log);                                                     \
+        if (log_->enabled(level)) {                                            \
+            if (log_->binary()) {                                              \
+                static std::atomic<int> site_(-1);                             \
+                log_->write_binary(                                            \
+                    site_, level, format, __FILE__, __LINE__,                  \
+                    ##__VA_ARGS__);                                            \
+            }                                                                  \
+            else {                                                             \
+                log_->write_log(level, format, ##__VA_ARGS__);                 \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+#define LOG_NOTHING()                                                          \
+    do {                                                                       \
+    } while (0)
+
+#if LOG_COMPILE_LEVEL <= 0
+#define LOG_DEBUG(format, ...) LOG_WRITE(0, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_NOTHING()
+#endif
+#if LOG_COMPILE_LEVEL <= 1
+#define LOG_INFO(format, ...) LOG_WRITE(1, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_NOTHING()
+#endif
+#if LOG_COMPILE_LEVEL <= 2
+#define LOG_WARN(format, ...) LOG_WRITE(2, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) LOG_NOTHING()
+#endif
+#define LOG_ERROR(format, ...) LOG_WRITE(3, format, ##__VA_ARGS__)
 
 #endif
\ No newline at end of file
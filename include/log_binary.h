@@ -0,0 +1,176 @@
+#ifndef LOG_BINARY_H
+#define LOG_BINARY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+/*
+    二进制日志格式，写入端在log.h，解码端是logdecode工具
+    热路径上不做任何格式化，只写 调用点id + 时间戳 + 参数的原始字节，
+    格式串和参数类型作为调用点记录(SITE)在文件里只出现一次
+
+    文件头:  LOG_BINARY_MAGIC，8字节，追加写入时同一文件里可能出现多次
+    SITE:    u8 type=1, u32 id, u8 level, u32 line, u16 fmt_len, u16 file_len,
+             u8 nargs, 参数类型[nargs], fmt[fmt_len], file[file_len]
+    TIME:    u8 type=3, u64 秒，之后的事件时间戳都相对于这一秒
+    EVENT:   u8 type=2, varint id, varint 微秒, 参数...
+    参数:    i zigzag varint，u varint，d 8字节double，p 8字节指针值，
+             s varint长度 + 字符串内容(不含结尾的0)
+    定长整数都是本机字节序。每块缓冲区以TIME记录开头，
+    缓冲区整块写入文件，所以顺序解码时TIME总是作用于紧跟着的同一线程的事件
+*/
+
+#define LOG_BINARY_MAGIC "WSBLOG1\n"
+#define LOG_BINARY_MAGIC_LEN 8
+
+enum LOG_RECORD_TYPE {
+    LOG_RECORD_SITE  = 1,
+    LOG_RECORD_EVENT = 2,
+    LOG_RECORD_TIME  = 3
+};
+
+static const int LOG_TIME_RECORD_LEN   = 9;
+static const int LOG_EVENT_HEADER_MAX  = 1 + 5 + 3;  // type + id + 微秒
+static const int LOG_BINARY_MAX_STRING = 4096;  // 字符串参数的最大长度
+
+inline char* log_put_varint(char* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+    return p;
+}
+
+// 解码varint，数据不完整返回nullptr
+inline const char* log_get_varint(const char* p, const char* end, uint64_t* v)
+{
+    uint64_t x     = 0;
+    int      shift = 0;
+    while (p < end && shift < 64) {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return p;
+        }
+        shift += 7;
+    }
+    return nullptr;
+}
+
+// 按参数类型分三类: 0 整数和枚举，1 浮点，2 指针
+// size返回编码后的最大长度，encode返回实际写到的位置
+template <
+    typename T,
+    int KIND = std::is_floating_point<T>::value ? 1
+               : std::is_pointer<T>::value      ? 2
+                                                : 0>
+struct log_arg;
+
+template <typename T> struct log_arg<T, 0> {
+    static_assert(
+        std::is_integral<T>::value || std::is_enum<T>::value,
+        "unsupported log argument type");
+    static const char tag =
+        std::is_signed<T>::value || std::is_enum<T>::value ? 'i' : 'u';
+    static int size(T)
+    {
+        return 10;
+    }
+    static char* encode(char* p, T v)
+    {
+        if (tag == 'u') {
+            return log_put_varint(p, (uint64_t)v);
+        }
+        // zigzag让绝对值小的负数也只占很少的字节
+        int64_t x = (int64_t)v;
+        return log_put_varint(p, ((uint64_t)x << 1) ^ (uint64_t)(x >> 63));
+    }
+};
+
+template <typename T> struct log_arg<T, 1> {
+    static const char tag = 'd';
+    static int size(T)
+    {
+        return 8;
+    }
+    static char* encode(char* p, T v)
+    {
+        double x = v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+template <typename T> struct log_arg<T, 2> {
+    static const char tag = 'p';
+    static int size(T)
+    {
+        return 8;
+    }
+    static char* encode(char* p, T v)
+    {
+        uint64_t x = (uint64_t)(uintptr_t)v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+// 字符串按内容记录
+template <> struct log_arg<const char*, 2> {
+    static const char tag = 's';
+    static int length(const char* v)
+    {
+        if (!v) {
+            return 6;  // "(null)"
+        }
+        size_t n = strnlen(v, LOG_BINARY_MAX_STRING);
+        return (int)n;
+    }
+    static int size(const char* v)
+    {
+        return 2 + length(v);
+    }
+    static char* encode(char* p, const char* v)
+    {
+        int n = length(v);
+        p     = log_put_varint(p, n);
+        memcpy(p, v ? v : "(null)", n);
+        return p + n;
+    }
+};
+template <> struct log_arg<char*, 2> : log_arg<const char*, 2> {};
+
+inline int log_args_size()
+{
+    return 0;
+}
+template <typename T, typename... Rest>
+inline int log_args_size(T v, Rest... rest)
+{
+    return log_arg<T>::size(v) + log_args_size(rest...);
+}
+
+inline char* log_args_encode(char* p)
+{
+    return p;
+}
+template <typename T, typename... Rest>
+inline char* log_args_encode(char* p, T v, Rest... rest)
+{
+    return log_args_encode(log_arg<T>::encode(p, v), rest...);
+}
+
+// 一组参数类型对应的类型串，比如 (int, const char*) 为 "is"
+template <typename... Args> struct log_signature {
+    static const char* get()
+    {
+        static const char sig[] = {log_arg<Args>::tag..., '\0'};
+        return sig;
+    }
+};
+
+#endif
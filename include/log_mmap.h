@@ -0,0 +1,47 @@
+#ifndef LOG_MMAP_H
+#define LOG_MMAP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+    内存映射的日志文件: 文件按窗口预先fallocate并映射，追加一行就是一次memcpy，
+    脏页由内核在后台写回，进程崩溃时已经写入映射区的内容仍然会落盘。
+    只在文件末尾追加，不会回绕覆盖旧的内容，文件大小由Log按天和行数切分控制。
+    正常关闭时把文件截断到实际长度; 崩溃后文件末尾会留下预分配的0字节，
+    再次打开时从文件末尾继续追加，这段0字节留在中间
+    不是线程安全的，由Log保证同一时刻只有一个线程写入
+*/
+class log_mmap_file {
+public:
+    log_mmap_file();
+    ~log_mmap_file();
+
+    bool open(const char* path);
+    void close();
+    bool append(const char* data, size_t len);
+
+    bool is_open() const
+    {
+        return m_fd >= 0;
+    }
+    int fd() const
+    {
+        return m_fd;
+    }
+
+    static const size_t WINDOW_SIZE = 4 * 1024 * 1024;  // 每次映射的窗口大小
+
+private:
+    bool map_window(off_t offset);
+    void unmap_window();
+
+private:
+    int    m_fd;
+    char*  m_window;         // 当前映射的窗口
+    off_t  m_window_offset;  // 窗口在文件中的偏移，按页对齐
+    size_t m_pos;            // 窗口内下一个写入位置
+    off_t  m_written;        // 实际写入的长度，关闭时截断到这里，-1为未知
+};
+
+#endif
@@ -190,9 +190,19 @@
 #define LST_TIMER
 
 #include <time.h>
+#include <atomic>
 #include "log.h"
 
 class util_timer;
+
+// 定时器用的时钟，秒。服务器用真实时间，模拟测试换成可以快进的时钟
+typedef time_t (*timer_clock)();
+
+inline time_t timer_clock_real()
+{
+    return time(NULL);
+}
+
 struct client_data
 {
     sockaddr_in address;
@@ -216,7 +226,8 @@ public:
 class sort_timer_list
 {
 public:
-    sort_timer_list() : head(NULL), tail(NULL) {}
+    explicit sort_timer_list(timer_clock clock = timer_clock_real)
+        : head(NULL), tail(NULL), m_size(0), m_clock(clock) {}
     ~sort_timer_list()
     {
         util_timer *tmp = head;
@@ -233,6 +244,7 @@ public:
         {
             return;
         }
+        resize(1);
         if (!head)
         {
             head = tail = timer;
@@ -247,12 +259,40 @@ public:
         }
         add_timer(timer, head);
     }
+    // 到期时间改变之后调整位置。一般是往后推迟，但空闲超时比处理请求时的
+    // 超时短的时候会提前，这时取出来从表头重新插入
     void adjust_timer(util_timer *timer)
     {
         if (!timer)
         {
             return;
         }
+        util_timer *prev = timer->prev;
+        if (prev && timer->expire < prev->expire)
+        {
+            prev->next = timer->next;
+            if (timer->next)
+            {
+                timer->next->prev = prev;
+            }
+            else
+            {
+                tail = prev;
+            }
+            timer->prev = NULL;
+            timer->next = NULL;
+            if (timer->expire < head->expire)
+            {
+                timer->next = head;
+                head->prev = timer;
+                head = timer;
+            }
+            else
+            {
+                add_timer(timer, head);
+            }
+            return;
+        }
         util_timer *tmp = timer->next;
         if (!tmp || (timer->expire < tmp->expire))
         {
@@ -278,6 +318,7 @@ public:
         {
             return;
         }
+        resize(-1);
         if ((timer == head) && (timer == tail))
         {
             delete timer;
@@ -303,16 +344,23 @@ public:
         timer->next->prev = timer->prev;
         delete timer;
     }
-    void tick()
+    // 当前时间，设置到期时间时也要用它，和tick用同一个时钟
+    time_t now() const
+    {
+        return m_clock();
+    }
+    // 处理到期的定时器，返回处理的个数
+    int tick()
     {
         if (!head)
         {
-            return;
+            return 0;
         }
         //printf( "timer tick\n" );
         LOG_INFO("%s", "timer tick");
         Log::get_instance()->flush();
-        time_t cur = time(NULL);
+        time_t cur = m_clock();
+        int expired = 0;
         util_timer *tmp = head;
         while (tmp)
         {
@@ -321,6 +369,7 @@ public:
                 break;
             }
             tmp->cb_func(tmp->user_data);
+            resize(-1);
             head = tmp->next;
             if (head)
             {
@@ -328,10 +377,25 @@ public:
             }
             delete tmp;
             tmp = head;
+            ++expired;
         }
+        return expired;
+    }
+
+    // 链表里的定时器数，其他线程读取时是近似值
+    int size() const
+    {
+        return m_size.load(std::memory_order_relaxed);
     }
 
 private:
+    // 只有主线程修改链表，不需要原子加
+    void resize(int delta)
+    {
+        m_size.store(m_size.load(std::memory_order_relaxed) + delta,
+                     std::memory_order_relaxed);
+    }
+
     void add_timer(util_timer *timer, util_timer *lst_head)
     {
         util_timer *prev = lst_head;
@@ -361,6 +425,64 @@ private:
 private:
     util_timer *head;
     util_timer *tail;
+    std::atomic<int> m_size;
+    timer_clock m_clock;
+};
+
+// 连接定时器的规则，服务器主循环和bench/timer_sim.cpp共用同一份:
+// 建立连接和处理请求期间超时为3个slot，响应发完、等待下一个请求的长连接
+// 用keep-alive空闲超时，每个slot调用一次tick处理到期的连接
+class conn_timer_list
+{
+public:
+    explicit conn_timer_list(int slot, timer_clock clock = timer_clock_real)
+        : m_list(clock), m_slot(slot), m_keepalive(3 * slot) {}
+
+    void set_keepalive(int seconds)
+    {
+        m_keepalive = seconds;
+    }
+    int slot() const
+    {
+        return m_slot;
+    }
+    int timeout(bool idle) const
+    {
+        return idle ? m_keepalive : 3 * m_slot;
+    }
+    time_t now() const
+    {
+        return m_list.now();
+    }
+    // 新连接的定时器
+    void add(util_timer *timer)
+    {
+        timer->expire = m_list.now() + timeout(false);
+        m_list.add_timer(timer);
+    }
+    // 收到请求或者响应发完之后刷新，空闲超时比处理期间短时到期时间会提前
+    void refresh(util_timer *timer, bool idle)
+    {
+        timer->expire = m_list.now() + timeout(idle);
+        m_list.adjust_timer(timer);
+    }
+    void del(util_timer *timer)
+    {
+        m_list.del_timer(timer);
+    }
+    int tick()
+    {
+        return m_list.tick();
+    }
+    int size() const
+    {
+        return m_list.size();
+    }
+
+private:
+    sort_timer_list m_list;
+    int m_slot;
+    int m_keepalive;
 };
 
 #endif
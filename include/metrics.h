@@ -0,0 +1,172 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "body_producer.h"
+#include <atomic>
+#include <stdint.h>
+
+/*
+    运行指标，在 /metrics 以Prometheus文本格式输出
+    每个线程第一次记录时分配一块自己的计数区，按缓存行对齐，之后只写自己的区，
+    计数用relaxed的 读-加-写(只有本线程写，不需要原子加)，请求路径上不加锁;
+    抓取时遍历所有线程的计数区求和，只在线程第一次注册时和抓取时锁注册表
+
+    直方图按对数分桶(类似HDR): 每个2的幂区间再等分成4个子桶，相对误差不超过25%，
+    单位为微秒，上限约33秒，更大的值计入最后一个桶
+*/
+
+enum METRICS_COUNTER {
+    COUNTER_CONNECTIONS = 0,  // 接受的连接数
+    COUNTER_REQUESTS,         // 发完响应的请求数
+    COUNTER_BYTES_SENT,       // 响应发送的字节数
+    COUNTER_STATUS_2XX,
+    COUNTER_STATUS_3XX,
+    COUNTER_STATUS_4XX,
+    COUNTER_STATUS_5XX,
+    COUNTER_MAX
+};
+
+enum METRICS_HISTOGRAM {
+    HIST_ACCEPT_TO_READ = 0,  // 连接建立到读到第一个请求
+    HIST_QUEUE_WAIT,          // 在线程池队列里等待
+    HIST_PARSE,               // 解析请求(不含do_request)
+    HIST_DO_REQUEST,          // do_request
+    HIST_WRITE,               // 生成响应之后到发送完毕
+    HIST_MAX
+};
+
+// do_request分派到的路由，按路由统计请求数、耗时和CPU时间
+enum METRICS_ROUTE {
+    ROUTE_OTHER = 0,    // 没有走到do_request，比如请求格式错误
+    ROUTE_STATIC,       // 静态页面、样式和脚本
+    ROUTE_MEDIA,        // 图片、音视频
+    ROUTE_PAGE,         // /0 /1 /5 /6 /7 对应的页面
+    ROUTE_LOGIN,        // /2 登录校验
+    ROUTE_REGISTER,     // /3 注册，会写数据库
+    ROUTE_DIAGNOSTICS,  // /metrics /perf /trace
+    ROUTE_MAX
+};
+
+static const int METRICS_SUB_BUCKETS = 4;
+static const int METRICS_MAX_OCTAVE  = 25;  // 最大的桶上界为2^25微秒
+static const int METRICS_BUCKETS =
+    METRICS_SUB_BUCKETS * (METRICS_MAX_OCTAVE - 1) + 1;  // 最后一个桶为+Inf
+
+struct metrics_histogram {
+    std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+    std::atomic<uint64_t> sum;  // 所有观测值的和，微秒
+};
+
+struct metrics_route {
+    metrics_histogram     duration;  // 收到请求到响应发完，微秒
+    std::atomic<uint64_t> cpu_us;    // 主线程和工作线程的CPU时间之和
+    std::atomic<uint64_t> slow;      // 超过慢请求阈值的请求数
+};
+
+// 一个线程的全部计数，对齐到缓存行，不和其他线程的计数共享缓存行
+struct alignas(64) thread_metrics {
+    std::atomic<uint64_t> counters[COUNTER_MAX];
+    metrics_histogram     histograms[HIST_MAX];
+    metrics_route         routes[ROUTE_MAX];
+};
+
+// 当前线程的计数区，第一次调用时分配并注册
+thread_metrics* metrics_local();
+
+// 值为v-1所在的桶，桶的范围是左开右闭的(下界, 上界]
+inline int metrics_bucket(uint64_t v)
+{
+    uint64_t x = v ? v - 1 : 0;
+    if (x < (uint64_t)METRICS_SUB_BUCKETS) {
+        return (int)x;
+    }
+    int msb = 63 - __builtin_clzll(x);
+    if (msb >= METRICS_MAX_OCTAVE) {
+        return METRICS_BUCKETS - 1;
+    }
+    int sub = (int)(x >> (msb - 2)) & (METRICS_SUB_BUCKETS - 1);
+    return METRICS_SUB_BUCKETS * (msb - 1) + sub;
+}
+
+// 桶的上界，微秒，最后一个桶没有上界
+inline uint64_t metrics_bucket_bound(int bucket)
+{
+    if (bucket < METRICS_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+    int msb = bucket / METRICS_SUB_BUCKETS + 1;
+    int sub = bucket % METRICS_SUB_BUCKETS;
+    return (uint64_t)(METRICS_SUB_BUCKETS + sub + 1) << (msb - 2);
+}
+
+// 只有所属线程会写，relaxed的读和写就够了
+inline void metrics_bump(std::atomic<uint64_t>& c, uint64_t v)
+{
+    c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+inline void metrics_add(METRICS_COUNTER counter, uint64_t v = 1)
+{
+    metrics_bump(metrics_local()->counters[counter], v);
+}
+
+inline void metrics_record(metrics_histogram& h, long long us)
+{
+    if (us < 0) {
+        us = 0;
+    }
+    metrics_bump(h.buckets[metrics_bucket(us)], 1);
+    metrics_bump(h.sum, us);
+}
+
+// 记录一个耗时，单位微秒
+inline void metrics_observe(METRICS_HISTOGRAM hist, long long us)
+{
+    metrics_record(metrics_local()->histograms[hist], us);
+}
+
+// 记录一个发完的请求在所属路由上的耗时和CPU时间
+inline void metrics_route_done(
+    METRICS_ROUTE route,
+    long long     wall_us,
+    long long     cpu_us,
+    bool          slow)
+{
+    metrics_route& r = metrics_local()->routes[route];
+    metrics_record(r.duration, wall_us);
+    metrics_bump(r.cpu_us, cpu_us > 0 ? cpu_us : 0);
+    if (slow) {
+        metrics_bump(r.slow, 1);
+    }
+}
+
+// 路由在指标和日志里的名字
+const char* metrics_route_name(METRICS_ROUTE route);
+
+// 抓取时读取的瞬时值，比如连接数、队列长度
+typedef long (*metrics_gauge_fn)(void* arg);
+
+// 注册一个瞬时值，启动时调用，name不带前缀
+void metrics_add_gauge(
+    const char*      name,
+    const char*      help,
+    metrics_gauge_fn fn,
+    void*            arg);
+
+// 汇总所有线程的计数，生成 /metrics 的响应体
+body_producer* new_metrics_producer();
+
+static const int METRICS_NAME_LEN = 48;
+
+// 一个指标的当前值，不带标签，给共享内存统计段用
+struct metrics_value {
+    char     name[METRICS_NAME_LEN];
+    bool     counter;  // 累计值，false为瞬时值
+    uint64_t value;
+};
+
+// 汇总所有线程的计数、按路由的统计和瞬时值，最多写max个，返回个数
+// 同一进程里每次返回的指标和顺序都一样
+int metrics_snapshot(metrics_value* out, int max);
+
+#endif
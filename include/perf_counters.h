@@ -0,0 +1,69 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include "body_producer.h"
+#include <atomic>
+#include <stdint.h>
+
+/*
+    按请求阶段统计硬件性能计数器，启动时用 -p 打开，结果在 GET /perf
+    每个线程第一次进入阶段时用perf_event_open打开自己的一组计数器
+    (硬件计数器只计用户态，时间和上下文切换包括系统调用)，
+    进入和离开阶段时各读一次，差值记到该阶段上。阶段可以嵌套，
+    外层阶段只记自己的部分(减去内层阶段)，比如解析不含do_request
+
+    虚拟机里常常没有硬件计数器，打不开的计数器在输出中标为不可用
+    每次读计数器是一次系统调用，只适合诊断时打开
+*/
+
+extern bool g_perf_enabled;  // 启动时设置，之后只读
+
+enum PERF_COUNTER {
+    PERF_TASK_CLOCK = 0,  // 在CPU上的纳秒数
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_COUNTER_MAX
+};
+
+enum PERF_STAGE {
+    PERF_REACTOR_READ = 0,  // 主线程 http_conn::read
+    PERF_REACTOR_WRITE,     // 主线程 http_conn::write
+    PERF_REACTOR_TIMER,     // 主线程 定时任务
+    PERF_PARSE,             // 解析请求，不含do_request
+    PERF_DO_REQUEST,        // 路由、stat和mmap文件
+    PERF_BUILD_RESPONSE,    // process_write 生成响应头
+    PERF_STAGE_MAX
+};
+
+// 阶段的作用域，关闭时构造和析构都只有一次分支
+class perf_scope {
+public:
+    explicit perf_scope(PERF_STAGE stage)
+    {
+        m_active = __builtin_expect(g_perf_enabled, 0) && begin(stage);
+    }
+    ~perf_scope()
+    {
+        if (m_active) {
+            end();
+        }
+    }
+
+private:
+    bool begin(PERF_STAGE stage);
+    void end();
+
+    bool        m_active;
+    PERF_STAGE  m_stage;
+    uint64_t    m_start[PERF_COUNTER_MAX];
+    uint64_t    m_child[PERF_COUNTER_MAX];  // 嵌套阶段的总和
+    perf_scope* m_parent;
+};
+
+// /perf 的响应体，各阶段跨线程汇总后的平均值
+body_producer* new_perf_producer();
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+    USDT静态跟踪点，provider为webserver，perf/bpftrace可以直接挂载，比如
+        bpftrace -e 'usdt:./webserver:webserver:write_done { @[arg1] = count(); }'
+    跟踪点编译为一条nop加ELF note，没有跟踪器挂载时没有开销。
+    CMake检测到sys/sdt.h(systemtap-sdt-dev)时定义HAVE_SYS_SDT_H，否则跟踪点为空
+
+    accept          (fd, 网络字节序的ip, 端口)
+    read_done       (fd, 读缓冲区中的字节数)
+    enqueue         (fd)
+    dequeue         (fd, 排队微秒数)
+    parse_done      (fd, 方法, url)
+    response_ready  (fd, 状态码, 待发送字节数)
+    write_done      (fd, 状态码, 已发送字节数)
+    close           (fd)
+*/
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define WS_PROBE1(name, a) DTRACE_PROBE1(webserver, name, a)
+#define WS_PROBE2(name, a, b) DTRACE_PROBE2(webserver, name, a, b)
+#define WS_PROBE3(name, a, b, c) DTRACE_PROBE3(webserver, name, a, b, c)
+#else
+#define WS_PROBE1(name, a)                                                     \
+    do {                                                                       \
+    } while (0)
+#define WS_PROBE2(name, a, b)                                                  \
+    do {                                                                       \
+    } while (0)
+#define WS_PROBE3(name, a, b, c)                                               \
+    do {                                                                       \
+    } while (0)
+#endif
+
+#endif
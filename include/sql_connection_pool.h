@@ -8,6 +8,7 @@
 #include <string.h>
 #include <iostream>
 #include <string>
+#include <atomic>
 #include "lock.h"
 
 using namespace std;
@@ -31,7 +32,7 @@ public:
 private:
 	unsigned int MaxConn;  //最大连接数
 	unsigned int CurConn;  //当前已使用的连接数
-	unsigned int FreeConn; //当前空闲的连接数
+	atomic<int> FreeConn;  //当前空闲的连接数，在锁内修改，监控不加锁读取
 
 private:
 	locker lock;
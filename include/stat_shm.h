@@ -0,0 +1,90 @@
+#ifndef STAT_SHM_H
+#define STAT_SHM_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+/*
+    共享内存统计段: 服务器后台线程每秒把 /metrics 里的计数和瞬时值汇总一次，
+    写进一个POSIX共享内存段，webserver-stat 只读映射后直接读取，
+    读统计不经过HTTP，也不给请求路径加任何系统调用和锁
+
+    段里的指标名字和顺序在启动时写好，之后不变; 值用seqlock保护:
+    写之前把seq加成奇数，写完再加成偶数，读者读到奇数或者前后两次seq
+    不一样就重读。只有一个写者，读者不会阻塞写者
+
+    默认的段名带上监听端口，同一台机器上的多个实例互不覆盖
+*/
+
+static const uint32_t    STAT_SHM_MAGIC      = 0x54535357;  // "WSST"
+static const uint32_t    STAT_SHM_VERSION    = 1;
+static const int         STAT_SHM_MAX_FIELDS = 64;
+static const int         STAT_SHM_NAME_LEN   = 48;
+static const int         STAT_SHM_READ_TRIES = 100000;
+static const char* const STAT_SHM_DEFAULT    = "/webserver_stat";  // 加_端口
+
+// 跨进程使用，必须是无锁的
+static_assert(
+    std::atomic<uint64_t>::is_always_lock_free,
+    "stat segment needs lock-free 64-bit atomics");
+
+struct stat_field {
+    char                  name[STAT_SHM_NAME_LEN];
+    uint32_t              counter;  // 1为累计值，0为瞬时值
+    std::atomic<uint64_t> value;
+};
+
+struct stat_segment {
+    std::atomic<uint32_t> magic;  // 头部和名字都写好之后才设置
+    uint32_t              version;
+    int32_t               pid;
+    int32_t               nfields;
+    int64_t               start_time;  // 服务器启动时间，unix秒
+    std::atomic<uint64_t> seq;         // 奇数表示正在更新
+    std::atomic<int64_t>  update_us;   // 最近一次发布的单调时钟时间，微秒
+    stat_field            fields[STAT_SHM_MAX_FIELDS];
+};
+
+// 监听port的服务器默认使用的段名
+inline std::string stat_shm_default_name(int port)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%d", STAT_SHM_DEFAULT, port);
+    return name;
+}
+
+// 读一份一致的快照，values至少有nfields个。写者在更新中途退出时seq一直
+// 是奇数，重试STAT_SHM_READ_TRIES次仍读不到一致的快照返回false，段已失效
+inline bool stat_shm_read(
+    const stat_segment* seg,
+    uint64_t*           values,
+    int64_t*            update_us)
+{
+    for (int tries = 0; tries < STAT_SHM_READ_TRIES; ++tries) {
+        uint64_t begin = seg->seq.load(std::memory_order_acquire);
+        if (begin & 1) {
+            continue;
+        }
+        for (int i = 0; i < seg->nfields; ++i) {
+            values[i] = seg->fields[i].value.load(std::memory_order_relaxed);
+        }
+        *update_us = seg->update_us.load(std::memory_order_relaxed);
+        // 保证上面的读在第二次读seq之前完成
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (seg->seq.load(std::memory_order_relaxed) == begin) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 创建共享内存段并启动发布线程，指标要在这之前注册好。
+// 同名的段属于另一个还在运行的进程时不接管，失败返回false
+bool stat_shm_start(const char* name, int interval_ms);
+
+// 停止发布并删除共享内存段
+void stat_shm_stop();
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "lock.h"
 #include "sql_connection_pool.h"
+#include "trace.h"
+#include <atomic>
 #include <iostream>
 #include <list>
 #include <pthread.h>
@@ -16,6 +18,11 @@ public:
         int              max_requests  = 10000);
     ~threadPool();
     bool append(T* request);  //添加任务
+    // 队列中等待的任务数，不加锁，供监控读取
+    int queue_depth() const
+    {
+        return m_queue_depth.load(std::memory_order_relaxed);
+    }
 
 private:
     static void* worker(void* args);
@@ -26,6 +33,7 @@ private:
     pthread_t*       m_threads;        // 线程池数组
     int              m_max_requests;   // 线程池里面最多的请求数
     std::list<T*>    m_workerqueue;    // 任务队列，生产者进程
+    std::atomic<int> m_queue_depth;    // 队列长度，在锁内更新
     locker           m_queuelocker;    // 互斥锁
     sem              m_queuestat;  // 信号量判断是否有任务需要处理
     bool             m_stop;       //是否结束线程
@@ -37,8 +45,9 @@ threadPool<T>::threadPool(
     connection_pool* connPool,
     int              thread_number,
     int              max_requests)
-    : m_thread_number(thread_number), m_max_requests(max_requests),
-      m_stop(false), m_threads(nullptr),m_connPool(connPool)
+    : m_thread_number(thread_number), m_threads(nullptr),
+      m_max_requests(max_requests), m_queue_depth(0), m_stop(false),
+      m_connPool(connPool)
 {
     if ((thread_number <= 0) || (max_requests <= 0)) {
         throw std::exception();
@@ -80,6 +89,7 @@ template <typename T> bool threadPool<T>::append(T* request)
         return false;                             // 返回失败
     }
     m_workerqueue.push_back(request);  // 任务入队
+    m_queue_depth.store(m_workerqueue.size(), std::memory_order_relaxed);
     m_queuelocker.unlock();            // 解锁
     m_queuestat.post();  // 任务多了一个，信号量代表任务的个数，执行p操作+1
     return true;
@@ -95,6 +105,7 @@ template <typename T> void* threadPool<T>::worker(void* args)
 // 线程池运行
 template <typename T> void threadPool<T>::run()
 {
+    trace_set_thread_name("worker");
     while (!m_stop) {
         m_queuestat.wait();  // 资源减一，如果小于0线程阻塞在任务队列上面
         m_queuelocker.lock();         // 有的话先上锁
@@ -104,12 +115,18 @@ template <typename T> void threadPool<T>::run()
         }
         T* request = m_workerqueue.front();  // 获取队首任务
         m_workerqueue.pop_front();           // 弹出
+        m_queue_depth.store(m_workerqueue.size(), std::memory_order_relaxed);
         m_queuelocker.unlock();              // 解锁
 
         if (!request) {
             continue;
         }
+        // 等待数据库连接的时间单独记录
+        long long wait_start = TRACE_ENABLED() ? access_now_us() : 0;
         connectionRAII mysqlcon(&request->mysql,m_connPool);
+        if (wait_start) {
+            trace_record("db_conn", wait_start, access_now_us(), -1);
+        }
         request->process();  // 处理任务
     }
 }
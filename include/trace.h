@@ -0,0 +1,87 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "access_log.h"
+#include "body_producer.h"
+#include <atomic>
+#include <stdint.h>
+
+/*
+    请求各阶段的跟踪，输出Chrome trace_event格式的JSON，可以用Perfetto或
+    chrome://tracing 打开。默认关闭，启动时用 -t 打开，
+    关闭时每个记录点只有一次对g_trace_enabled的判断
+
+    每个线程把事件写进自己的环形缓冲区，满了覆盖最旧的，不加锁;
+    导出时(SIGUSR1 或 /trace)复制各线程最近的事件，导出期间被覆盖的事件丢弃
+*/
+
+extern bool g_trace_enabled;  // 启动时设置，之后只读
+
+#define TRACE_ENABLED() __builtin_expect(g_trace_enabled, 0)
+
+struct trace_event {
+    const char* name;      // 阶段名，必须是字符串常量
+    int64_t     start_us;  // 单调时钟，微秒
+    int32_t     dur_us;
+    int32_t     fd;  // 关联的连接，-1表示没有
+};
+
+static const int TRACE_RING_SIZE = 8192;  // 每个线程保留的事件数，2的幂
+
+struct trace_ring {
+    trace_event           events[TRACE_RING_SIZE];
+    std::atomic<uint64_t> head;  // 已经写入的事件总数
+    const char*           thread_name;
+    int                   tid;
+};
+
+// 当前线程的缓冲区，第一次调用时分配并注册
+trace_ring* trace_local();
+
+// 设置当前线程在跟踪视图里显示的名字
+void trace_set_thread_name(const char* name);
+
+// 记录一个已经结束的阶段，调用前需要先判断TRACE_ENABLED()
+inline void trace_record(
+    const char* name,
+    long long   start_us,
+    long long   end_us,
+    int         fd)
+{
+    trace_ring*  r    = trace_local();
+    uint64_t     head = r->head.load(std::memory_order_relaxed);
+    trace_event& e    = r->events[head & (TRACE_RING_SIZE - 1)];
+    e.name            = name;
+    e.start_us        = start_us;
+    e.dur_us          = (int32_t)(end_us - start_us);
+    e.fd              = fd;
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+// 作用域内的一个阶段
+class trace_scope {
+public:
+    trace_scope(const char* name, int fd)
+        : m_name(name), m_fd(fd), m_start(TRACE_ENABLED() ? access_now_us() : 0)
+    {
+    }
+    ~trace_scope()
+    {
+        if (m_start) {
+            trace_record(m_name, m_start, access_now_us(), m_fd);
+        }
+    }
+
+private:
+    const char* m_name;
+    int         m_fd;
+    long long   m_start;
+};
+
+// 把所有线程最近的事件写成JSON文件，成功返回true
+bool trace_dump_file(const char* path);
+
+// /trace 的响应体
+body_producer* new_trace_producer();
+
+#endif
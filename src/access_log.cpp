@@ -0,0 +1,58 @@
+#include "access_log.h"
+#include "log.h"
+#include <arpa/inet.h>
+
+static bool s_enabled = false;
+static int  s_sample  = 1;
+static long s_slow_us = 0;
+
+bool access_log_init(const char* filename, int sample, int slow_ms, bool binary)
+{
+    s_sample  = sample;
+    s_slow_us = slow_ms * 1000L;
+    s_enabled = Log::get_access_log()->init(
+        filename, 2000, 800000, 0, true, log_flush_policy(), binary);
+    return s_enabled;
+}
+
+bool access_log_slow(long long total_us)
+{
+    return s_slow_us > 0 && total_us >= s_slow_us;
+}
+
+void access_log_request(const access_record& r)
+{
+    bool slow = access_log_slow(r.total_us);
+    // 采样计数是线程私有的，不需要同步
+    static thread_local unsigned counter = 0;
+    bool always  = r.status >= 500 || slow;
+    bool sampled = s_enabled &&
+                   (always || (s_sample > 0 && ++counter % s_sample == 0));
+    if (!sampled && !slow) {
+        return;
+    }
+    // inet_ntoa返回静态缓冲区，多线程下不安全
+    char     ip[INET_ADDRSTRLEN];
+    unsigned port = ntohs(r.addr->sin_port);
+    if (!inet_ntop(AF_INET, &r.addr->sin_addr, ip, sizeof(ip))) {
+        ip[0] = '\0';
+    }
+    long long cpu_us = r.reactor_cpu_us + r.worker_cpu_us;
+    if (sampled) {
+        LOG_WRITE_TO(
+            Log::get_access_log(), 1, "%s:%u %s %s %d %ld %lld %lld %lld %lld",
+            (const char*)ip, port, r.method, r.path, r.status, r.bytes,
+            r.queue_us, r.service_us, r.total_us, cpu_us);
+    }
+    if (slow) {
+        LOG_WARN(
+            "slow request %s:%u %s %s route=%s status=%d bytes=%ld "
+            "total=%lld recv=%lld queue=%lld parse=%lld do_request=%lld "
+            "build=%lld service=%lld write=%lld cpu=%lld reactor_cpu=%lld "
+            "worker_cpu=%lld",
+            (const char*)ip, port, r.method, r.path, r.route, r.status,
+            r.bytes, r.total_us, r.recv_us, r.queue_us, r.parse_us,
+            r.do_request_us, r.build_us, r.service_us, r.write_us, cpu_us,
+            r.reactor_cpu_us, r.worker_cpu_us);
+    }
+}
@@ -0,0 +1,49 @@
+#include "buffer_pool.h"
+
+buffer_pool::buffer_pool(int block_size, int max_free)
+    : m_block_size(block_size), m_max_free(max_free), m_in_use(0)
+{
+}
+
+buffer_pool::~buffer_pool()
+{
+    for (size_t i = 0; i < m_free.size(); ++i) {
+        delete[] m_free[i];
+    }
+}
+
+char* buffer_pool::get()
+{
+    char* block = nullptr;
+    m_lock.lock();
+    if (!m_free.empty()) {
+        block = m_free.back();
+        m_free.pop_back();
+    }
+    m_lock.unlock();
+    if (!block) {
+        block = new char[m_block_size];
+    }
+    m_in_use++;
+    return block;
+}
+
+void buffer_pool::put(char* block)
+{
+    m_in_use--;
+    m_lock.lock();
+    if ((int)m_free.size() < m_max_free) {
+        m_free.push_back(block);
+        block = nullptr;
+    }
+    m_lock.unlock();
+    delete[] block;
+}
+
+int buffer_pool::free_count()
+{
+    m_lock.lock();
+    int n = m_free.size();
+    m_lock.unlock();
+    return n;
+}
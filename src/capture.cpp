@@ -0,0 +1,76 @@
+#include "capture.h"
+#include "access_log.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+bool g_capture_enabled = false;
+
+static FILE*     s_file      = nullptr;
+static long long s_start_us  = 0;
+static uint32_t  s_next_conn = 0;
+static uint64_t  s_bytes     = 0;
+
+bool capture_open(const char* path)
+{
+    s_file = fopen(path, "wb");
+    if (!s_file) {
+        return false;
+    }
+    // 每次read都写一条记录，用大一点的缓冲区减少write次数
+    setvbuf(s_file, nullptr, _IOFBF, 1 << 20);
+
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    capture_file_header h;
+    memcpy(h.magic, CAPTURE_MAGIC, sizeof(h.magic));
+    h.start_unix_us = tv.tv_sec * 1000000LL + tv.tv_usec;
+    if (fwrite(&h, sizeof(h), 1, s_file) != 1) {
+        fclose(s_file);
+        s_file = nullptr;
+        return false;
+    }
+    s_start_us        = access_now_us();
+    s_bytes           = sizeof(h);
+    g_capture_enabled = true;
+    return true;
+}
+
+void capture_close()
+{
+    g_capture_enabled = false;
+    if (s_file) {
+        fclose(s_file);
+        s_file = nullptr;
+    }
+}
+
+uint32_t capture_new_conn()
+{
+    return ++s_next_conn;
+}
+
+void capture_data(uint32_t conn, const char* data, int len)
+{
+    if (!s_file || len <= 0) {
+        return;
+    }
+    if (s_bytes + sizeof(capture_record) + len > CAPTURE_MAX_BYTES) {
+        LOG_WARN("capture file reached %llu bytes, capture stopped",
+                 (unsigned long long)s_bytes);
+        capture_close();
+        return;
+    }
+    capture_record r;
+    r.conn      = conn;
+    r.len       = len;
+    r.offset_us = access_now_us() - s_start_us;
+    if (fwrite(&r, sizeof(r), 1, s_file) != 1 ||
+        fwrite(data, 1, len, s_file) != (size_t)len) {
+        LOG_ERROR("%s", "write capture file failed, capture stopped");
+        capture_close();
+        return;
+    }
+    s_bytes += sizeof(r) + len;
+}
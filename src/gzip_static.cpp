@@ -0,0 +1,402 @@
+#include "gzip_static.h"
+#include "lock.h"
+#include "log.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+struct mime_entry {
+    const char* ext;           // 扩展名
+    const char* type;          // MIME类型
+    bool        compressible;  // 是否值得压缩
+};
+
+static const mime_entry mime_table[] = {
+    {"html", "text/html; charset=utf-8", true},
+    {"htm", "text/html; charset=utf-8", true},
+    {"css", "text/css", true},
+    {"js", "application/javascript", true},
+    {"json", "application/json", true},
+    {"txt", "text/plain; charset=utf-8", true},
+    {"xml", "application/xml", true},
+    {"svg", "image/svg+xml", true},
+    {"ico", "image/x-icon", true},
+    {"jpg", "image/jpeg", false},
+    {"jpeg", "image/jpeg", false},
+    {"png", "image/png", false},
+    {"gif", "image/gif", false},
+    {"webp", "image/webp", false},
+    {"mp4", "video/mp4", false},
+    {"webm", "video/webm", false},
+    {"mp3", "audio/mpeg", false},
+    {"pdf", "application/pdf", false},
+    {"woff", "font/woff", false},
+    {"woff2", "font/woff2", false},
+};
+
+static const mime_entry* find_mime(const char* path)
+{
+    const char* dot   = strrchr(path, '.');
+    const char* slash = strrchr(path, '/');
+    if (!dot || (slash && dot < slash)) {
+        return nullptr;
+    }
+    ++dot;
+    for (size_t i = 0; i < sizeof(mime_table) / sizeof(mime_table[0]); ++i) {
+        if (strcasecmp(dot, mime_table[i].ext) == 0) {
+            return &mime_table[i];
+        }
+    }
+    return nullptr;
+}
+
+const char* mime_type(const char* path)
+{
+    const mime_entry* m = find_mime(path);
+    return m ? m->type : "application/octet-stream";
+}
+
+bool is_compressible(const char* path)
+{
+    const mime_entry* m = find_mime(path);
+    return m && m->compressible;
+}
+
+// qvalue = ("0" ["." 0*3DIGIT]) / ("1" ["." 0*3("0")])，返回千分之几，
+// 格式不对的按0处理
+static int parse_qvalue(const char* s, size_t len)
+{
+    if (len == 0 || (s[0] != '0' && s[0] != '1')) {
+        return 0;
+    }
+    int q = (s[0] - '0') * 1000;
+    if (len == 1) {
+        return q;
+    }
+    if (s[1] != '.' || len > 5) {
+        return 0;
+    }
+    int scale = 100;
+    for (size_t i = 2; i < len; ++i, scale /= 10) {
+        if (s[i] < '0' || s[i] > '9') {
+            return 0;
+        }
+        q += (s[i] - '0') * scale;
+    }
+    return q > 1000 ? 0 : q;
+}
+
+bool accept_gzip(const char* value)
+{
+    static const char* OWS = " \t";
+    int gzip_q = -1;  // 千分之几，-1表示没有列出
+    int any_q  = -1;
+    const char* p = value;
+    while (*p) {
+        // 一项: 编码名 *(OWS ";" OWS 参数名 "=" 参数值)，到逗号结束
+        p += strspn(p, OWS);
+        const char* name     = p;
+        size_t      name_len = strcspn(p, ",; \t");
+        p += name_len;
+        int q = 1000;
+        p += strspn(p, OWS);
+        while (*p == ';') {
+            ++p;
+            p += strspn(p, OWS);
+            const char* param     = p;
+            size_t      param_len = strcspn(p, "=,; \t");
+            p += param_len;
+            p += strspn(p, OWS);
+            const char* arg     = p;
+            size_t      arg_len = 0;
+            if (*p == '=') {
+                ++p;
+                p += strspn(p, OWS);
+                arg     = p;
+                arg_len = strcspn(p, ",; \t");
+                p += arg_len;
+                p += strspn(p, OWS);
+            }
+            if (param_len == 1 && (*param == 'q' || *param == 'Q')) {
+                q = parse_qvalue(arg, arg_len);
+            }
+        }
+        // 这一项剩下的不认识的部分
+        p += strcspn(p, ",");
+        if (*p == ',') {
+            ++p;
+        }
+        if (name_len == 4 && strncasecmp(name, "gzip", 4) == 0) {
+            gzip_q = q;
+        }
+        else if (name_len == 1 && *name == '*') {
+            any_q = q;
+        }
+    }
+    // 没有单独列出gzip时按 * 的q值
+    if (gzip_q < 0) {
+        gzip_q = any_q;
+    }
+    return gzip_q > 0;
+}
+
+int gzip_compress(const char* in, int in_len, char* out, int out_len)
+{
+    // 每个线程一个deflate上下文，只初始化一次，之后每次使用前reset，
+    // 避免每次压缩都分配和释放zlib内部约256KB的状态
+    static thread_local z_stream strm;
+    static thread_local bool     inited = false;
+    if (!inited) {
+        memset(&strm, 0, sizeof(strm));
+        // windowBits为15+16表示输出gzip格式
+        if (deflateInit2(
+                &strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK) {
+            return -1;
+        }
+        inited = true;
+    }
+    else {
+        deflateReset(&strm);
+    }
+    strm.next_in   = (Bytef*)in;
+    strm.avail_in  = in_len;
+    strm.next_out  = (Bytef*)out;
+    strm.avail_out = out_len;
+    if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+        return -1;  // 输出空间不够
+    }
+    return out_len - strm.avail_out;
+}
+
+// 流式压缩用的deflate上下文。生产者在工作线程创建、在主线程发送和销毁，
+// 同时可能有很多个在用，不能像gzip_compress那样每个线程只有一个，
+// 用完放回这个池里，下次reset之后接着用，不用再分配zlib的内部状态
+static const int              GZIP_STREAM_POOL_MAX = 64;
+static locker                 s_stream_lock;
+static std::vector<z_stream*> s_stream_free;
+
+static z_stream* get_stream()
+{
+    z_stream* strm = nullptr;
+    s_stream_lock.lock();
+    if (!s_stream_free.empty()) {
+        strm = s_stream_free.back();
+        s_stream_free.pop_back();
+    }
+    s_stream_lock.unlock();
+    if (strm) {
+        deflateReset(strm);
+        return strm;
+    }
+    strm = new z_stream;
+    memset(strm, 0, sizeof(*strm));
+    if (deflateInit2(
+            strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete strm;
+        return nullptr;
+    }
+    return strm;
+}
+
+static void put_stream(z_stream* strm)
+{
+    s_stream_lock.lock();
+    if ((int)s_stream_free.size() < GZIP_STREAM_POOL_MAX) {
+        s_stream_free.push_back(strm);
+        strm = nullptr;
+    }
+    s_stream_lock.unlock();
+    if (strm) {
+        deflateEnd(strm);
+        delete strm;
+    }
+}
+
+class gzip_producer : public body_producer {
+public:
+    gzip_producer(const char* data, long len) : m_strm(get_stream())
+    {
+        if (m_strm) {
+            m_strm->next_in  = (Bytef*)data;
+            m_strm->avail_in = len;
+        }
+        m_finished = false;
+    }
+    ~gzip_producer()
+    {
+        if (m_strm) {
+            put_stream(m_strm);
+        }
+    }
+
+    int produce(char* buf, int len)
+    {
+        if (m_finished) {
+            return 0;
+        }
+        m_strm->next_out  = (Bytef*)buf;
+        m_strm->avail_out = len;
+        // 输入一次性给出，每次只把输出填满一块
+        int ret = deflate(m_strm, Z_FINISH);
+        if (ret == Z_STREAM_ERROR) {
+            return -1;
+        }
+        m_finished = ret == Z_STREAM_END;
+        return len - m_strm->avail_out;
+    }
+
+    bool done() const
+    {
+        return m_finished;
+    }
+
+    bool ok() const
+    {
+        return m_strm != nullptr;
+    }
+
+private:
+    z_stream* m_strm;
+    bool      m_finished;
+};
+
+body_producer* new_gzip_producer(const char* data, long len)
+{
+    gzip_producer* p = new gzip_producer(data, len);
+    if (!p->ok()) {
+        delete p;
+        return nullptr;
+    }
+    return p;
+}
+
+// 把src压缩后写到dst，先写临时文件再rename，保证服务线程不会读到一半的文件
+static bool compress_file(const char* src, const struct stat& st, const char* dst)
+{
+    int fd = open(src, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    char* addr = (char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    // 离线压缩，用最高压缩级别
+    if (deflateInit2(
+            &strm, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+            Z_DEFAULT_STRATEGY) != Z_OK) {
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    std::string tmp = std::string(dst) + ".tmp";
+    FILE*       fp  = fopen(tmp.c_str(), "w");
+    if (!fp) {
+        deflateEnd(&strm);
+        munmap(addr, st.st_size);
+        return false;
+    }
+    strm.next_in  = (Bytef*)addr;
+    strm.avail_in = st.st_size;
+
+    char  out[16384];
+    int   ret = Z_OK;
+    bool  ok  = true;
+    while (ret != Z_STREAM_END) {
+        strm.next_out  = (Bytef*)out;
+        strm.avail_out = sizeof(out);
+        ret            = deflate(&strm, Z_FINISH);
+        if (ret == Z_STREAM_ERROR) {
+            ok = false;
+            break;
+        }
+        size_t have = sizeof(out) - strm.avail_out;
+        if (fwrite(out, 1, have, fp) != have) {
+            ok = false;
+            break;
+        }
+    }
+    // 压缩后没有变小的文件不保留
+    ok = ok && strm.total_out < (uLong)st.st_size;
+    deflateEnd(&strm);
+    munmap(addr, st.st_size);
+
+    if (fclose(fp) != 0 || !ok) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return rename(tmp.c_str(), dst) == 0;
+}
+
+// 递归遍历目录，返回新生成的 .gz 文件个数
+static int precompress_dir(const std::string& dir)
+{
+    DIR* dp = opendir(dir.c_str());
+    if (!dp) {
+        return 0;
+    }
+    int            count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dp)) != nullptr) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        std::string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            count += precompress_dir(path);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || st.st_size < GZIP_MIN_LENGTH ||
+            !is_compressible(path.c_str())) {
+            continue;
+        }
+        // 已有不比原文件旧的 .gz 就跳过
+        std::string gz = path + ".gz";
+        struct stat gz_st;
+        if (stat(gz.c_str(), &gz_st) == 0 && gz_st.st_mtime >= st.st_mtime) {
+            continue;
+        }
+        if (compress_file(path.c_str(), st, gz.c_str())) {
+            ++count;
+        }
+    }
+    closedir(dp);
+    return count;
+}
+
+static void* precompress_thread(void* args)
+{
+    const char* root  = (const char*)args;
+    int         count = precompress_dir(root);
+    LOG_INFO("gzip precompress done, %d files compressed", count);
+    return nullptr;
+}
+
+void start_gzip_precompress(const char* root)
+{
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, precompress_thread, (void*)root) != 0) {
+        LOG_ERROR("%s", "create gzip precompress thread failed");
+        return;
+    }
+    pthread_detach(tid);
+}
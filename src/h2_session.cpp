@@ -0,0 +1,831 @@
+#include "h2_session.h"
+#include "access_log.h"
+#include "gzip_static.h"
+#include "http_conn.h"
+#include "http_header.h"
+#include "log.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+// 帧类型
+enum H2_FRAME_TYPE {
+    H2_DATA = 0,
+    H2_HEADERS,
+    H2_PRIORITY,
+    H2_RST_STREAM,
+    H2_SETTINGS,
+    H2_PUSH_PROMISE,
+    H2_PING,
+    H2_GOAWAY,
+    H2_WINDOW_UPDATE,
+    H2_CONTINUATION
+};
+
+// 帧标志
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+// 错误码
+enum H2_ERROR {
+    H2_NO_ERROR = 0,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR
+};
+
+static const int32_t  DEFAULT_WINDOW    = 65535;
+static const uint32_t DEFAULT_MAX_FRAME = 16384;
+static const int64_t  MAX_WINDOW        = 0x7fffffff;
+static const size_t   MAX_HEADER_BLOCK  = 64 * 1024;
+static const size_t   OUTPUT_WATERMARK  = 64 * 1024;  // 输出攒到这么多就先发送
+
+const char h2_session::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static uint32_t read_u32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put_u32(char* p, uint32_t v)
+{
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+
+static void put_frame_header(
+    char*    p,
+    uint32_t len,
+    uint8_t  type,
+    uint8_t  flags,
+    uint32_t stream_id)
+{
+    p[0] = (char)(len >> 16);
+    p[1] = (char)(len >> 8);
+    p[2] = (char)len;
+    p[3] = (char)type;
+    p[4] = (char)flags;
+    put_u32(p + 5, stream_id & 0x7fffffff);
+}
+
+// HTTP2-Settings头是SETTINGS负载的base64url编码，不带填充
+static bool base64url_decode(const char* in, std::string& out)
+{
+    unsigned int buf  = 0;
+    int          bits = 0;
+    for (; *in && *in != '='; ++in) {
+        char c = *in;
+        int  v;
+        if (c >= 'A' && c <= 'Z')
+            v = c - 'A';
+        else if (c >= 'a' && c <= 'z')
+            v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9')
+            v = c - '0' + 52;
+        else if (c == '-' || c == '+')
+            v = 62;
+        else if (c == '_' || c == '/')
+            v = 63;
+        else
+            return false;
+        buf = (buf << 6) | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back((char)((buf >> bits) & 0xff));
+        }
+    }
+    return true;
+}
+
+h2_stream::h2_stream(uint32_t stream_id, int32_t window)
+    : id(stream_id), accept_gzip(false), end_stream(false), responded(false),
+      headers_sent(false), status(200), content_type("text/html"),
+      gzip(false), vary(false), file_address(nullptr), file_size(0),
+      use_file(false), producer(nullptr), body_offset(0), send_window(window),
+      read_us(0), recv_us(0), queue_us(0), start_us(0), do_request_us(0), service_us(0),
+      worker_cpu_us(0), route(0), bytes_sent(0)
+{
+}
+
+h2_stream::~h2_stream()
+{
+    delete producer;
+    if (file_address) {
+        munmap(file_address, file_size);
+    }
+}
+
+h2_session::h2_session(http_conn* conn, int sockfd)
+    : m_conn(conn), m_sockfd(sockfd), m_out_pos(0),
+      m_preface_received(false), m_settings_sent(false),
+      m_goaway_sent(false), m_goaway_received(false), m_last_stream_id(0),
+      m_continuation_stream(0), m_header_flags(0),
+      m_send_window(DEFAULT_WINDOW), m_peer_initial_window(DEFAULT_WINDOW),
+      m_peer_max_frame(DEFAULT_MAX_FRAME)
+{
+}
+
+h2_session::~h2_session()
+{
+    std::map<uint32_t, h2_stream*>::iterator it;
+    for (it = m_streams.begin(); it != m_streams.end(); ++it) {
+        delete it->second;
+    }
+    // 没发完就关闭的连接，这些流不算完成
+    for (size_t i = 0; i < m_finished.size(); ++i) {
+        delete m_finished[i].second;
+    }
+}
+
+bool h2_session::recv_from(int fd)
+{
+    char buf[16384];
+    while (true) {
+        int n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        m_in.append(buf, n);
+        if (m_in.size() > MAX_INPUT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void h2_session::feed(const char* data, int len)
+{
+    if (len > 0) {
+        m_in.append(data, len);
+    }
+}
+
+h2_stream* h2_session::upgrade(const char* settings_b64)
+{
+    std::string payload;
+    if (!base64url_decode(settings_b64, payload) || payload.size() % 6) {
+        return nullptr;
+    }
+    const uint8_t* p = (const uint8_t*)payload.data();
+    for (size_t i = 0; i < payload.size(); i += 6) {
+        uint16_t id = (p[i] << 8) | p[i + 1];
+        if (apply_setting(id, read_u32(p + i + 2)) != H2_NO_ERROR) {
+            return nullptr;
+        }
+    }
+    // 101之后紧跟服务端的连接前言(SETTINGS帧)，HTTP2-Settings由101隐式确认
+    m_out.append(
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Connection: Upgrade\r\n"
+        "Upgrade: h2c\r\n\r\n");
+    write_settings();
+
+    // 升级前的请求视为流1上已经收完的请求
+    h2_stream* s     = new h2_stream(1, m_peer_initial_window);
+    s->end_stream    = true;
+    m_streams[1]     = s;
+    m_last_stream_id = 1;
+    return s;
+}
+
+bool h2_session::process()
+{
+    size_t pos = 0;
+    if (!m_preface_received) {
+        size_t n = m_in.size() < (size_t)PREFACE_LEN ? m_in.size() : PREFACE_LEN;
+        if (memcmp(m_in.data(), PREFACE, n) != 0) {
+            return false;
+        }
+        if (n < (size_t)PREFACE_LEN) {
+            return true;  // 前言还不完整，继续读
+        }
+        pos                = PREFACE_LEN;
+        m_preface_received = true;
+        if (!m_settings_sent) {
+            write_settings();
+        }
+    }
+
+    bool ok = true;
+    while (ok && m_in.size() - pos >= 9) {
+        const uint8_t* p  = (const uint8_t*)m_in.data() + pos;
+        uint32_t       len = (p[0] << 16) | (p[1] << 8) | p[2];
+        if (len > DEFAULT_MAX_FRAME) {
+            goaway(H2_FRAME_SIZE_ERROR);
+            ok = false;
+            break;
+        }
+        if (m_in.size() - pos < 9 + len) {
+            break;  // 帧不完整
+        }
+        ok = handle_frame(p[3], p[4], read_u32(p + 5) & 0x7fffffff, p + 9, len);
+        pos += 9 + len;
+    }
+    m_in.erase(0, pos);
+
+    if (!ok) {
+        // 尽量把GOAWAY发出去再关闭
+        send(m_sockfd, m_out.data() + m_out_pos, m_out.size() - m_out_pos,
+             MSG_DONTWAIT);
+        return false;
+    }
+
+    // 为已经收完的请求生成响应，复用HTTP/1.1的路由和静态文件逻辑
+    std::map<uint32_t, h2_stream*>::iterator it;
+    for (it = m_streams.begin(); it != m_streams.end(); ++it) {
+        h2_stream* s = it->second;
+        if (s->end_stream && !s->responded) {
+            m_conn->serve_h2_stream(s);
+        }
+    }
+    fill_output();
+    return true;
+}
+
+int h2_session::send_to(int fd)
+{
+    while (true) {
+        if (m_out_pos == m_out.size()) {
+            m_out.clear();
+            m_out_pos = 0;
+            // 窗口允许的话继续生成数据帧
+            fill_output();
+            if (m_out.empty()) {
+                return 0;
+            }
+        }
+        int n = send(fd, m_out.data() + m_out_pos, m_out.size() - m_out_pos, 0);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            return -1;
+        }
+        m_out_pos += n;
+        report_sent();
+    }
+}
+
+bool h2_session::handle_frame(
+    uint8_t        type,
+    uint8_t        flags,
+    uint32_t       stream_id,
+    const uint8_t* payload,
+    uint32_t       len)
+{
+    // 头部块没有结束之前只能收到同一个流的CONTINUATION
+    if (m_continuation_stream &&
+        (type != H2_CONTINUATION || stream_id != m_continuation_stream)) {
+        goaway(H2_PROTOCOL_ERROR);
+        return false;
+    }
+    switch (type) {
+        case H2_DATA: return on_data(flags, stream_id, payload, len);
+        case H2_HEADERS: return on_headers(flags, stream_id, payload, len);
+        case H2_PRIORITY: {
+            // 不做优先级调度，所有流轮流发送
+            if (stream_id == 0) {
+                goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            if (len != 5) {
+                write_rst_stream(stream_id, H2_FRAME_SIZE_ERROR);
+                close_stream(stream_id);
+            }
+            return true;
+        }
+        case H2_RST_STREAM: {
+            if (len != 4) {
+                goaway(H2_FRAME_SIZE_ERROR);
+                return false;
+            }
+            if (stream_id == 0 || idle_stream(stream_id)) {
+                goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            close_stream(stream_id);
+            return true;
+        }
+        case H2_SETTINGS: {
+            if (stream_id != 0) {
+                goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            return on_settings(flags, payload, len);
+        }
+        case H2_PING: {
+            if (len != 8) {
+                goaway(H2_FRAME_SIZE_ERROR);
+                return false;
+            }
+            if (stream_id != 0) {
+                goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            if (!(flags & H2_FLAG_ACK)) {
+                write_frame_header(8, H2_PING, H2_FLAG_ACK, 0);
+                m_out.append((const char*)payload, 8);
+            }
+            return true;
+        }
+        case H2_GOAWAY: {
+            if (len < 8) {
+                goaway(H2_FRAME_SIZE_ERROR);
+                return false;
+            }
+            if (stream_id != 0) {
+                goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            // 对端不再发起新流，处理完已有的流后关闭
+            m_goaway_received = true;
+            return true;
+        }
+        case H2_WINDOW_UPDATE:
+            return on_window_update(stream_id, payload, len);
+        case H2_CONTINUATION: {
+            if (!m_continuation_stream) {
+                goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            m_header_block.append((const char*)payload, len);
+            if (m_header_block.size() > MAX_HEADER_BLOCK) {
+                goaway(H2_PROTOCOL_ERROR);
+                return false;
+            }
+            if (flags & H2_FLAG_END_HEADERS) {
+                uint32_t id           = m_continuation_stream;
+                m_continuation_stream = 0;
+                return on_header_block(id);
+            }
+            return true;
+        }
+        case H2_PUSH_PROMISE: {
+            // 客户端不能推送
+            goaway(H2_PROTOCOL_ERROR);
+            return false;
+        }
+        default: return true;  // 未知的帧类型直接忽略
+    }
+}
+
+bool h2_session::on_headers(
+    uint8_t        flags,
+    uint32_t       stream_id,
+    const uint8_t* payload,
+    uint32_t       len)
+{
+    // 客户端发起的流id必须是奇数
+    if (stream_id == 0 || !(stream_id & 1)) {
+        goaway(H2_PROTOCOL_ERROR);
+        return false;
+    }
+    const uint8_t* end = payload + len;
+    uint8_t        pad = 0;
+    if (flags & H2_FLAG_PADDED) {
+        if (payload >= end) {
+            goaway(H2_PROTOCOL_ERROR);
+            return false;
+        }
+        pad = *payload++;
+    }
+    if (flags & H2_FLAG_PRIORITY) {
+        if (end - payload < 5) {
+            goaway(H2_PROTOCOL_ERROR);
+            return false;
+        }
+        payload += 5;
+    }
+    if (pad > end - payload) {
+        goaway(H2_PROTOCOL_ERROR);
+        return false;
+    }
+    end -= pad;
+    m_header_block.assign((const char*)payload, end - payload);
+    m_header_flags = flags;
+    if (!(flags & H2_FLAG_END_HEADERS)) {
+        m_continuation_stream = stream_id;
+        return true;
+    }
+    return on_header_block(stream_id);
+}
+
+bool h2_session::on_header_block(uint32_t stream_id)
+{
+    header_list headers;
+    bool        ok = m_decoder.decode(
+        (const uint8_t*)m_header_block.data(), m_header_block.size(), headers);
+    m_header_block.clear();
+    if (!ok) {
+        goaway(H2_COMPRESSION_ERROR);
+        return false;
+    }
+    bool end_stream = m_header_flags & H2_FLAG_END_STREAM;
+
+    // 已有流上的头部是trailer，只关心请求是否结束
+    std::map<uint32_t, h2_stream*>::iterator it = m_streams.find(stream_id);
+    if (it != m_streams.end()) {
+        if (!end_stream || it->second->end_stream) {
+            goaway(H2_PROTOCOL_ERROR);
+            return false;
+        }
+        it->second->end_stream = true;
+        return true;
+    }
+    if (stream_id <= m_last_stream_id) {
+        goaway(H2_STREAM_CLOSED);
+        return false;
+    }
+    m_last_stream_id = stream_id;
+    if (m_goaway_sent || m_streams.size() >= (size_t)MAX_STREAMS) {
+        write_rst_stream(stream_id, H2_REFUSED_STREAM);
+        return true;
+    }
+
+    h2_stream* s = new h2_stream(stream_id, m_peer_initial_window);
+    for (size_t i = 0; i < headers.size(); ++i) {
+        const std::string& name = headers[i].first;
+        if (name == ":method") {
+            s->method = headers[i].second;
+        }
+        else if (name == ":path") {
+            s->path = headers[i].second;
+        }
+        else if (name == "accept-encoding") {
+            s->accept_gzip = accept_gzip(headers[i].second.c_str());
+        }
+    }
+    s->end_stream         = end_stream;
+    s->read_us            = m_conn ? m_conn->read_us() : 0;
+    m_streams[stream_id] = s;
+
+    // 到达单连接请求上限，处理完这个流就不再接受新流
+    if (m_conn && !m_conn->count_request()) {
+        goaway(H2_NO_ERROR);
+    }
+    return true;
+}
+
+bool h2_session::on_data(
+    uint8_t        flags,
+    uint32_t       stream_id,
+    const uint8_t* payload,
+    uint32_t       len)
+{
+    // 还没有打开过的流上收到DATA是连接错误
+    if (stream_id == 0 || idle_stream(stream_id)) {
+        goaway(H2_PROTOCOL_ERROR);
+        return false;
+    }
+    const uint8_t* end = payload + len;
+    if (flags & H2_FLAG_PADDED) {
+        if (len == 0 || payload[0] >= len) {
+            goaway(H2_PROTOCOL_ERROR);
+            return false;
+        }
+        end -= payload[0];
+        ++payload;
+    }
+    // 请求体很小，收到多少(含填充)就立即归还多少连接窗口
+    if (len > 0) {
+        write_window_update(0, len);
+    }
+
+    std::map<uint32_t, h2_stream*>::iterator it = m_streams.find(stream_id);
+    if (it == m_streams.end() || it->second->end_stream) {
+        write_rst_stream(stream_id, H2_STREAM_CLOSED);
+        return true;
+    }
+    h2_stream* s = it->second;
+    s->body.append((const char*)payload, end - payload);
+    if (s->body.size() > MAX_REQUEST_BODY) {
+        write_rst_stream(stream_id, H2_REFUSED_STREAM);
+        close_stream(stream_id);
+        return true;
+    }
+    if (flags & H2_FLAG_END_STREAM) {
+        s->end_stream = true;
+    }
+    else if (len > 0) {
+        write_window_update(stream_id, len);
+    }
+    return true;
+}
+
+bool h2_session::on_settings(uint8_t flags, const uint8_t* payload, uint32_t len)
+{
+    if (flags & H2_FLAG_ACK) {
+        if (len != 0) {
+            goaway(H2_FRAME_SIZE_ERROR);
+            return false;
+        }
+        return true;
+    }
+    if (len % 6) {
+        goaway(H2_FRAME_SIZE_ERROR);
+        return false;
+    }
+    for (uint32_t i = 0; i < len; i += 6) {
+        uint16_t id    = (payload[i] << 8) | payload[i + 1];
+        uint32_t error = apply_setting(id, read_u32(payload + i + 2));
+        if (error != H2_NO_ERROR) {
+            goaway(error);
+            return false;
+        }
+    }
+    write_frame_header(0, H2_SETTINGS, H2_FLAG_ACK, 0);
+    return true;
+}
+
+uint32_t h2_session::apply_setting(uint16_t id, uint32_t value)
+{
+    switch (id) {
+        case 0x2: {  // ENABLE_PUSH，服务端本来就不推送
+            return value > 1 ? H2_PROTOCOL_ERROR : H2_NO_ERROR;
+        }
+        case 0x4: {  // INITIAL_WINDOW_SIZE，变化量作用到所有已有的流上
+            if (value > MAX_WINDOW) {
+                return H2_FLOW_CONTROL_ERROR;
+            }
+            // 任何一个流的窗口因此超过2^31-1都是连接错误
+            int64_t delta = (int64_t)value - m_peer_initial_window;
+            std::map<uint32_t, h2_stream*>::iterator it;
+            for (it = m_streams.begin(); it != m_streams.end(); ++it) {
+                if (it->second->send_window + delta > MAX_WINDOW) {
+                    return H2_FLOW_CONTROL_ERROR;
+                }
+            }
+            for (it = m_streams.begin(); it != m_streams.end(); ++it) {
+                it->second->send_window += delta;
+            }
+            m_peer_initial_window = value;
+            return H2_NO_ERROR;
+        }
+        case 0x5: {  // MAX_FRAME_SIZE
+            if (value < DEFAULT_MAX_FRAME || value > 16777215) {
+                return H2_PROTOCOL_ERROR;
+            }
+            m_peer_max_frame = value;
+            return H2_NO_ERROR;
+        }
+        // HEADER_TABLE_SIZE: 编码器不使用动态表，不受影响
+        // MAX_CONCURRENT_STREAMS: 只限制服务端推送
+        default: return H2_NO_ERROR;
+    }
+}
+
+bool h2_session::on_window_update(
+    uint32_t       stream_id,
+    const uint8_t* payload,
+    uint32_t       len)
+{
+    if (len != 4) {
+        goaway(H2_FRAME_SIZE_ERROR);
+        return false;
+    }
+    uint32_t increment = read_u32(payload) & 0x7fffffff;
+    if (stream_id == 0) {
+        if (increment == 0 || m_send_window + (int64_t)increment > MAX_WINDOW) {
+            goaway(increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+            return false;
+        }
+        m_send_window += increment;
+        return true;
+    }
+    if (idle_stream(stream_id)) {
+        goaway(H2_PROTOCOL_ERROR);
+        return false;
+    }
+    std::map<uint32_t, h2_stream*>::iterator it = m_streams.find(stream_id);
+    if (it == m_streams.end()) {
+        return true;  // 已经关闭的流
+    }
+    h2_stream* s = it->second;
+    if (increment == 0 || s->send_window + (int64_t)increment > MAX_WINDOW) {
+        write_rst_stream(
+            stream_id, increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+        close_stream(stream_id);
+        return true;
+    }
+    s->send_window += increment;
+    return true;
+}
+
+void h2_session::write_frame_header(
+    uint32_t len,
+    uint8_t  type,
+    uint8_t  flags,
+    uint32_t stream_id)
+{
+    char header[9];
+    put_frame_header(header, len, type, flags, stream_id);
+    m_out.append(header, 9);
+}
+
+void h2_session::write_settings()
+{
+    // 只声明并发流上限，其余用默认值
+    char payload[6] = {0, 0x3};
+    put_u32(payload + 2, MAX_STREAMS);
+    write_frame_header(sizeof(payload), H2_SETTINGS, 0, 0);
+    m_out.append(payload, sizeof(payload));
+    m_settings_sent = true;
+}
+
+void h2_session::write_window_update(uint32_t stream_id, uint32_t increment)
+{
+    char payload[4];
+    put_u32(payload, increment);
+    write_frame_header(4, H2_WINDOW_UPDATE, 0, stream_id);
+    m_out.append(payload, 4);
+}
+
+void h2_session::write_rst_stream(uint32_t stream_id, uint32_t error)
+{
+    char payload[4];
+    put_u32(payload, error);
+    write_frame_header(4, H2_RST_STREAM, 0, stream_id);
+    m_out.append(payload, 4);
+}
+
+void h2_session::goaway(uint32_t error)
+{
+    char payload[8];
+    put_u32(payload, m_last_stream_id);
+    put_u32(payload + 4, error);
+    write_frame_header(8, H2_GOAWAY, 0, 0);
+    m_out.append(payload, 8);
+    m_goaway_sent = true;
+    if (error != H2_NO_ERROR) {
+        LOG_WARN("h2 connection error %u, last stream %u", error, m_last_stream_id);
+    }
+}
+
+// 生成响应的HEADERS帧，没有响应体时同时结束流，返回流是否已经结束
+bool h2_session::write_headers(h2_stream* s)
+{
+    std::string block;
+    hpack_encode_status(block, s->status);
+
+    int         date_len;
+    const char* date = http_date_header(&date_len);
+    // 去掉 "Date: " 和结尾的 "\r\n"
+    hpack_encode_header(block, HPACK_DATE, date + 6, date_len - 8);
+    hpack_encode_header(
+        block, HPACK_CONTENT_TYPE, s->content_type, strlen(s->content_type));
+
+    long body_len = s->use_file ? s->file_size : (long)s->inline_body.size();
+    if (!s->producer) {
+        char num[24];
+        int  n = format_uint(num, body_len);
+        hpack_encode_header(block, HPACK_CONTENT_LENGTH, num, n);
+    }
+    if (s->gzip) {
+        hpack_encode_header(block, HPACK_CONTENT_ENCODING, "gzip", 4);
+    }
+    if (s->vary) {
+        hpack_encode_header(block, HPACK_VARY, "accept-encoding", 15);
+    }
+
+    bool no_body = !s->producer && body_len == 0;
+    write_frame_header(
+        block.size(), H2_HEADERS,
+        H2_FLAG_END_HEADERS | (no_body ? H2_FLAG_END_STREAM : 0), s->id);
+    m_out += block;
+    s->headers_sent = true;
+    s->bytes_sent += 9 + block.size();
+    return no_body;
+}
+
+// 在流控窗口允许的范围内为流生成一个DATA帧
+// 返回写入的字节数，0表示被窗口阻塞，-1表示流已经结束
+int h2_session::write_data(h2_stream* s, int max_len)
+{
+    int64_t n = max_len;
+    if (n > m_send_window)
+        n = m_send_window;
+    if (n > s->send_window)
+        n = s->send_window;
+    if (n <= 0) {
+        // 生产者已经没有数据时只剩一个空的END_STREAM帧，它不占窗口
+        if (!s->producer || !s->producer->done()) {
+            return 0;
+        }
+        n = 0;
+    }
+
+    // 直接在输出缓冲区里生成负载，帧头最后回填
+    size_t header_pos = m_out.size();
+    m_out.resize(header_pos + 9 + n);
+    char* dst = &m_out[header_pos + 9];
+    int   got;
+    bool  end;
+    if (s->producer) {
+        got = s->producer->produce(dst, n);
+        if (got < 0) {
+            m_out.resize(header_pos);
+            write_rst_stream(s->id, H2_INTERNAL_ERROR);
+            return -1;
+        }
+        end = got == 0;
+    }
+    else {
+        const char* src = s->use_file ? s->file_address : s->inline_body.data();
+        long total = s->use_file ? s->file_size : (long)s->inline_body.size();
+        got        = total - s->body_offset < n ? total - s->body_offset : n;
+        memcpy(dst, src + s->body_offset, got);
+        end = s->body_offset + got >= total;
+    }
+    m_out.resize(header_pos + 9 + got);
+    put_frame_header(
+        &m_out[header_pos], got, H2_DATA, end ? H2_FLAG_END_STREAM : 0, s->id);
+    s->body_offset += got;
+    s->bytes_sent += 9 + got;
+    m_send_window -= got;
+    s->send_window -= got;
+    return end ? -1 : got;
+}
+
+// 轮流给每个有响应的流生成一帧，多个流的数据交错发送，
+// 直到输出攒够或者所有流都被流控窗口阻塞
+void h2_session::fill_output()
+{
+    bool progress = true;
+    while (progress && m_out.size() - m_out_pos < OUTPUT_WATERMARK) {
+        progress = false;
+        std::map<uint32_t, h2_stream*>::iterator it = m_streams.begin();
+        while (it != m_streams.end()) {
+            h2_stream* s = it->second;
+            ++it;
+            if (!s->responded) {
+                continue;
+            }
+            bool finished;
+            if (!s->headers_sent) {
+                finished = write_headers(s);
+            }
+            else {
+                int ret = write_data(s, m_peer_max_frame);
+                if (ret == 0) {
+                    continue;
+                }
+                finished = ret < 0;
+            }
+            progress = true;
+            if (finished) {
+                finish_stream(s);
+            }
+        }
+    }
+}
+
+void h2_session::close_stream(uint32_t id)
+{
+    std::map<uint32_t, h2_stream*>::iterator it = m_streams.find(id);
+    if (it != m_streams.end()) {
+        delete it->second;
+        m_streams.erase(it);
+    }
+}
+
+// 流的最后一帧已经放进输出缓冲区，不再参与调度，等这一帧发出去再统计
+void h2_session::finish_stream(h2_stream* s)
+{
+    m_streams.erase(s->id);
+    m_finished.push_back(std::make_pair(m_out.size(), s));
+}
+
+// 主线程: 最后一帧已经写进socket的流算作完成
+void h2_session::report_sent()
+{
+    size_t done = 0;
+    while (done < m_finished.size() && m_finished[done].first <= m_out_pos) {
+        h2_stream* s = m_finished[done].second;
+        if (m_conn) {
+            m_conn->h2_stream_done(s);
+        }
+        delete s;
+        ++done;
+    }
+    m_finished.erase(m_finished.begin(), m_finished.begin() + done);
+}
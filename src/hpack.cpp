@@ -0,0 +1,397 @@
+#include "hpack.h"
+
+static const char* static_table[][2] = {
+    {"", ""},
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+static const size_t STATIC_TABLE_LEN =
+    sizeof(static_table) / sizeof(static_table[0]) - 1;
+
+// RFC 7541 附录B的Huffman编码表，下标为符号，256为EOS
+struct huffman_code {
+    uint32_t code;
+    int      bits;
+};
+
+static const huffman_code huffman_table[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+// 由编码表构造的解码树，叶子节点保存符号
+struct huffman_node {
+    short child[2];
+    short symbol;  // -1表示内部节点
+};
+
+class huffman_tree {
+public:
+    huffman_tree() : m_count(1)
+    {
+        m_nodes[0].child[0] = m_nodes[0].child[1] = 0;
+        m_nodes[0].symbol                         = -1;
+        for (int sym = 0; sym < 257; ++sym) {
+            int node = 0;
+            for (int i = huffman_table[sym].bits - 1; i >= 0; --i) {
+                int bit = (huffman_table[sym].code >> i) & 1;
+                if (m_nodes[node].child[bit] == 0) {
+                    m_nodes[m_count].child[0] = m_nodes[m_count].child[1] = 0;
+                    m_nodes[m_count].symbol                               = -1;
+                    m_nodes[node].child[bit] = m_count++;
+                }
+                node = m_nodes[node].child[bit];
+            }
+            m_nodes[node].symbol = sym;
+        }
+    }
+
+    bool decode(const uint8_t* data, size_t len, std::string& out) const
+    {
+        int  node     = 0;
+        int  pad_bits = 0;     // 上一个符号之后消耗的位数
+        bool all_ones = true;  // 这些位是否全为1
+        for (size_t i = 0; i < len; ++i) {
+            for (int b = 7; b >= 0; --b) {
+                int bit = (data[i] >> b) & 1;
+                node    = m_nodes[node].child[bit];
+                if (node == 0) {
+                    return false;
+                }
+                ++pad_bits;
+                all_ones = all_ones && bit;
+                if (m_nodes[node].symbol >= 0) {
+                    // 字符串里出现EOS是错误
+                    if (m_nodes[node].symbol == 256) {
+                        return false;
+                    }
+                    out.push_back((char)m_nodes[node].symbol);
+                    node     = 0;
+                    pad_bits = 0;
+                    all_ones = true;
+                }
+            }
+        }
+        // 结尾只允许不超过7位的全1填充(EOS的前缀)
+        return pad_bits <= 7 && all_ones;
+    }
+
+private:
+    huffman_node m_nodes[513];
+    int          m_count;
+};
+
+static const huffman_tree& get_huffman_tree()
+{
+    static huffman_tree tree;
+    return tree;
+}
+
+// 带前缀的整数解码(RFC 7541 5.1)
+static bool decode_int(
+    const uint8_t*& p,
+    const uint8_t*  end,
+    int             prefix_bits,
+    uint64_t&       value)
+{
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    value               = *p++ & max_prefix;
+    if (value < max_prefix) {
+        return true;
+    }
+    int shift = 0;
+    while (p < end) {
+        uint8_t b = *p++;
+        value += (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+            return true;
+        }
+        if (shift > 28) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// 字符串解码(RFC 7541 5.2)，最高位表示是否为Huffman编码
+static bool decode_string(const uint8_t*& p, const uint8_t* end, std::string& out)
+{
+    if (p >= end) {
+        return false;
+    }
+    bool     huffman = *p & 0x80;
+    uint64_t len;
+    if (!decode_int(p, end, 7, len) || len > (uint64_t)(end - p)) {
+        return false;
+    }
+    out.clear();
+    if (huffman) {
+        if (!get_huffman_tree().decode(p, len, out)) {
+            return false;
+        }
+    }
+    else {
+        out.assign((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+static void encode_int(std::string& out, uint8_t first, int prefix_bits, uint64_t value)
+{
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out.push_back((char)(first | value));
+        return;
+    }
+    out.push_back((char)(first | max_prefix));
+    value -= max_prefix;
+    while (value >= 128) {
+        out.push_back((char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+hpack_decoder::hpack_decoder(size_t max_table_size)
+    : m_table_size(0), m_max_size(max_table_size),
+      m_max_allowed(max_table_size)
+{
+}
+
+bool hpack_decoder::lookup(size_t index, std::string& name, std::string& value)
+{
+    if (index == 0) {
+        return false;
+    }
+    if (index <= STATIC_TABLE_LEN) {
+        name  = static_table[index][0];
+        value = static_table[index][1];
+        return true;
+    }
+    index -= STATIC_TABLE_LEN + 1;
+    if (index >= m_table.size()) {
+        return false;
+    }
+    name  = m_table[index].first;
+    value = m_table[index].second;
+    return true;
+}
+
+void hpack_decoder::insert(const std::string& name, const std::string& value)
+{
+    size_t entry = name.size() + value.size() + 32;
+    m_table.push_front(std::make_pair(name, value));
+    m_table_size += entry;
+    evict();
+}
+
+void hpack_decoder::evict()
+{
+    while (m_table_size > m_max_size && !m_table.empty()) {
+        const std::pair<std::string, std::string>& last = m_table.back();
+        m_table_size -= last.first.size() + last.second.size() + 32;
+        m_table.pop_back();
+    }
+}
+
+bool hpack_decoder::decode(const uint8_t* data, size_t len, header_list& headers)
+{
+    const uint8_t* p   = data;
+    const uint8_t* end = data + len;
+    std::string    name, value;
+    while (p < end) {
+        uint8_t  b = *p;
+        uint64_t index;
+        if (b & 0x80) {
+            // 索引的头部字段
+            if (!decode_int(p, end, 7, index) || !lookup(index, name, value)) {
+                return false;
+            }
+            headers.push_back(std::make_pair(name, value));
+        }
+        else if ((b & 0xe0) == 0x20) {
+            // 动态表大小更新
+            if (!decode_int(p, end, 5, index) || index > m_max_allowed) {
+                return false;
+            }
+            m_max_size = index;
+            evict();
+        }
+        else {
+            // 字面量: 01为增量索引(6位前缀)，0000不索引和0001永不索引(4位前缀)
+            bool indexing = (b & 0xc0) == 0x40;
+            if (!decode_int(p, end, indexing ? 6 : 4, index)) {
+                return false;
+            }
+            if (index == 0) {
+                if (!decode_string(p, end, name)) {
+                    return false;
+                }
+            }
+            else if (!lookup(index, name, value)) {
+                return false;
+            }
+            if (!decode_string(p, end, value)) {
+                return false;
+            }
+            if (indexing) {
+                insert(name, value);
+            }
+            headers.push_back(std::make_pair(name, value));
+        }
+    }
+    return true;
+}
+
+void hpack_encode_status(std::string& out, int status)
+{
+    // 静态表里有的状态码直接用索引
+    static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};
+    for (int i = 0; i < 7; ++i) {
+        if (indexed[i] == status) {
+            encode_int(out, 0x80, 7, 8 + i);
+            return;
+        }
+    }
+    char value[4] = {(char)('0' + status / 100 % 10),
+                     (char)('0' + status / 10 % 10),
+                     (char)('0' + status % 10), '\0'};
+    hpack_encode_header(out, 8, value, 3);
+}
+
+void hpack_encode_header(
+    std::string& out,
+    int          name_index,
+    const char*  value,
+    size_t       len)
+{
+    // 0000 + 4位前缀的名字下标，不进动态表
+    encode_int(out, 0x00, 4, name_index);
+    encode_int(out, 0x00, 7, len);
+    out.append(value, len);
+}
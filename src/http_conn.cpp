@@ -1,6 +1,13 @@
 #include "http_conn.h"
+#include "access_log.h"
+#include "capture.h"
+#include "gzip_static.h"
+#include "http_header.h"
 #include "log.h"
-#include <iostream>
+#include "metrics.h"
+#include "perf_counters.h"
+#include "probes.h"
+#include "trace.h"
 #include <map>
 #include <mysql/mysql.h>
 #include <string>
@@ -20,13 +27,38 @@ const char* error_500_title = "Internal Error";
 const char* error_500_form =
     "There was an unusual problem serving the requested file.\n";
 
-// 网站的根目录
+// 网站的根目录，可以用 -r 指定
 const char* doc_root = "/home/ljxdw/c++/WebServer/WebServer/root";
 
 //将表里面的用户名和密码放入map
 std::map<std::string, std::string> users;
 locker                             m_lock;
 
+// 登录和注册表单里用户名、密码的最大长度(不含结尾的'\0')
+static const size_t FORM_FIELD_LEN = 100;
+
+// 解析登录和注册的表单 user=<name>&password=<password>，格式不对或者
+// 字段太长返回false。请求体不一定来自浏览器，不能假设它的格式和长度
+static bool parse_login_form(const char* form, char* name, char* password)
+{
+    if (!form || strncmp(form, "user=", 5) != 0) {
+        return false;
+    }
+    const char* sep = strstr(form + 5, "&password=");
+    if (!sep) {
+        return false;
+    }
+    size_t name_len     = sep - (form + 5);
+    size_t password_len = strlen(sep + 10);
+    if (name_len >= FORM_FIELD_LEN || password_len >= FORM_FIELD_LEN) {
+        return false;
+    }
+    memcpy(name, form + 5, name_len);
+    name[name_len] = '\0';
+    memcpy(password, sep + 10, password_len + 1);
+    return true;
+}
+
 void http_conn::initmysql_result(connection_pool* connPool)
 {
     MYSQL*         mysql = nullptr;
@@ -66,13 +98,16 @@ int setnonblocking(int fd)
 }
 
 // 给一个epoll实例对象添加监听的文件描述符
-void addfd(int epollfd, int fd, bool one_shot)
+void addfd(int epollfd, int fd, bool one_shot, bool et)
 {
     epoll_event event;
     event.data.fd = fd;
     // 过EPOLLRDHUP属性，来判断是否对端已经关闭，
     // 这样可以减少一次系统调用。在2.6.17的内核版本之前，只能再通过调用一次recv函数来判断
-    event.events = EPOLLET | EPOLLIN | EPOLLRDHUP;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    if (et) {
+        event.events |= EPOLLET;
+    }
     if (one_shot) {
         // 防止同一个连接被多个不同线程处理  只触发一次 还想使用需要再次注册
         event.events |= EPOLLONESHOT;
@@ -93,20 +128,74 @@ void modfd(int epollfd, int fd, int ev)
 {
     epoll_event event;
     event.data.fd = fd;
-    event.events  = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;  // 设置边沿
+    event.events  = ev | EPOLLONESHOT | EPOLLRDHUP;
+    if (http_conn::m_conn_et) {
+        event.events |= EPOLLET;  // 设置边沿
+    }
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
 //客户端的数量
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 // 所有的通信使用的socket都注册到同一个epoll内核事件中
 int http_conn::m_epollfd = -1;
+// 长连接参数，由main根据命令行设置
+int http_conn::m_max_keepalive_requests = 100;
+int http_conn::m_keepalive_timeout      = 15;
+// read()和write()都读写到EAGAIN为止，两种触发方式都适用
+bool http_conn::m_conn_et = true;
+bool http_conn::m_compact_idle = false;
+
+// 池里留着的空闲缓冲区块数，约13MB，够同时处理这么多请求时不用再分配
+static const int BUFFER_POOL_MAX_FREE = 4096;
+
+buffer_pool& http_conn::buffers()
+{
+    static buffer_pool pool(BUFFER_BLOCK_SIZE, BUFFER_POOL_MAX_FREE);
+    return pool;
+}
+// 连接复用统计
+std::atomic<long> http_conn::m_total_conns(0);
+std::atomic<long> http_conn::m_total_requests(0);
+std::atomic<long> http_conn::m_reused_requests(0);
 
 // 构造函数
-http_conn::http_conn() {}
+http_conn::http_conn()
+    : m_read_buf(nullptr), m_read_idx(0), m_checked_idx(0),
+      m_real_file(nullptr), m_write_buf(nullptr), m_file_address(nullptr),
+      m_producer(nullptr), m_chunk_buf(nullptr), m_chunk_done(false),
+      m_body_next(0), m_h2(nullptr), m_in_worker(WORKER_NONE)
+{
+}
 
 // 析构函数
-http_conn::~http_conn() {}
+http_conn::~http_conn()
+{
+    release_buffers();
+}
+
+void http_conn::attach_buffers()
+{
+    if (m_read_buf) {
+        return;
+    }
+    char* block = buffers().get();
+    bzero(block, BUFFER_BLOCK_SIZE);
+    m_read_buf  = block;
+    m_write_buf = block + READ_BUFFER_SIZE;
+    m_real_file = m_write_buf + WRITE_BUFFER_SIZE;
+}
+
+void http_conn::release_buffers()
+{
+    if (!m_read_buf) {
+        return;
+    }
+    buffers().put(m_read_buf);
+    m_read_buf  = nullptr;
+    m_write_buf = nullptr;
+    m_real_file = nullptr;
+}
 
 //初始化连接
 void http_conn::init(int sockfd, const sockaddr_in& addr)
@@ -117,19 +206,48 @@ void http_conn::init(int sockfd, const sockaddr_in& addr)
     // 端口复用
     // int reuse = 1;
     // setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-    addfd(m_epollfd, sockfd, true);
+    addfd(m_epollfd, sockfd, true, m_conn_et);
     m_user_count++;
+    m_total_conns++;
+    m_request_count = 0;
+    m_accept_us     = access_now_us();
+    m_capture_id    = CAPTURE_ENABLED() ? capture_new_conn() : 0;
+    metrics_add(COUNTER_CONNECTIONS);
+    WS_PROBE3(accept, sockfd, addr.sin_addr.s_addr, ntohs(addr.sin_port));
+    // 上一个使用该fd的连接可能是被定时器关闭的，清理它没发完的流式响应
+    end_stream();
+    unmap();
+    delete m_h2;
+    m_h2 = nullptr;
+    // 新连接不继承上一个连接留在缓冲区里的数据
+    m_read_idx    = 0;
+    m_checked_idx = 0;
     init();
 }
 
 void http_conn::init()
 {
+    // 流水线: 客户端可能不等响应就发来了下一个请求，它紧跟在已经解析完的
+    // 请求后面，挪到缓冲区开头留给下一次解析
+    int tail = m_read_idx - m_checked_idx;
+    if (tail > 0) {
+        if (m_body_next) {
+            m_read_buf[m_checked_idx] = m_body_next;
+        }
+        memmove(m_read_buf, m_read_buf + m_checked_idx, tail);
+    }
+    else {
+        tail = 0;
+    }
+
     mysql           = nullptr;
     bytes_to_send   = 0;
     bytes_have_send = 0;
 
     m_check_state = CHECK_STATE_REQUESTLINE;  // 初始状态为检查请求行
-    m_linger = false;  // 默认不保持链接  Connection : keep-alive保持连接
+    // 是否保持连接在解析完请求行之后按协议版本确定，Connection头可以覆盖
+    m_linger = false;
+    m_http11 = false;
 
     m_method         = GET;  // 默认请求方式为GET
     m_url            = 0;
@@ -138,23 +256,64 @@ void http_conn::init()
     m_host           = 0;
     m_start_line     = 0;
     m_checked_idx    = 0;
-    m_read_idx       = 0;
+    m_read_idx       = tail;
     m_write_idx      = 0;
     cgi              = 0;
+    m_string         = 0;
+    m_body_next      = 0;
+    m_accept_gzip    = false;
+    m_gzip           = false;
+    m_vary           = false;
+    m_content_type   = "text/html";
+    m_upgrade_h2c    = false;
+    m_h2_settings    = 0;
+    m_status         = 0;
+    m_read_us        = 0;
+    m_route          = ROUTE_OTHER;
+    m_reactor_cpu_us = 0;
+    m_worker_cpu_us  = 0;
+    m_cpu_mark       = 0;
 
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+    if (tail > 0) {
+        // 下一个请求的数据已经在了，接收时间就算现在
+        m_read_us = access_now_us();
+        bzero(m_read_buf + tail, BUFFER_BLOCK_SIZE - tail);
+    }
+    // 缓冲区里没有未解析的数据，空闲期间还回去，读到数据时再取。
+    // HTTP/2的流在do_request里还要用文件名缓冲区，不还
+    else if (m_compact_idle && !m_h2) {
+        release_buffers();
+    }
+    else if (m_read_buf) {
+        bzero(m_read_buf, BUFFER_BLOCK_SIZE);
+    }
 }
 
 bool http_conn::read()
 {
+    trace_scope scope("read", m_sockfd);
+    perf_scope  perf(PERF_REACTOR_READ);
+    cpu_scope   cpu(this);
+    if (m_h2) {
+        m_read_us = access_now_us();
+        bool ok   = m_h2->recv_from(m_sockfd);
+        WS_PROBE2(read_done, m_sockfd, 0);
+        return ok;
+    }
     if (m_read_idx >= READ_BUFFER_SIZE) {
         return false;
     }
+    attach_buffers();
+    if (m_read_idx == 0) {
+        m_read_us = access_now_us();
+        if (m_request_count == 0) {
+            metrics_observe(HIST_ACCEPT_TO_READ, m_read_us - m_accept_us);
+        }
+    }
     int bytes_read = 0;
-    // 非阻塞socket的ET模式，需要把数据全都读完
-    while (true) {
+    // 非阻塞socket的ET模式，需要把数据全都读完。缓冲区满了先停下，
+    // 剩下的数据等前面的请求处理完、重新注册事件时再读
+    while (m_read_idx < READ_BUFFER_SIZE) {
         // 读取socket的数据,从m_read_buf+m_read_idx开始保存，最后一个参数一般设置为0
         bytes_read = recv(
             m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx,
@@ -173,39 +332,137 @@ bool http_conn::read()
             // 断开连接
             return false;
         }
+        if (CAPTURE_ENABLED()) {
+            capture_data(m_capture_id, m_read_buf + m_read_idx, bytes_read);
+        }
         // 指针偏移
         m_read_idx += bytes_read;
     }
+    WS_PROBE2(read_done, m_sockfd, m_read_idx);
     return true;
 }
 
+void http_conn::enqueue()
+{
+    m_queued_us = access_now_us();
+    m_in_worker.store(WORKER_BUSY, std::memory_order_relaxed);
+}
+
+bool http_conn::close_after_worker()
+{
+    int busy = WORKER_BUSY;
+    return m_in_worker.compare_exchange_strong(
+        busy, WORKER_CLOSE, std::memory_order_acq_rel);
+}
+
 // 线程池的工作线程调用 处理HTTP请求的入口函数
 void http_conn::process()
 {
+    m_start_us = access_now_us();
+    metrics_observe(HIST_QUEUE_WAIT, m_start_us - m_queued_us);
+    WS_PROBE2(dequeue, m_sockfd, m_start_us - m_queued_us);
+    if (TRACE_ENABLED()) {
+        trace_record("queue", m_queued_us, m_start_us, m_sockfd);
+    }
+    trace_scope scope("process", m_sockfd);
+    if (m_h2) {
+        process_h2();
+        return;
+    }
+    // 先验知识的h2c: 连接上的第一批数据就是HTTP/2连接前言
+    int n = m_read_idx < h2_session::PREFACE_LEN ? m_read_idx
+                                                 : h2_session::PREFACE_LEN;
+    if (m_request_count == 0 && n > 0 &&
+        memcmp(m_read_buf, h2_session::PREFACE, n) == 0) {
+        if (n < h2_session::PREFACE_LEN) {
+            rearm(EPOLLIN);  // 前言不完整，继续读
+            return;
+        }
+        m_h2 = new h2_session(this, m_sockfd);
+        m_h2->feed(m_read_buf, m_read_idx);
+        m_read_idx = 0;
+        process_h2();
+        return;
+    }
+
+    // 工作线程的CPU时间要在modfd之前记上，之后连接就交回主线程了
+    long long cpu_start = access_cpu_us();
+
     // 解析http请求
-    HTTP_CODE read_ret = process_read();
+    m_do_request_us = 0;
+    HTTP_CODE read_ret;
+    {
+        perf_scope perf(PERF_PARSE);
+        read_ret = process_read();
+    }
+    long long parsed = access_now_us();
+    m_parse_us       = parsed - m_start_us - m_do_request_us;
+    metrics_observe(HIST_PARSE, m_parse_us);
+    if (TRACE_ENABLED()) {
+        trace_record("parse", m_start_us, parsed, m_sockfd);
+    }
     if (read_ret == NO_REQUEST) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        m_worker_cpu_us += access_cpu_us() - cpu_start;
+        rearm(EPOLLIN);
+        return;
+    }
+    WS_PROBE3(parse_done, m_sockfd, (int)m_method, m_url);
+
+    // 到达单连接请求上限后本次响应之后关闭连接
+    if (!count_request()) {
+        m_linger = false;
+    }
+
+    // 没有请求体的请求才能升级，响应在HTTP/2的流1上发送
+    if (m_upgrade_h2c && m_h2_settings && read_ret != BAD_REQUEST &&
+        m_content_length == 0) {
+        upgrade_h2c(read_ret, cpu_start);
         return;
     }
 
     // 生成响应
-    bool write_ret = process_write(read_ret);
+    bool      write_ret = process_write(read_ret);
+    long long built     = access_now_us();
+    m_build_us          = built - parsed;
+    m_service_us        = built - m_start_us;
+    m_worker_cpu_us += access_cpu_us() - cpu_start;
+    WS_PROBE3(response_ready, m_sockfd, m_status, bytes_to_send);
     if (!write_ret) {
         close_conn();
     }
     // 生成响应之后让主线程监听EPOLLOUT事件发送出去
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    rearm(EPOLLOUT);
+}
+
+void http_conn::rearm(int ev)
+{
+    // 先清掉标记再注册事件，注册之后主线程随时可能接着处理这个连接。
+    // 处理期间定时器到期的连接由这里关闭
+    if (m_in_worker.exchange(WORKER_NONE, std::memory_order_acq_rel) ==
+        WORKER_CLOSE) {
+        close_conn();
+        return;
+    }
+    modfd(m_epollfd, m_sockfd, ev);
 }
 
 // 关闭连接
 void http_conn ::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1)) {  // accpet调用失败返回-1
+        end_stream();
+        unmap();
+        delete m_h2;
+        m_h2 = nullptr;
         removefd(m_epollfd, m_sockfd);
+        WS_PROBE1(close, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
+        if (m_compact_idle) {
+            release_buffers();
+        }
     }
+    m_in_worker.store(WORKER_NONE, std::memory_order_release);
 }
 
 // 主状态机，解析请求
@@ -214,13 +471,14 @@ http_conn::HTTP_CODE http_conn::process_read()
     LINE_STATUS line_status = LINE_OK;  //一开始读的行状态初始化为ok
     HTTP_CODE   ret  = NO_REQUEST;      // 一开始http状态码为没有请求
     char*       text = 0;
+    // 请求体不按行解析，没收完时不能让parse_line扫过它
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) ||
-           ((line_status = parse_line()) == LINE_OK)) {
+           (m_check_state != CHECK_STATE_CONTENT &&
+            (line_status = parse_line()) == LINE_OK)) {
         // 解析一行没有错误才继续循环,第一个条件是当内容检查完了就要退出循环
         text = get_line();
         // 每次读取完一行之后把text更新为读缓冲区里面位置,从该位置继续往后读
         m_start_line = m_checked_idx;
-        std::cout << "get 1 http line: " << text << std::endl;
         LOG_INFO("%s", text);
         Log::get_instance()->flush();
 
@@ -239,14 +497,14 @@ http_conn::HTTP_CODE http_conn::process_read()
                 }
                 else if (ret == GET_REQUEST) {
                     // 如果首部后面没有内容,则已经解析完了 需要do_request
-                    return do_request();
+                    return timed_do_request();
                 }
                 break;
             }
             case CHECK_STATE_CONTENT: {
                 ret = parse_content(text);
                 if (ret == GET_REQUEST) {
-                    return do_request();
+                    return timed_do_request();
                 }
                 //解析完消息体即完成报文解析，避免再次进入循环，更新line_status
                 line_status = LINE_OPEN;
@@ -323,9 +581,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text)
     }
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");
-    if (strcasecmp(m_version, "HTTP/1.1") != 0) {
+    // HTTP/1.1默认保持连接，HTTP/1.0默认关闭
+    if (strcasecmp(m_version, "HTTP/1.1") == 0) {
+        m_http11 = true;
+    }
+    else if (strcasecmp(m_version, "HTTP/1.0") != 0) {
         return BAD_REQUEST;
     }
+    m_linger = m_http11;
     // strncasecmp()用来比较参数s1和s2字符串前n个字符，比较时会自动忽略大小写的差异。
     if (strncasecmp(m_url, "http://", 7) == 0) {
         m_url += 7;
@@ -361,7 +624,11 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         // C 库函数 size_t strspn(const char *str1, const char *str2) 检索字符串
         // str1 中第一个不在字符串 str2 中出现的字符下标。
         text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0) {
+        // 可能带多个选项，如 "keep-alive, Upgrade"
+        if (strcasestr(text, "close")) {
+            m_linger = false;
+        }
+        else if (strcasestr(text, "keep-alive")) {
             m_linger = true;
         }
     }
@@ -372,6 +639,24 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
         // 所指向的字符串转换为一个长整数（类型为 long int 型）。
         m_content_length = atol(text);
     }
+    else if (strncasecmp(text, "Accept-Encoding:", 16) == 0) {
+        text += 16;
+        text += strspn(text, " \t");
+        // 有多个Accept-Encoding头时任何一个接受gzip都算
+        if (accept_gzip(text)) {
+            m_accept_gzip = true;
+        }
+    }
+    else if (strncasecmp(text, "Upgrade:", 8) == 0) {
+        text += 8;
+        text += strspn(text, " \t");
+        m_upgrade_h2c = strcasecmp(text, "h2c") == 0;
+    }
+    else if (strncasecmp(text, "HTTP2-Settings:", 15) == 0) {
+        text += 15;
+        text += strspn(text, " \t");
+        m_h2_settings = text;
+    }
     else if (strncasecmp(text, "Host:", 5) == 0) {
         text += 5;
         text += strspn(text, " \t");
@@ -387,10 +672,13 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text)
 
 // 我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
 http_conn::HTTP_CODE http_conn::parse_content(char* text)
-{  // 如果缓冲区的大小大于数据的长度+已有的长度，说明数据没有越界
-    if (m_read_idx >= (m_content_length + m_checked_idx)) {
+{  // 请求体从m_start_line开始，收到的数据够请求体的长度就是完整的
+    if (m_read_idx >= (m_content_length + m_start_line)) {
+        // 请求体后面可能是流水线的下一个请求，被截断的字节在init里还原
+        m_body_next            = text[m_content_length];
         text[m_content_length] = '\0';
         m_string               = text;  // post 请求
+        m_checked_idx          = m_start_line + m_content_length;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -415,6 +703,19 @@ http_conn::HTTP_CODE http_conn::parse_content(char* text)
 //     // 最后一次改变时间(指属性)
 // };
 
+http_conn::HTTP_CODE http_conn::timed_do_request()
+{
+    perf_scope perf(PERF_DO_REQUEST);
+    long long  start = access_now_us();
+    HTTP_CODE ret   = do_request();
+    m_do_request_us = access_now_us() - start;
+    metrics_observe(HIST_DO_REQUEST, m_do_request_us);
+    if (TRACE_ENABLED()) {
+        trace_record("do_request", start, start + m_do_request_us, m_sockfd);
+    }
+    return ret;
+}
+
 http_conn::HTTP_CODE http_conn::do_request()
 {
     strcpy(m_real_file, doc_root);  //复制最外面的路径
@@ -430,9 +731,33 @@ http_conn::HTTP_CODE http_conn::do_request()
     // 所指向的字符串中搜索第一次出现字符 c（一个无符号字符）的位置。
     const char* p = strchr(m_url, '/');
 
-    if (cgi == 1 && (*(p + 1) == '2') || *(p + 1) == '3') {
+    // 运行指标，不对应文件，每次抓取时生成
+    m_route = ROUTE_STATIC;
+    if (strcmp(m_url, "/metrics") == 0) {
+        m_route        = ROUTE_DIAGNOSTICS;
+        m_producer     = new_metrics_producer();
+        m_content_type = "text/plain; version=0.0.4";
+        return STREAM_REQUEST;
+    }
+    // 各阶段的硬件计数器，没有用 -p 打开时只有一行说明
+    if (strcmp(m_url, "/perf") == 0) {
+        m_route        = ROUTE_DIAGNOSTICS;
+        m_producer     = new_perf_producer();
+        m_content_type = "text/plain; charset=utf-8";
+        return STREAM_REQUEST;
+    }
+    // 各线程最近的跟踪事件，没有用 -t 打开跟踪时为空
+    if (strcmp(m_url, "/trace") == 0) {
+        m_route        = ROUTE_DIAGNOSTICS;
+        m_producer     = new_trace_producer();
+        m_content_type = "application/json";
+        return STREAM_REQUEST;
+    }
+
+    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3')) {
         // 根据标志判断是登录还是注册
         char  flag       = m_url[1];
+        m_route          = *(p + 1) == '3' ? ROUTE_REGISTER : ROUTE_LOGIN;
         char* m_url_real = (char*)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/");
         // 字符串追加
@@ -441,25 +766,18 @@ http_conn::HTTP_CODE http_conn::do_request()
         free(m_url_real);
 
         //将用户名和密码提取出来
-        // user=123&passwd=123
-        char name[100], password[100];
-        int  i;
-        for (i = 5; m_string[i] != '&'; ++i) {
-            name[i - 5] = m_string[i];
-        }
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j) {
-            password[j] = m_string[i];
+        // user=123&password=123
+        char name[FORM_FIELD_LEN], password[FORM_FIELD_LEN];
+        if (!parse_login_form(m_string, name, password)) {
+            return BAD_REQUEST;
         }
-        password[j] = '\0';
 
         // 同步线程登录校验
         if (*(p + 1) == '3') {
             //如果是注册，先检测数据库中是否有重名的
             //没有重名的，进行增加数据
-            char* sql_insert = (char*)malloc(sizeof(char) * 200);
+            // 语句的固定部分加上两个最长的字段不超过256字节
+            char* sql_insert = (char*)malloc(sizeof(char) * 256);
             strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
             strcat(sql_insert, "'");
             strcat(sql_insert, name);
@@ -467,12 +785,13 @@ http_conn::HTTP_CODE http_conn::do_request()
             strcat(sql_insert, password);
             strcat(sql_insert, "')");
 
+            // 查重和插入在同一把锁里，并发注册时map不会被同时修改
+            m_lock.lock();
             if (users.find(name) == users.end()) {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
+                // 没有数据库(-u 内存用户表)时只记在map里
+                int res = mysql ? mysql_query(mysql, sql_insert) : 0;
                 users.insert(
                     std::pair<std::string, std::string>(name, password));
-                m_lock.unlock();
                 if (!res) {
                     strcpy(m_url, "/log.html");
                 }
@@ -483,17 +802,26 @@ http_conn::HTTP_CODE http_conn::do_request()
             else {
                 strcpy(m_url, "/registerError.html");
             }
+            m_lock.unlock();
+            free(sql_insert);
         }
         //如果是登录，直接判断
         //若浏览器端输入的用户名和密码在表中可以查找到，返回1，否则返回0
         else if (*(p + 1) == '2') {
-            if (users.find(name) != users.end() && users[name] == password) {
+            m_lock.lock();
+            std::map<std::string, std::string>::iterator it = users.find(name);
+            bool ok = it != users.end() && it->second == password;
+            m_lock.unlock();
+            if (ok) {
                 strcpy(m_url, "/welcome.html");
             }
             else
                 strcpy(m_url, "/logError.html");
         }
     }
+    if (m_route == ROUTE_STATIC && *(p + 1) && strchr("01567", *(p + 1))) {
+        m_route = ROUTE_PAGE;
+    }
     if (*(p + 1) == '0') {
         char* m_url_real = (char*)malloc(sizeof(char) * 200);
         strcpy(m_url_real, "/register.html");
@@ -532,38 +860,75 @@ http_conn::HTTP_CODE http_conn::do_request()
         return FORBIDDEN_REQUEST;
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
+    m_content_type = mime_type(m_real_file);
+    if (m_route == ROUTE_STATIC && (strncmp(m_content_type, "image/", 6) == 0 ||
+                                    strncmp(m_content_type, "video/", 6) == 0 ||
+                                    strncmp(m_content_type, "audio/", 6) == 0)) {
+        m_route = ROUTE_MEDIA;
+    }
+    if (is_compressible(m_real_file)) {
+        m_vary = true;
+        // 客户端接受gzip并且有不比原文件旧的预压缩变体，直接映射 .gz 文件
+        if (m_accept_gzip) {
+            char        gz_file[FILENAME_LEN + 3];
+            struct stat gz_stat;
+            snprintf(gz_file, sizeof(gz_file), "%s.gz", m_real_file);
+            if (stat(gz_file, &gz_stat) == 0 && S_ISREG(gz_stat.st_mode) &&
+                gz_stat.st_mtime >= m_file_stat.st_mtime) {
+                int fd = open(gz_file, O_RDONLY);
+                if (fd >= 0) {
+                    m_file_stat = gz_stat;
+                    m_gzip      = true;
+                    m_file_address = (char*)mmap(
+                        0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    close(fd);
+                    return FILE_REQUEST;
+                }
+            }
+        }
+    }
     int fd = open(m_real_file, O_RDONLY);
     m_file_address =
         (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    // 可压缩但还没有预压缩变体(比如后台压缩还没做完)，边压缩边分块发送
+    if (m_accept_gzip && m_vary && m_file_stat.st_size >= GZIP_MIN_LENGTH) {
+        m_producer = new_gzip_producer(m_file_address, m_file_stat.st_size);
+        if (m_producer) {
+            m_gzip = true;
+            return STREAM_REQUEST;
+        }
+    }
     return FILE_REQUEST;
 }
 
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    perf_scope perf(PERF_BUILD_RESPONSE);
     switch (ret) {
         case INTERNAL_ERROR: {
+            m_status = 500;
             add_status_line(500, error_500_title);
-            add_headers(strlen(error_500_form));
-            if (!add_content(error_500_form))
+            if (!add_body(error_500_form))
                 return false;
             break;
         }
         case BAD_REQUEST: {
+            m_status = 404;
             add_status_line(404, error_404_title);
-            add_headers(strlen(error_404_form));
-            if (!add_content(error_404_form))
+            if (!add_body(error_404_form))
                 return false;
             break;
         }
         case FORBIDDEN_REQUEST: {
+            m_status = 403;
             add_status_line(403, error_403_title);
-            add_headers(strlen(error_403_form));
-            if (!add_content(error_403_form))
+            if (!add_body(error_403_form))
                 return false;
             break;
         }
         case FILE_REQUEST: {
+            m_status = 200;
             add_status_line(200, ok_200_title);
             if (m_file_stat.st_size != 0) {
                 add_headers(m_file_stat.st_size);
@@ -577,10 +942,24 @@ bool http_conn::process_write(HTTP_CODE ret)
             }
             else {
                 const char* ok_string = "<html><body></body></html>";
-                add_headers(strlen(ok_string));
-                if (!add_content(ok_string))
+                if (!add_body(ok_string))
                     return false;
             }
+            break;
+        }
+        case STREAM_REQUEST: {
+            m_status = 200;
+            add_status_line(200, ok_200_title);
+            if (!add_stream_headers() || !next_chunk()) {
+                return false;
+            }
+            // 头部和第一块一起发出去
+            m_iv[1]         = m_iv[0];
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len  = m_write_idx;
+            m_iv_count       = 2;
+            bytes_to_send    = m_write_idx + m_iv[1].iov_len;
+            return true;
         }
         default: return false;
     }
@@ -595,11 +974,32 @@ bool http_conn::process_write(HTTP_CODE ret)
 
 bool http_conn::write()
 {
-    int temp = 0;
+    trace_scope scope("write", m_sockfd);
+    perf_scope  perf(PERF_REACTOR_WRITE);
+    cpu_scope   cpu(this);
+    int         temp = 0;
+
+    if (m_h2) {
+        int ret = m_h2->send_to(m_sockfd);
+        if (ret < 0) {
+            return false;
+        }
+        if (ret == 0 && m_h2->closing()) {
+            return false;
+        }
+        modfd(m_epollfd, m_sockfd, ret > 0 ? EPOLLOUT : EPOLLIN);
+        return true;
+    }
+
+    if (m_producer) {
+        return write_stream();
+    }
 
     if (bytes_to_send == 0) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
         init();
+        if (!pipelined()) {
+            modfd(m_epollfd, m_sockfd, EPOLLIN);
+        }
         return true;
     }
 
@@ -635,11 +1035,16 @@ bool http_conn::write()
         }
         // 没有数据发送
         if (bytes_to_send <= 0) {
+            request_done();
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
 
             if (m_linger) {
                 init();
+                // 缓冲区里已经有下一个请求时由主线程直接交给线程池，
+                // 这时不能注册EPOLLIN，否则主线程会和工作线程同时读写缓冲区
+                if (!pipelined()) {
+                    modfd(m_epollfd, m_sockfd, EPOLLIN);
+                }
                 return true;
             }
             else {
@@ -677,45 +1082,241 @@ bool http_conn::add_response(const char* format, ...)
 
 bool http_conn::add_status_line(int status, const char* title)
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    int         len;
+    const char* line = http_status_line(status, &len);
+    if (!line) {
+        return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    }
+    return add_bytes(line, len);
 }
 
 //添加消息报头，具体的添加文本长度、连接状态和空行
 bool http_conn::add_headers(int content_length)
 {
-    add_content_length(content_length);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+    int         date_len;
+    const char* date = http_date_header(&date_len);
+    return add_bytes(date, date_len) && add_content_length(content_length) &&
+           add_content_type() && add_content_encoding() && add_linger() &&
+           add_blank_line();
 }
 
 // 添加内容
 bool http_conn::add_content(const char* content)
 {
-    return add_response("%s", content);
+    return add_bytes(content, strlen(content));
+}
+
+// 追加任意字节(可能含'\0')，压缩过的响应体不能走格式化
+bool http_conn::add_bytes(const char* data, int len)
+{
+    if (len > WRITE_BUFFER_SIZE - 1 - m_write_idx) {
+        return false;
+    }
+    memcpy(m_write_buf + m_write_idx, data, len);
+    m_write_idx += len;
+    return true;
+}
+
+// 添加头部和内联的响应体(错误页等)，客户端支持gzip且内容足够大时压缩后发送
+bool http_conn::add_body(const char* content)
+{
+    int len = strlen(content);
+    if (m_accept_gzip && len >= GZIP_MIN_LENGTH) {
+        char zbuf[WRITE_BUFFER_SIZE];
+        int  zlen = gzip_compress(content, len, zbuf, sizeof(zbuf));
+        if (zlen > 0 && zlen < len) {
+            m_gzip = true;
+            m_vary = true;
+            add_headers(zlen);
+            return add_bytes(zbuf, zlen);
+        }
+    }
+    add_headers(len);
+    return add_content(content);
 }
 
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_bytes(HDR_FRAGMENT("Content-Type: ")) &&
+           add_bytes(m_content_type, strlen(m_content_type)) &&
+           add_bytes(HDR_FRAGMENT("\r\n"));
+}
+
+// 响应体被压缩时声明编码，内容随Accept-Encoding变化时告诉缓存
+bool http_conn::add_content_encoding()
+{
+    if (m_gzip && !add_bytes(HDR_FRAGMENT("Content-Encoding: gzip\r\n"))) {
+        return false;
+    }
+    if (m_vary) {
+        return add_bytes(HDR_FRAGMENT("Vary: Accept-Encoding\r\n"));
+    }
+    return true;
 }
 
 // 添加Content-Length，表示响应报文的长度
 bool http_conn::add_content_length(int content_length)
 {
-    return add_response("Content-Length: %d\r\n", content_length);
+    // "Content-Length: " + 最多20位数字 + "\r\n"
+    char buf[40] = "Content-Length: ";
+    int  len     = sizeof("Content-Length: ") - 1;
+    len += format_uint(buf + len, content_length);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return add_bytes(buf, len);
 }
 
 //添加连接状态，通知浏览器端是保持连接还是关闭
 bool http_conn::add_linger()
 {
-    return add_response(
-        "Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    if (m_linger) {
+        return add_bytes(HDR_FRAGMENT("Connection: keep-alive\r\n")) &&
+               add_keepalive();
+    }
+    return add_bytes(HDR_FRAGMENT("Connection: close\r\n"));
+}
+
+// 告诉客户端空闲超时和剩余可用的请求数，"Keep-Alive: timeout=15, max=99"
+bool http_conn::add_keepalive()
+{
+    char buf[64] = "Keep-Alive: timeout=";
+    int  len     = sizeof("Keep-Alive: timeout=") - 1;
+    len += format_uint(buf + len, m_keepalive_timeout);
+    if (m_max_keepalive_requests > 0) {
+        memcpy(buf + len, ", max=", 6);
+        len += 6;
+        len += format_uint(
+            buf + len, m_max_keepalive_requests - m_request_count);
+    }
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    return add_bytes(buf, len);
 }
 //添加空行
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return add_bytes(HDR_FRAGMENT("\r\n"));
+}
+
+// 流式响应的头部，长度未知，用chunked编码
+bool http_conn::add_stream_headers()
+{
+    // HTTP/1.0不认识chunked，只能靠关闭连接表示响应体结束
+    m_chunked = m_http11;
+    if (!m_chunked) {
+        m_linger = false;
+    }
+    int         date_len;
+    const char* date = http_date_header(&date_len);
+    return add_bytes(date, date_len) &&
+           (!m_chunked ||
+            add_bytes(HDR_FRAGMENT("Transfer-Encoding: chunked\r\n"))) &&
+           add_content_type() && add_content_encoding() && add_linger() &&
+           add_blank_line();
+}
+
+// 向生产者要下一块数据，编码成 "长度(十六进制)\r\n数据\r\n" 放到m_iv[0]
+// 生产者结束后生成结束块 "0\r\n\r\n"
+bool http_conn::next_chunk()
+{
+    // 块头最多8位十六进制长度加\r\n，预留在数据前面，避免拷贝数据
+    static const int HEAD_RESERVE = 10;
+    if (!m_chunk_buf) {
+        m_chunk_buf = new char[HEAD_RESERVE + CHUNK_SIZE + 2];
+    }
+    char* data = m_chunk_buf + HEAD_RESERVE;
+    int   len  = m_producer->produce(data, CHUNK_SIZE);
+    if (len < 0) {
+        return false;
+    }
+    if (len == 0) {
+        static const char last_chunk[] = "0\r\n\r\n";
+        m_chunk_done                   = true;
+        m_iv[0].iov_base               = (void*)last_chunk;
+        m_iv[0].iov_len = m_chunked ? sizeof(last_chunk) - 1 : 0;
+    }
+    else if (!m_chunked) {
+        m_iv[0].iov_base = data;
+        m_iv[0].iov_len  = len;
+    }
+    else {
+        static const char hex[] = "0123456789abcdef";
+        char*             head  = data - 2;
+        head[0]                 = '\r';
+        head[1]                 = '\n';
+        for (int n = len; n > 0; n >>= 4) {
+            *--head = hex[n & 0xf];
+        }
+        data[len]        = '\r';
+        data[len + 1]    = '\n';
+        m_iv[0].iov_base = head;
+        m_iv[0].iov_len  = data + len + 2 - head;
+    }
+    m_iv_count    = 1;
+    bytes_to_send = m_iv[0].iov_len;
+    return true;
+}
+
+// 流式响应的发送，只有在socket可写、上一块完全发出后才生产下一块，
+// socket写满时交给主线程等待EPOLLOUT，生产者也随之暂停
+bool http_conn::write_stream()
+{
+    while (true) {
+        if (bytes_to_send == 0) {
+            if (m_chunk_done) {
+                request_done();
+                end_stream();
+                unmap();
+                if (m_linger) {
+                    init();
+                    if (!pipelined()) {
+                        modfd(m_epollfd, m_sockfd, EPOLLIN);
+                    }
+                    return true;
+                }
+                return false;
+            }
+            if (!next_chunk()) {
+                end_stream();
+                unmap();
+                return false;
+            }
+        }
+
+        int temp = writev(m_sockfd, m_iv, m_iv_count);
+        if (temp < 0) {
+            if (errno == EAGAIN) {
+                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                return true;
+            }
+            end_stream();
+            unmap();
+            return false;
+        }
+        bytes_have_send += temp;
+        bytes_to_send -= temp;
+        // 按发送的字节数推进iovec
+        for (int i = 0; i < m_iv_count && temp > 0; ++i) {
+            int step = temp < (int)m_iv[i].iov_len ? temp : m_iv[i].iov_len;
+            m_iv[i].iov_base = (char*)m_iv[i].iov_base + step;
+            m_iv[i].iov_len -= step;
+            temp -= step;
+        }
+    }
+}
+
+// 释放流式响应占用的生产者和分块缓冲区
+void http_conn::end_stream()
+{
+    if (m_producer) {
+        delete m_producer;
+        m_producer = nullptr;
+    }
+    if (m_chunk_buf) {
+        delete[] m_chunk_buf;
+        m_chunk_buf = nullptr;
+    }
+    m_chunk_done = false;
 }
 
 void http_conn::unmap()
@@ -725,3 +1326,224 @@ void http_conn::unmap()
         m_file_address = 0;
     }
 }
+
+http_conn::cpu_scope::cpu_scope(http_conn* conn) : m_conn(conn)
+{
+    conn->m_cpu_mark = access_cpu_us();
+}
+
+void http_conn::cpu_stop()
+{
+    if (m_cpu_mark) {
+        m_reactor_cpu_us += access_cpu_us() - m_cpu_mark;
+        m_cpu_mark = 0;
+    }
+}
+
+static const char* method_names[] = {
+    "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+
+// 一个响应发完的请求: 请求数、状态码、发送字节数、发送耗时和路由的耗时
+static void record_request(const access_record& r, METRICS_ROUTE route, int fd)
+{
+    metrics_add(COUNTER_REQUESTS);
+    metrics_add(COUNTER_BYTES_SENT, r.bytes);
+    if (r.status >= 200 && r.status < 600) {
+        metrics_add((METRICS_COUNTER)(COUNTER_STATUS_2XX + r.status / 100 - 2));
+    }
+    metrics_observe(HIST_WRITE, r.write_us);
+    WS_PROBE3(write_done, fd, r.status, r.bytes);
+    metrics_route_done(
+        route, r.total_us, r.reactor_cpu_us + r.worker_cpu_us,
+        access_log_slow(r.total_us));
+}
+
+void http_conn::request_done()
+{
+    // 发完之后的清理不算在本请求上，也不能算到下一个请求上
+    cpu_stop();
+    long long now = access_now_us();
+
+    access_record r;
+    r.addr           = &m_address;
+    r.method         = method_names[m_method];
+    r.path           = m_url ? m_url : "-";
+    r.route          = metrics_route_name(m_route);
+    r.status         = m_status;
+    r.bytes          = bytes_have_send;
+    r.recv_us        = m_queued_us - m_read_us;
+    r.queue_us       = m_start_us - m_queued_us;
+    r.parse_us       = m_parse_us;
+    r.do_request_us  = m_do_request_us;
+    r.build_us       = m_build_us;
+    r.service_us     = m_service_us;
+    r.write_us       = now - m_start_us - m_service_us;
+    r.total_us       = now - m_read_us;
+    r.reactor_cpu_us = m_reactor_cpu_us;
+    r.worker_cpu_us  = m_worker_cpu_us;
+    record_request(r, m_route, m_sockfd);
+    access_log_request(r);
+}
+
+// 主线程在流的最后一帧写进socket之后调用，各阶段耗时由h2_stream_stats记下。
+// 连接上的流共用主线程的读写，主线程CPU时间不分摊到流上
+void http_conn::h2_stream_done(const h2_stream* s)
+{
+    long long     now = access_now_us();
+    access_record r;
+    r.addr           = &m_address;
+    r.method         = s->method.empty() ? "-" : s->method.c_str();
+    r.path           = s->path.empty() ? "-" : s->path.c_str();
+    r.route          = metrics_route_name((METRICS_ROUTE)s->route);
+    r.status         = s->status;
+    r.bytes          = s->bytes_sent;
+    r.recv_us        = s->recv_us;
+    r.queue_us       = s->queue_us;
+    r.parse_us       = 0;
+    r.do_request_us  = s->do_request_us;
+    r.build_us       = s->service_us - s->do_request_us;
+    r.service_us     = s->service_us;
+    r.write_us       = now - s->start_us - s->service_us;
+    r.total_us       = now - s->read_us;
+    r.reactor_cpu_us = 0;
+    r.worker_cpu_us  = s->worker_cpu_us;
+    record_request(r, (METRICS_ROUTE)s->route, m_sockfd);
+    access_log_request(r);
+}
+
+bool http_conn::count_request()
+{
+    // 统计连接复用
+    ++m_request_count;
+    m_total_requests++;
+    if (m_request_count > 1) {
+        m_reused_requests++;
+    }
+    return m_max_keepalive_requests <= 0 ||
+           m_request_count < m_max_keepalive_requests;
+}
+
+// HTTP/2连接由会话处理所有收到的帧，有待发送的数据就监听EPOLLOUT
+void http_conn::process_h2()
+{
+    if (!m_h2->process()) {
+        close_conn();
+        return;
+    }
+    rearm(m_h2->want_write() ? EPOLLOUT : EPOLLIN);
+}
+
+// 处理 Upgrade: h2c，已经解析好的请求作为流1的请求
+void http_conn::upgrade_h2c(HTTP_CODE ret, long long cpu_start)
+{
+    m_h2         = new h2_session(this, m_sockfd);
+    h2_stream* s = m_h2->upgrade(m_h2_settings);
+    if (!s) {
+        close_conn();
+        return;
+    }
+    // 升级前的请求已经由process解析和生成响应，计时从那里开始
+    s->method   = method_names[m_method];
+    s->path     = m_url ? m_url : "";
+    s->read_us  = m_read_us;
+    s->start_us = m_start_us;
+    make_h2_response(ret, s);
+    h2_stream_stats(s, cpu_start);
+    // 客户端可能已经紧跟着发送了连接前言
+    m_h2->feed(m_read_buf + m_checked_idx, m_read_idx - m_checked_idx);
+    m_checked_idx = m_read_idx;
+    init();
+    process_h2();
+}
+
+void http_conn::serve_h2_stream(h2_stream* s)
+{
+    long long cpu_start = access_cpu_us();
+    s->start_us         = access_now_us();
+    m_route             = ROUTE_OTHER;
+    m_do_request_us     = 0;
+
+    char url[FILENAME_LEN];
+    m_accept_gzip  = s->accept_gzip;
+    m_gzip         = false;
+    m_vary         = false;
+    m_content_type = "text/html";
+    bzero(m_real_file, FILENAME_LEN);
+
+    HTTP_CODE ret = BAD_REQUEST;
+    bool      get = s->method == "GET";
+    bool      post = s->method == "POST";
+    // 请求体最长有MAX_REQUEST_BODY，登录和注册的表单由do_request检查格式和长度
+    if ((get || post) && !s->path.empty() && s->path[0] == '/' &&
+        s->path.size() < FILENAME_LEN - 16) {
+        strcpy(url, s->path.c_str());
+        //当url为/时，显示判断界面
+        if (strlen(url) == 1) {
+            strcat(url, "judge.html");
+        }
+        m_method = post ? POST : GET;
+        cgi      = post;
+        m_url    = url;
+        m_string = (char*)s->body.c_str();
+        ret      = timed_do_request();
+    }
+    make_h2_response(ret, s);
+    h2_stream_stats(s, cpu_start);
+}
+
+// 记下流在工作线程里的各阶段耗时，发完之后由h2_stream_done统计
+void http_conn::h2_stream_stats(h2_stream* s, long long cpu_start)
+{
+    s->recv_us       = m_queued_us - s->read_us;
+    s->queue_us      = m_start_us - m_queued_us;
+    s->do_request_us = m_do_request_us;
+    s->service_us    = access_now_us() - s->start_us;
+    s->worker_cpu_us = access_cpu_us() - cpu_start;
+    s->route         = m_route;
+}
+
+// 把do_request的结果转成流的响应，mmap的文件和生产者的所有权交给流
+void http_conn::make_h2_response(HTTP_CODE ret, h2_stream* s)
+{
+    switch (ret) {
+        case FILE_REQUEST:
+        case STREAM_REQUEST: {
+            s->status       = 200;
+            s->content_type = m_content_type;
+            s->gzip         = m_gzip;
+            s->vary         = m_vary;
+            s->producer     = m_producer;
+            // 不对应文件的动态内容(比如/metrics)只有生产者，没有文件
+            if (!m_producer || m_file_address) {
+                if (m_file_stat.st_size == 0) {
+                    s->inline_body = "<html><body></body></html>";
+                    unmap();
+                }
+                else {
+                    s->file_address = m_file_address;
+                    s->file_size    = m_file_stat.st_size;
+                    s->use_file     = !m_producer;
+                }
+            }
+            m_file_address = nullptr;
+            m_producer     = nullptr;
+            break;
+        }
+        case FORBIDDEN_REQUEST: {
+            s->status      = 403;
+            s->inline_body = error_403_form;
+            break;
+        }
+        case INTERNAL_ERROR: {
+            s->status      = 500;
+            s->inline_body = error_500_form;
+            break;
+        }
+        default: {
+            s->status      = 404;
+            s->inline_body = error_404_form;
+            break;
+        }
+    }
+    s->responded = true;
+}
@@ -0,0 +1,66 @@
+#include "http_header.h"
+#include <stdio.h>
+
+const char http_digit_pairs[201] = "00010203040506070809"
+                                   "10111213141516171819"
+                                   "20212223242526272829"
+                                   "30313233343536373839"
+                                   "40414243444546474849"
+                                   "50515253545556575859"
+                                   "60616263646566676869"
+                                   "70717273747576777879"
+                                   "80818283848586878889"
+                                   "90919293949596979899";
+
+#define STATUS_LINE(code, text)                                                \
+    case code: {                                                               \
+        static const char line[] = "HTTP/1.1 " #code " " text "\r\n";          \
+        *len                     = sizeof(line) - 1;                           \
+        return line;                                                           \
+    }
+
+const char* http_status_line(int status, int* len)
+{
+    switch (status) {
+        STATUS_LINE(101, "Switching Protocols")
+        STATUS_LINE(200, "OK")
+        STATUS_LINE(204, "No Content")
+        STATUS_LINE(206, "Partial Content")
+        STATUS_LINE(301, "Moved Permanently")
+        STATUS_LINE(302, "Found")
+        STATUS_LINE(304, "Not Modified")
+        STATUS_LINE(400, "Bad Request")
+        STATUS_LINE(403, "Forbidden")
+        STATUS_LINE(404, "Not Found")
+        STATUS_LINE(405, "Method Not Allowed")
+        STATUS_LINE(413, "Payload Too Large")
+        STATUS_LINE(500, "Internal Error")
+        STATUS_LINE(503, "Service Unavailable")
+        default: return nullptr;
+    }
+}
+
+static const char* week_names[]  = {"Sun", "Mon", "Tue", "Wed",
+                                   "Thu", "Fri", "Sat"};
+static const char* month_names[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+const char* http_date_header(int* len)
+{
+    static thread_local time_t cached_sec = 0;
+    static thread_local char   cached[48];
+    static thread_local int    cached_len = 0;
+
+    time_t now = time(NULL);
+    if (now != cached_sec) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        cached_len = snprintf(
+            cached, sizeof(cached), "Date: %s, %02d %s %d %02d:%02d:%02d GMT\r\n",
+            week_names[tm.tm_wday], tm.tm_mday, month_names[tm.tm_mon],
+            tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        cached_sec = now;
+    }
+    *len = cached_len;
+    return cached;
+}
@@ -1,17 +1,117 @@
 #include "../include/log.h"
+#include <algorithm>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+std::atomic<int> Log::s_instances(0);
+
+// 每个线程缓存当前这一秒的时间和 "YYYY-MM-DD HH:MM:SS." 前缀，
+// 同一秒内的日志只需要重新生成微秒部分，不用每行都调localtime
+struct log_time_cache {
+    time_t    sec = -1;  // 还没有缓存任何一秒
+    struct tm tm;
+    char      prefix[32];
+    int       len;
+};
+
+static const log_time_cache& local_time_cache(time_t sec)
+{
+    static thread_local log_time_cache t_cache;
+    if (t_cache.sec != sec) {
+        struct tm& my_tm = t_cache.tm;
+        localtime_r(&sec, &my_tm);
+        t_cache.len = snprintf(
+            t_cache.prefix, sizeof(t_cache.prefix),
+            "%d-%02d-%02d %02d:%02d:%02d.", my_tm.tm_year + 1900,
+            my_tm.tm_mon + 1, my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min,
+            my_tm.tm_sec);
+        t_cache.sec = sec;
+    }
+    return t_cache;
+}
+
+static long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// 条件变量timewait用的绝对时间
+static struct timespec deadline_after_ms(int ms)
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    long long       us = now.tv_usec + ms * 1000LL;
+    struct timespec t  = {now.tv_sec + us / 1000000, (us % 1000000) * 1000};
+    return t;
+}
+
+// 写入 "时间.微秒 [级别]: " 前缀，返回长度，buf至少要有64字节
+static int format_line_prefix(
+    char*                 buf,
+    int                   level,
+    const struct timeval& now,
+    const struct tm**     tm_out)
+{
+    static const char* const levels[] = {
+        "[debug]: ", "[info]: ", "[warn]: ", "[erro]: "};
+    static const int level_lens[] = {9, 8, 8, 8};
+    if (level < 0 || level > 3) {
+        level = 1;
+    }
+    const log_time_cache& cache = local_time_cache(now.tv_sec);
+    memcpy(buf, cache.prefix, cache.len);
+    char* p = buf + cache.len;
+    // 微秒固定6位
+    long usec = now.tv_usec;
+    for (int i = 5; i >= 0; --i) {
+        p[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+    p[6] = ' ';
+    memcpy(p + 7, levels[level], level_lens[level]);
+    if (tm_out) {
+        *tm_out = &cache.tm;
+    }
+    return cache.len + 7 + level_lens[level];
+}
 
 Log::Log()
 {
-    m_count    = 0;      // 记录日志写了多少行，一开始为0
-    m_is_async = false;  // 默认同步
+    m_count         = 0;      // 记录日志写了多少行，一开始为0
+    m_is_async      = false;  // 默认同步
+    m_thread_buffer = false;
+    m_binary        = false;
+    m_sites_written = 0;
+    m_stop          = false;
+    m_urgent        = false;
+    m_fp            = NULL;
+    m_unflushed     = 0;
+    m_last_flush_ms = 0;
+    m_last_sync_ms  = 0;
+    m_unsynced      = false;
+    m_flusher       = false;
+    m_level         = 0;
+    m_id            = s_instances++;
+    if (m_id >= MAX_INSTANCES) {
+        throw std::exception();
+    }
 }
 
 Log::~Log()
 {
-    if (!m_fp) {
-        fclose(m_fp);
+    if (m_thread_buffer || m_flusher) {
+        // 让写线程把剩下的缓冲区写完再退出
+        m_buf_mutex.lock();
+        m_stop = true;
+        m_buf_cond.signal();
+        m_buf_mutex.unlock();
+        pthread_join(m_writer, NULL);
     }
+    close_file();
 }
 
 // 异步需要设置阻塞队列的长度，同步不需要设置
@@ -19,13 +119,22 @@ bool Log::init(
     const char* file_name,
     int         log_buf_size,
     int         split_lines,
-    int         max_queue_size)
+    int                     max_queue_size,
+    bool                    thread_buffer,
+    const log_flush_policy& policy,
+    bool                    binary)
 {
+    m_policy        = policy;
+    m_last_flush_ms = monotonic_ms();
+    m_last_sync_ms  = m_last_flush_ms;
     // 如果设置了max_queue_size，则为异步
-    if (max_queue_size >= 1) {
+    if (thread_buffer || binary) {
+        m_thread_buffer = true;
+    }
+    else if (max_queue_size >= 1) {
         m_is_async = true;
         // 阻塞队列
-        m_log_queue = new block_queue<std::string>(max_queue_size);
+        m_log_queue = new lockfree_queue<log_line>(max_queue_size);
         pthread_t tid;
         // flush_log_thread为回调函数,这里表示创建线程异步写日志
         pthread_create(&tid, NULL, flush_log_thread, NULL);
@@ -83,15 +192,125 @@ bool Log::init(
 
     m_today = my_tm.tm_mday;
     // 追加到一个文件。写操作向文件末尾追加数据。如果文件不存在，则创建文件。
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == NULL) {
+    if (!open_file(log_full_name)) {
         return false;
     }
+    // 文件头和m_binary在写线程启动之前设好，写线程读到的模式和文件内容一致
+    if (binary) {
+        write_file(LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN);
+        m_binary = true;
+    }
+    if (m_thread_buffer &&
+        pthread_create(&m_writer, NULL, buffer_write_thread, this) != 0) {
+        m_thread_buffer = false;  // 文本日志退回同步写
+        if (m_binary) {
+            // 二进制格式只能由写线程写
+            m_binary = false;
+            close_file();
+            return false;
+        }
+    }
+    // 同步写没有后台线程，按间隔的刷新和fdatasync由单独的线程来做
+    if (!m_thread_buffer && !m_is_async && policy_period_ms() > 0 &&
+        pthread_create(&m_writer, NULL, flush_timer_thread, this) == 0) {
+        m_flusher = true;
+    }
     return true;
 }
 
+bool Log::open_file(const char* path)
+{
+    if (m_policy.mmap_file) {
+        return m_mmap.open(path);
+    }
+    // 追加到一个文件。写操作向文件末尾追加数据。如果文件不存在，则创建文件。
+    m_fp = fopen(path, "a");
+    return m_fp != NULL;
+}
+
+void Log::close_file()
+{
+    if (m_mmap.is_open()) {
+        m_mmap.close();
+    }
+    if (m_fp) {
+        fflush(m_fp);
+        fclose(m_fp);
+        m_fp = NULL;
+    }
+}
+
+void Log::write_file(const char* data, size_t len)
+{
+    if (m_fp) {
+        fwrite(data, 1, len, m_fp);  //  写到文件流的缓冲区
+    }
+    else if (m_mmap.is_open()) {
+        m_mmap.append(data, len);  // 直接拷贝进映射区，不进内核
+    }
+}
+
+// 把用户态缓冲的内容交给内核，内存映射文件写入即已在内核的页缓存里
+void Log::flush_file()
+{
+    if (m_fp) {
+        fflush(m_fp);
+    }
+}
+
+int Log::file_fd()
+{
+    if (m_fp) {
+        return fileno(m_fp);
+    }
+    return m_mmap.fd();
+}
+
+// 按天或者按行数切分，关闭当前文件并打开新文件
+void Log::open_rotated_file(const struct tm& my_tm)
+{
+    // 年月日前缀和按行数切分的序号都按整数的最大宽度留空间
+    char tail[48] = {0};
+    char new_log[sizeof(dir_name) + sizeof(tail) + sizeof(log_name) + 24] = {0};
+    snprintf(
+        tail, sizeof(tail), "%d_%02d_%02d_", my_tm.tm_year + 1900,
+        my_tm.tm_mon + 1, my_tm.tm_mday);
+
+    int n;
+    if (m_today != my_tm.tm_mday) {
+        n = snprintf(
+            new_log, sizeof(new_log), "%s%s%s", dir_name, tail, log_name);
+    }
+    else {
+        n = snprintf(
+            new_log, sizeof(new_log), "%s%s%s.%lld", dir_name, tail,
+            log_name, m_count / m_split_lines);
+    }
+    // 文件名被截断时不切换，继续写当前的文件
+    if (n < 0 || n >= (int)sizeof(new_log)) {
+        return;
+    }
+    m_today = my_tm.tm_mday;
+    // 之前的文件内容刷掉
+    close_file();
+    open_file(new_log);
+    // 二进制文件要能单独解码，新文件重新写文件头和所有调用点
+    if (m_binary) {
+        write_file(LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN);
+        m_sites_written = 0;
+    }
+}
+
 void Log::write_log(int level, const char* format, ...)
 {
+    if (m_thread_buffer) {
+        va_list valst;
+        va_start(valst, format);
+        write_buffered(level, format, valst);
+        va_end(valst);
+        return;
+    }
+
     //     struct timeval
     // {
     //     long tv_sec; /*秒*/
@@ -99,41 +318,16 @@ void Log::write_log(int level, const char* format, ...)
     // };
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t     t      = now.tv_sec;
-    struct tm* sys_tm = localtime(&t);
-    struct tm  my_tm  = *sys_tm;
-    char       s[16]  = {0};
-    switch (level) {
-        case 0: strcpy(s, "[debug]:"); break;
-        case 1: strcpy(s, "[info]:"); break;
-        case 2: strcpy(s, "[warn]:"); break;
-        case 3: strcpy(s, "[erro]:"); break;
-        default: strcpy(s, "[info]:"); break;
-    }
+    char             prefix[64];
+    const struct tm* sys_tm;
+    int              n     = format_line_prefix(prefix, level, now, &sys_tm);
+    struct tm        my_tm = *sys_tm;
     //写入一个log，对m_count++, m_split_lines最大行数
     m_mutex.lock();
     m_count++;
     if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) {
         // 新日志
-        char new_log[256] = {0};
-        // 之前的文件指针内容刷掉
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-
-        snprintf(
-            tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1,
-            my_tm.tm_mday);
-
-        if (m_today != my_tm.tm_mday) {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-        }
-        else {
-            snprintf(
-                new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name,
-                m_count / m_split_lines);
-        }
-        m_fp = fopen(new_log, "a");
+        open_rotated_file(my_tm);
     }
     m_mutex.unlock();
 
@@ -143,10 +337,7 @@ void Log::write_log(int level, const char* format, ...)
 
     m_mutex.lock();
     //写入的具体时间内容格式
-    int n = snprintf(
-        m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-        my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, my_tm.tm_hour,
-        my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
+    memcpy(m_buf, prefix, n);
 
     // 可变参数列表写入m_buf
     int m            = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
@@ -156,23 +347,437 @@ void Log::write_log(int level, const char* format, ...)
 
     m_mutex.unlock();
 
-    // 异步写，加入日志队列
-    if (m_is_async && !m_log_queue->full()) {
-        m_log_queue->push(log_str);
-    }
-    else {
+    // 异步写，加入日志队列，队列满时push失败，改为同步写
+    if (!m_is_async || !m_log_queue->push(log_line{level, log_str})) {
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);  //  写到文件流的缓冲区
+        write_file(log_str.data(), log_str.size());
+        apply_policy(level, log_str.size());
         m_mutex.unlock();
     }
 
     va_end(valst);
 }
 
+// 按持久化策略决定是否刷新，调用时持有m_mutex。level是这次写入的日志里
+// 最高的级别，定时检查时没有新日志，level为-1、bytes为0
+void Log::apply_policy(int level, int bytes)
+{
+    m_unflushed += bytes;
+    long long now_ms = monotonic_ms();
+    bool need = m_unflushed > 0 &&
+                ((m_policy.on_error && level == 3) ||
+                 (m_policy.bytes > 0 && m_unflushed >= m_policy.bytes) ||
+                 (m_policy.interval_ms > 0 &&
+                  now_ms - m_last_flush_ms >= m_policy.interval_ms));
+    if (file_fd() < 0) {
+        return;
+    }
+    if (need) {
+        flush_file();
+        m_unflushed     = 0;
+        m_last_flush_ms = now_ms;
+        m_unsynced      = true;
+    }
+    sync_if_due(now_ms);
+}
+
+// 按时间刷新和fdatasync的检查周期，取配置了的间隔里短的那个，都没配置为0
+int Log::policy_period_ms() const
+{
+    int flush = m_policy.interval_ms;
+    int sync  = m_policy.sync_interval_ms;
+    if (flush <= 0) {
+        return sync > 0 ? sync : 0;
+    }
+    if (sync <= 0) {
+        return flush;
+    }
+    return flush < sync ? flush : sync;
+}
+
+// 组提交: 有已经刷新进内核的数据，并且距上次fdatasync超过了间隔才落盘
+void Log::sync_if_due(long long now_ms)
+{
+    int fd = file_fd();
+    if (!m_unsynced || m_policy.sync_interval_ms <= 0 || fd < 0 ||
+        now_ms - m_last_sync_ms < m_policy.sync_interval_ms) {
+        return;
+    }
+    fdatasync(fd);
+    m_last_sync_ms = now_ms;
+    m_unsynced     = false;
+}
+
+// 同步模式的刷新线程: 每个周期醒来按策略检查一次，和写日志的线程一样持有m_mutex
+void Log::flush_timer_loop()
+{
+    int period = policy_period_ms();
+    m_buf_mutex.lock();
+    while (!m_stop) {
+        m_buf_cond.timewait(m_buf_mutex.get(), deadline_after_ms(period));
+        if (m_stop) {
+            break;
+        }
+        m_buf_mutex.unlock();
+        m_mutex.lock();
+        apply_policy(-1, 0);
+        m_mutex.unlock();
+        m_buf_mutex.lock();
+    }
+    m_buf_mutex.unlock();
+}
+
 void Log::flush(void)
 {
+    // 策略不要求时显式刷新什么都不做，请求路径上不加锁也不进内核
+    if (!m_policy.explicit_flush) {
+        return;
+    }
+    if (m_thread_buffer) {
+        m_buf_mutex.lock();
+        m_urgent = true;
+        m_buf_cond.signal();
+        m_buf_mutex.unlock();
+        return;
+    }
     m_mutex.lock();
     // 刷盘
-    fflush(m_fp);
+    flush_file();
     m_mutex.unlock();
 }
+
+int Log::pending_percent()
+{
+    if (m_thread_buffer) {
+        m_buf_mutex.lock();
+        int n = m_full.size();
+        m_buf_mutex.unlock();
+        return n * 100 / MAX_FULL_BUFFERS;
+    }
+    if (m_is_async) {
+        return m_log_queue->size() * 100 / m_log_queue->max_size();
+    }
+    return 0;
+}
+
+// 格式化到当前线程自己的缓冲区，只持有本线程的自旋锁，
+// 只有缓冲区写满换新的时候才会碰到全局的锁
+void Log::write_buffered(int level, const char* format, va_list valst)
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+
+    thread_log_buffer* tl = local_buffer();
+    tl->lock.lock();
+    log_buffer* buf = reserve(tl, m_log_buf_size + 64);
+    char*       p   = buf->data + buf->len;
+    int         n   = format_line_prefix(p, level, now, nullptr);
+    int         m   = vsnprintf(p + n, m_log_buf_size, format, valst);
+    // 过长的行被截断
+    if (m >= m_log_buf_size) {
+        m = m_log_buf_size - 1;
+    }
+    else if (m < 0) {
+        m = 0;
+    }
+    p[n + m] = '\n';
+    buf->len += n + m + 1;
+    buf->lines++;
+    tl->lock.unlock();
+
+    // ERROR立即唤醒写线程
+    if (level == 3 && m_policy.on_error) {
+        m_buf_mutex.lock();
+        m_urgent = true;
+        m_buf_cond.signal();
+        m_buf_mutex.unlock();
+    }
+}
+
+// 保证当前线程的缓冲区至少有need字节的空间，调用时持有线程锁。
+// 不够就把这块交给写线程，换一块新的
+log_buffer* Log::reserve(thread_log_buffer* tl, int need)
+{
+    log_buffer* buf = tl->cur;
+    if (buf->cap - buf->len < need) {
+        m_buf_mutex.lock();
+        m_full.push_back(buf);
+        m_buf_cond.signal();
+        m_buf_mutex.unlock();
+        buf     = take_buffer();
+        tl->cur = buf;
+    }
+    return buf;
+}
+
+int Log::register_site(
+    std::atomic<int>& site,
+    int               level,
+    const char*       format,
+    const char*       file,
+    int               line,
+    const char*       signature)
+{
+    m_site_mutex.lock();
+    // 可能有别的线程刚刚注册过同一个调用点
+    int id = site.load(std::memory_order_relaxed);
+    if (id < 0) {
+        log_site s;
+        s.level     = level;
+        s.line      = line;
+        s.format    = format;
+        s.file      = file;
+        s.signature = signature;
+        id          = m_sites.size();
+        m_sites.push_back(s);
+        site.store(id, std::memory_order_release);
+    }
+    m_site_mutex.unlock();
+    return id;
+}
+
+// 写事件头并返回参数的写入位置，返回时持有线程锁，由end_event提交并释放
+char* Log::begin_event(int id, int args_len, thread_log_buffer** tl)
+{
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+
+    *tl = local_buffer();
+    (*tl)->lock.lock();
+    log_buffer* buf = reserve(
+        *tl, LOG_TIME_RECORD_LEN + LOG_EVENT_HEADER_MAX + args_len);
+    char* p = buf->data + buf->len;
+    // 换了一秒或者新的缓冲区，先写一条TIME记录，事件里只记微秒
+    if (buf->base != now.tv_sec) {
+        uint64_t sec = now.tv_sec;
+        *p++         = LOG_RECORD_TIME;
+        memcpy(p, &sec, 8);
+        p += 8;
+        buf->base = now.tv_sec;
+    }
+    *p++ = LOG_RECORD_EVENT;
+    p    = log_put_varint(p, id);
+    return log_put_varint(p, now.tv_usec);
+}
+
+void Log::end_event(thread_log_buffer* tl, int level, char* end)
+{
+    log_buffer* buf = tl->cur;
+    buf->len        = end - buf->data;
+    buf->lines++;
+    tl->lock.unlock();
+    if (level == 3 && m_policy.on_error) {
+        m_buf_mutex.lock();
+        m_urgent = true;
+        m_buf_cond.signal();
+        m_buf_mutex.unlock();
+    }
+}
+
+// 写线程: 把还没写进当前文件的调用点写进去。事件所在的缓冲区交给写线程之前
+// 调用点一定已经注册，所以写缓冲区之前调用它就能保证调用点在事件前面
+void Log::write_new_sites()
+{
+    m_site_mutex.lock();
+    for (; m_sites_written < m_sites.size(); ++m_sites_written) {
+        const log_site& s     = m_sites[m_sites_written];
+        uint32_t        id    = m_sites_written;
+        uint32_t        line  = s.line;
+        uint16_t        fmt   = s.format.size();
+        uint16_t        file  = s.file.size();
+        uint8_t         nargs = s.signature.size();
+        char            head[15];
+        head[0] = LOG_RECORD_SITE;
+        memcpy(head + 1, &id, 4);
+        head[5] = (char)s.level;
+        memcpy(head + 6, &line, 4);
+        memcpy(head + 10, &fmt, 2);
+        memcpy(head + 12, &file, 2);
+        head[14] = nargs;
+        write_file(head, sizeof(head));
+        write_file(s.signature.data(), nargs);
+        write_file(s.format.data(), fmt);
+        write_file(s.file.data(), file);
+    }
+    m_site_mutex.unlock();
+}
+
+// 当前线程在本实例上的缓冲区，第一次写日志时创建并登记给写线程
+thread_log_buffer* Log::local_buffer()
+{
+    static thread_local thread_buffers t_buffers;
+    thread_log_buffer*& tl = t_buffers.buffers[m_id];
+    if (!tl) {
+        tl                   = new thread_log_buffer;
+        tl->cur              = take_buffer();
+        t_buffers.logs[m_id] = this;
+        m_threads_mutex.lock();
+        m_threads.push_back(tl);
+        m_threads_mutex.unlock();
+    }
+    return tl;
+}
+
+Log::thread_buffers::~thread_buffers()
+{
+    for (int i = 0; i < MAX_INSTANCES; ++i) {
+        if (buffers[i]) {
+            logs[i]->release_local_buffer(buffers[i]);
+        }
+    }
+}
+
+// 线程退出: 先从m_threads注销，写线程就不会再碰它，
+// 再把写了一部分的缓冲区交给写线程，最后释放
+void Log::release_local_buffer(thread_log_buffer* tl)
+{
+    m_threads_mutex.lock();
+    m_threads.erase(
+        std::remove(m_threads.begin(), m_threads.end(), tl), m_threads.end());
+    m_threads_mutex.unlock();
+    if (tl->cur->len > 0) {
+        m_buf_mutex.lock();
+        m_full.push_back(tl->cur);
+        m_buf_cond.signal();
+        m_buf_mutex.unlock();
+    }
+    else {
+        recycle_buffer(tl->cur);
+    }
+    delete tl;
+}
+
+log_buffer* Log::take_buffer()
+{
+    log_buffer* buf = nullptr;
+    m_buf_mutex.lock();
+    if (!m_free.empty()) {
+        buf = m_free.back();
+        m_free.pop_back();
+    }
+    m_buf_mutex.unlock();
+    if (!buf) {
+        buf       = new log_buffer;
+        buf->data = new char[BUFFER_SIZE];
+        buf->cap  = BUFFER_SIZE;
+    }
+    buf->len   = 0;
+    buf->lines = 0;
+    buf->base  = -1;
+    return buf;
+}
+
+void Log::recycle_buffer(log_buffer* buf)
+{
+    m_buf_mutex.lock();
+    if ((int)m_free.size() < MAX_FREE_BUFFERS) {
+        m_free.push_back(buf);
+        buf = nullptr;
+    }
+    m_buf_mutex.unlock();
+    if (buf) {
+        delete[] buf->data;
+        delete buf;
+    }
+}
+
+// 写线程: 有缓冲区写满、需要立即写入或者到了策略的刷新间隔，
+// 把所有缓冲区一次性写入文件。按字节数刷新的粒度就是一块缓冲区
+void Log::buffer_write_loop()
+{
+    std::vector<log_buffer*> batch;
+    while (true) {
+        m_buf_mutex.lock();
+        if (m_full.empty() && !m_stop && !m_urgent) {
+            // 刷新和fdatasync的间隔配置了任何一个都要定时醒来
+            int period = policy_period_ms();
+            if (period > 0) {
+                m_buf_cond.timewait(
+                    m_buf_mutex.get(), deadline_after_ms(period));
+            }
+            else {
+                m_buf_cond.wait(m_buf_mutex.get());
+            }
+        }
+        m_urgent  = false;
+        bool stop = m_stop;
+        m_buf_mutex.unlock();
+
+        // 各线程写了一部分的缓冲区也取走，日志最多延迟一个周期落盘。
+        // 和写日志的线程一样按 线程锁 -> m_buf_mutex 的顺序加锁，
+        // 同一线程的缓冲区在m_full里保持写入的先后顺序。
+        // 遍历期间持有m_threads_mutex，退出的线程要等遍历完才能释放缓冲区
+        m_threads_mutex.lock();
+        for (size_t i = 0; i < m_threads.size(); ++i) {
+            thread_log_buffer* tl = m_threads[i];
+            tl->lock.lock();
+            if (tl->cur->len > 0) {
+                m_buf_mutex.lock();
+                m_full.push_back(tl->cur);
+                m_buf_mutex.unlock();
+                tl->cur = take_buffer();
+            }
+            tl->lock.unlock();
+        }
+        m_threads_mutex.unlock();
+        m_buf_mutex.lock();
+        batch.swap(m_full);
+        m_buf_mutex.unlock();
+
+        // 积压太多说明磁盘跟不上，只保留最早的两块，其余丢弃
+        if (batch.size() > (size_t)MAX_FULL_BUFFERS) {
+            size_t dropped = batch.size() - 2;
+            for (size_t i = 2; i < batch.size(); ++i) {
+                recycle_buffer(batch[i]);
+            }
+            batch.resize(2);
+            if (m_binary) {
+                fprintf(stderr, "log: dropped %zu log buffers\n", dropped);
+            }
+            else {
+                log_buffer* note = take_buffer();
+                note->len        = snprintf(
+                    note->data, note->cap, "dropped %zu log buffers\n",
+                    dropped);
+                note->lines = 1;
+                batch.push_back(note);
+            }
+        }
+
+        write_buffers(batch);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            recycle_buffer(batch[i]);
+        }
+        batch.clear();
+        // 这一轮没有新数据，上一轮刷新进内核的数据也要按间隔落盘
+        sync_if_due(monotonic_ms());
+        if (stop) {
+            break;
+        }
+    }
+}
+
+void Log::write_buffers(std::vector<log_buffer*>& buffers)
+{
+    if (buffers.empty()) {
+        return;
+    }
+    time_t    t = time(NULL);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        // 行数跨过切分点或者日期变了就换文件，切分的粒度是一块缓冲区
+        long long before = m_count;
+        m_count += buffers[i]->lines;
+        if (m_today != my_tm.tm_mday ||
+            before / m_split_lines != m_count / m_split_lines) {
+            open_rotated_file(my_tm);
+        }
+        if (m_binary) {
+            write_new_sites();
+        }
+        write_file(buffers[i]->data, buffers[i]->len);
+    }
+    flush_file();
+    m_unsynced = true;
+}
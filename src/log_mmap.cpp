@@ -0,0 +1,114 @@
+#include "log_mmap.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+log_mmap_file::log_mmap_file()
+    : m_fd(-1), m_window(nullptr), m_window_offset(0), m_pos(0),
+      m_written(-1)
+{
+}
+
+log_mmap_file::~log_mmap_file()
+{
+    close();
+}
+
+bool log_mmap_file::open(const char* path)
+{
+    close();
+    m_fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) < 0) {
+        close();
+        return false;
+    }
+    m_written = st.st_size;
+    // 从文件末尾继续追加，映射的偏移必须按页对齐
+    off_t page   = sysconf(_SC_PAGESIZE);
+    off_t offset = st.st_size / page * page;
+    if (!map_window(offset)) {
+        close();
+        return false;
+    }
+    m_pos = st.st_size - offset;
+    return true;
+}
+
+void log_mmap_file::close()
+{
+    if (m_fd < 0) {
+        return;
+    }
+    unmap_window();
+    // 去掉预分配但没有用到的部分。不能用窗口位置计算: 打开时映射失败，
+    // 窗口位置还是上一个文件的。截断失败只是多留一些0字节，日志本身
+    // 写不了，和丢弃缓冲区一样报到stderr
+    if (m_written >= 0 && ftruncate(m_fd, m_written) < 0) {
+        fprintf(
+            stderr, "log: truncate mmap log to %lld bytes failed: %s\n",
+            (long long)m_written, strerror(errno));
+    }
+    ::close(m_fd);
+    m_fd            = -1;
+    m_window_offset = 0;
+    m_pos           = 0;
+    m_written       = -1;
+}
+
+bool log_mmap_file::append(const char* data, size_t len)
+{
+    if (!m_window) {
+        return false;
+    }
+    while (len > 0) {
+        if (m_pos == WINDOW_SIZE) {
+            // 当前窗口写满，映射紧接着的下一个窗口
+            off_t next = m_window_offset + WINDOW_SIZE;
+            unmap_window();
+            if (!map_window(next)) {
+                return false;
+            }
+            m_pos = 0;
+        }
+        size_t n = WINDOW_SIZE - m_pos < len ? WINDOW_SIZE - m_pos : len;
+        memcpy(m_window + m_pos, data, n);
+        m_pos += n;
+        m_written = m_window_offset + m_pos;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool log_mmap_file::map_window(off_t offset)
+{
+    // 先分配磁盘空间，否则写映射区时磁盘满会收到SIGBUS
+    if (fallocate(m_fd, 0, offset, WINDOW_SIZE) < 0 &&
+        ftruncate(m_fd, offset + WINDOW_SIZE) < 0) {
+        return false;
+    }
+    void* addr =
+        mmap(NULL, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    m_window        = (char*)addr;
+    m_window_offset = offset;
+    return true;
+}
+
+void log_mmap_file::unmap_window()
+{
+    if (m_window) {
+        munmap(m_window, WINDOW_SIZE);
+        m_window = nullptr;
+    }
+}
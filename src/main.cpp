@@ -1,10 +1,18 @@
+#include "access_log.h"
 #include "block_queue.h"
+#include "capture.h"
+#include "gzip_static.h"
 #include "http_conn.h"
 #include "lock.h"
 #include "log.h"
 #include "lst_timer.h"
+#include "metrics.h"
+#include "perf_counters.h"
+#include "probes.h"
 #include "sql_connection_pool.h"
+#include "stat_shm.h"
 #include "threadPool.h"
+#include "trace.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -23,12 +31,14 @@
 
 // 定时器相关参数
 static int             pipefd[2];
-static sort_timer_list timer_list;
+static conn_timer_list timer_list(TIMESLOT);
 static int             epollfd = 0;
+static http_conn*      conns   = nullptr;  // 所有用户连接，下标为fd
 
-extern void addfd(int epollfd, int fd, bool one_shot);
+extern void addfd(int epollfd, int fd, bool one_shot, bool et);
 extern void removefd(int epollfd, int fd);
 extern void setnonblocking(int fd);
+extern const char* doc_root;
 
 // 信号处理函数,把信号写入管道信号处理函数中仅仅通过管道发送信号，
 // 不处理信号对应的逻辑，缩短异步执行时间，值减少对主程序的影响。
@@ -61,21 +71,89 @@ void addsig(int sig, void(handler)(int), bool restart = true)
 // 定时处理任务
 void timer_handler()
 {
+    trace_scope scope("timer", -1);
+    perf_scope  perf(PERF_REACTOR_TIMER);
     timer_list.tick();
+    // 长连接复用情况: 在已用过的连接上处理的请求占全部请求的比例
+    long conns    = http_conn::m_total_conns;
+    long requests = http_conn::m_total_requests;
+    long reused   = http_conn::m_reused_requests;
+    LOG_INFO(
+        "stats: connections %ld, requests %ld, reuse ratio %.3f", conns,
+        requests, requests ? (double)reused / requests : 0.0);
     alarm(TIMESLOT);
 }
 
+// 刷新连接的定时器: 处理请求期间用固定的超时，
+// 响应发完等待下一个请求的长连接用keep-alive空闲超时，规则见conn_timer_list
+void refresh_timer(util_timer* timer, bool idle)
+{
+    LOG_INFO("%s", "adjust timer once");
+    Log::get_instance()->flush();
+    timer_list.refresh(timer, idle);
+}
+
 // 定时器回调函数，删除非活动连接在socket上的注册时间，并关闭
 void cb_func(client_data* user_data)
 {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    // 工作线程还在处理这个连接，由它处理完之后关闭
+    if (conns[user_data->sockfd].close_after_worker()) {
+        LOG_INFO("close fd %d after the worker", user_data->sockfd);
+        return;
+    }
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     close(user_data->sockfd);
-    // std::cout << "连接关闭了..." << std::endl;
+    WS_PROBE1(close, user_data->sockfd);
     LOG_INFO("close fd %d", user_data->sockfd);
     http_conn::m_user_count--;
 }
 
+// /metrics 里的瞬时值
+static long active_connections(void*)
+{
+    return http_conn::m_user_count;
+}
+
+static long pool_queue_depth(void* pool)
+{
+    return ((threadPool<http_conn>*)pool)->queue_depth();
+}
+
+static long db_free_connections(void* conn_pool)
+{
+    return ((connection_pool*)conn_pool)->GetFreeConn();
+}
+
+static long timer_list_size(void*)
+{
+    return timer_list.size();
+}
+
+static long conn_buffers_in_use(void*)
+{
+    return http_conn::buffers().in_use();
+}
+
+static long conn_buffers_free(void*)
+{
+    return http_conn::buffers().free_count();
+}
+
+static long log_pending_percent(void*)
+{
+    return Log::get_instance()->pending_percent();
+}
+
+// 大端ip转为点分十进制数，inet_ntoa使用静态缓冲区，不是线程安全的
+static const char* client_ip(const sockaddr_in* addr, char* buf)
+{
+    if (!inet_ntop(AF_INET, &addr->sin_addr, buf, INET_ADDRSTRLEN)) {
+        return "?";
+    }
+    return buf;
+}
+
 void show_error(int connfd, const char* info)
 {
     printf("%s", info);
@@ -83,30 +161,142 @@ void show_error(int connfd, const char* info)
     close(connfd);
 }
 
-int main()
+void usage(const char* prog)
+{
+    printf(
+        "usage: %s [-n max_requests_per_conn] [-a keepalive_timeout] "
+        "[-l log_level] [-b] [-m] [-s access_sample] [-w slow_ms] [-t] [-p]\n"
+        "       [-o stat_shm_name] [-P port] [-r doc_root] [-T threads] "
+        "[-e trig_mode] [-u] [-C capture_file] [-k]\n"
+        "  -n  每个长连接最多处理的请求数，0为不限制，默认100\n"
+        "  -a  长连接空闲超时秒数，默认15\n"
+        "  -l  最低日志级别 0 debug, 1 info, 2 warn, 3 error，默认1\n"
+        "  -b  以二进制格式写日志，用logdecode还原成文本\n"
+        "  -m  通过内存映射写日志文件，进程崩溃时已写入的日志不丢失\n"
+        "  -s  访问日志每N个请求记录一个，0为只记录错误和慢请求，默认1\n"
+        "  -w  超过这么多毫秒的慢请求总是记录到访问日志，并在服务器日志里\n"
+        "      记录各阶段耗时，0为不区分，默认500\n"
+        "  -t  记录请求各阶段的跟踪，SIGUSR1或者GET /trace导出Chrome trace JSON\n"
+        "  -p  按请求阶段统计perf_event_open计数器，GET /perf查看\n"
+        "  -o  统计共享内存段的名字，用webserver-stat查看，空字符串不发布，\n"
+        "      默认%s_端口\n"
+        "  -P  监听端口，默认10000\n"
+        "  -r  网站根目录，默认%s\n"
+        "  -T  工作线程数，默认8\n"
+        "  -e  触发模式 0 监听LT+连接LT, 1 LT+ET, 2 ET+LT, 3 ET+ET，默认1\n"
+        "  -u  用户只存在内存里，不连接MySQL，注册的用户重启后丢失\n"
+        "  -C  把收到的请求原样抓取到这个文件，用wsreplay重放\n"
+        "  -k  空闲长连接把读写缓冲区还给共享的缓冲区池，大量空闲连接时省内存\n",
+        prog, STAT_SHM_DEFAULT, doc_root);
+}
+
+int main(int argc, char* argv[])
 {
+    int opt;
+    int  log_level  = 1;
+    bool log_binary = false;
+    log_flush_policy log_policy;
+    int  access_sample = 1;
+    int  slow_ms       = 500;
+    const char* stat_shm_name = nullptr;  // 默认按端口命名
+    int  port         = 10000;
+    int  thread_num   = 8;
+    int  trig_mode    = 1;
+    bool memory_users = false;
+    const char* capture_file = nullptr;
+    while ((opt = getopt(argc, argv, "n:a:l:bms:w:tpo:P:r:T:e:uC:kh")) != -1) {
+        switch (opt) {
+            case 'n': http_conn::m_max_keepalive_requests = atoi(optarg); break;
+            case 'a': http_conn::m_keepalive_timeout = atoi(optarg); break;
+            case 'l': log_level = atoi(optarg); break;
+            case 'b': log_binary = true; break;
+            case 'm': log_policy.mmap_file = true; break;
+            case 's': access_sample = atoi(optarg); break;
+            case 'w': slow_ms = atoi(optarg); break;
+            case 't': g_trace_enabled = true; break;
+            case 'p': g_perf_enabled = true; break;
+            case 'o': stat_shm_name = optarg; break;
+            case 'P': port = atoi(optarg); break;
+            case 'r': doc_root = optarg; break;
+            case 'T': thread_num = atoi(optarg); break;
+            case 'e': trig_mode = atoi(optarg); break;
+            case 'u': memory_users = true; break;
+            case 'C': capture_file = optarg; break;
+            case 'k': http_conn::m_compact_idle = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    timer_list.set_keepalive(http_conn::m_keepalive_timeout);
+    std::string stat_shm_default = stat_shm_default_name(port);
+    if (!stat_shm_name) {
+        stat_shm_name = stat_shm_default.c_str();
+    }
+
     // 日志系统初始化
-    Log::get_instance()->init("LJX_Webserver", 2000, 800000, 0);
+    Log::get_instance()->init(
+        "LJX_Webserver", 2000, 800000, 0, true, log_policy, log_binary);
+    Log::get_instance()->set_level(log_level);
+    access_log_init("LJX_Webserver_access", access_sample, slow_ms, log_binary);
+    if (capture_file && !capture_open(capture_file)) {
+        LOG_ERROR("open capture file %s failed", capture_file);
+    }
+
+    // 后台为静态资源生成gzip预压缩变体
+    start_gzip_precompress(doc_root);
 
-    // int port = atoi(argv[1]);
-    int port = 10000;
     addsig(SIGPIPE, SIG_IGN);
+    // 监听socket和连接socket各自的触发方式
+    bool listen_et       = trig_mode & 2;
+    http_conn::m_conn_et = trig_mode & 1;
 
-    // 创建数据库连接池
+    // 创建数据库连接池，内存用户表时连接池为空，工作线程拿到的连接是NULL
     connection_pool* connPool = connection_pool::GetInstance();
-    connPool->init("localhost", "ljx", "ljxdw1998", "yourdb", 3306, 8);
+    if (!memory_users) {
+        connPool->init("localhost", "ljx", "ljxdw1998", "yourdb", 3306, 8);
+    }
     // 创建线程池
     threadPool<http_conn>* pool = nullptr;
     try {
-        pool = new threadPool<http_conn>(connPool);
+        pool = new threadPool<http_conn>(connPool, thread_num);
     }
     catch (...) {  //省略号的作用是表示捕获所有类型的异常。
         return 1;
     }
 
+    metrics_add_gauge(
+        "active_connections", "Open client connections.", active_connections,
+        nullptr);
+    metrics_add_gauge(
+        "thread_pool_queue_depth", "Requests waiting for a worker thread.",
+        pool_queue_depth, pool);
+    metrics_add_gauge(
+        "db_free_connections", "Idle MySQL connections in the pool.",
+        db_free_connections, connPool);
+    metrics_add_gauge(
+        "timer_list_size", "Connection timers in the timer list.",
+        timer_list_size, nullptr);
+    metrics_add_gauge(
+        "conn_buffers_in_use",
+        "Connection read/write buffer blocks held by connections.",
+        conn_buffers_in_use, nullptr);
+    metrics_add_gauge(
+        "conn_buffers_free", "Idle buffer blocks kept in the buffer pool.",
+        conn_buffers_free, nullptr);
+    metrics_add_gauge(
+        "log_pending_percent",
+        "Log backlog waiting for the writer thread, percent of capacity.",
+        log_pending_percent, nullptr);
+    // 指标都注册好之后再发布到共享内存
+    if (stat_shm_name[0] && !stat_shm_start(stat_shm_name, 1000)) {
+        LOG_ERROR("publish stats to %s failed", stat_shm_name);
+    }
+
     // 所有用户连接数组
     http_conn* users = new http_conn[MAX_FD];
-    users->initmysql_result(connPool);
+    conns            = users;
+    if (!memory_users) {
+        users->initmysql_result(connPool);
+    }
 
     // 获取监听的端口 使用tcp协议
     int listenfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -125,7 +315,8 @@ int main()
 
     // 绑定监听
     ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
-    ret = listen(listenfd, 5);
+    // 队列太短时突发的大量连接会被丢掉SYN，客户端要等重传
+    ret = listen(listenfd, SOMAXCONN);
 
     //  epoll事件数组
     epoll_event events[MAX_EVENTS_NUMBER];
@@ -140,6 +331,11 @@ int main()
     // 过EPOLLRDHUP属性，来判断是否对端已经关闭，
     // 这样可以减少一次系统调用。在2.6.17的内核版本之前，只能再通过调用一次recv函数来判断
     event.events = EPOLLRDHUP | EPOLLIN;
+    if (listen_et) {
+        // 边沿触发要一次accept到EAGAIN，监听socket必须非阻塞
+        event.events |= EPOLLET;
+        setnonblocking(listenfd);
+    }
 
     // 添加事件
     epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event);
@@ -148,15 +344,19 @@ int main()
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
     setnonblocking(pipefd[1]);  //非阻塞写
-    addfd(epollfd, pipefd[0], false);
+    addfd(epollfd, pipefd[0], false, true);
 
     addsig(SIGALRM, sig_handler, false);
     addsig(SIGTERM, sig_handler, false);
+    addsig(SIGUSR1, sig_handler, false);
     bool stop_never = false;
+    bool dump_trace = false;
+    trace_set_thread_name("main");
 
     client_data* users_timer = new client_data[MAX_FD];
 
     bool timeout = false;
+    char ip[INET_ADDRSTRLEN];  // 调试日志里的客户端地址
 
     // 设置信号传送闹钟，即用来设置信号SIGALRM在经过参数seconds秒数后发送给目前的进程。
     // 如果未设置信号SIGALRM的处理函数，那么alarm()默认处理终止进程.
@@ -172,42 +372,45 @@ int main()
             std::cout << "epoll fail" << std::endl;
             break;
         }
+        // 一轮事件处理，包括下面的定时任务
+        trace_scope loop_scope("events", -1);
         for (int i = 0; i < number; ++i) {
             int sockfd = events[i].data.fd;
 
             // 处理新到的客户端连接
             if (sockfd == listenfd) {
-                struct sockaddr_in client_address;
-                socklen_t          client_addrlength = sizeof(client_address);
-                int                connfd            = accept(
-                                              listenfd, (struct sockaddr*)&client_address,
-                                              &client_addrlength);
-                if (connfd < 0) {
-                    std::cout << "errno is: " << errno << std::endl;
-                    LOG_ERROR("%s:errno is:%d", "accpet", errno);
-                    continue;
-                }
-                std::cout << "建立连接: " << connfd << std::endl;
+                // 边沿触发时一直accept到EAGAIN，否则一次事件只接受一个连接
+                do {
+                    struct sockaddr_in client_address;
+                    socklen_t client_addrlength = sizeof(client_address);
+                    int       connfd            = accept(
+                        listenfd, (struct sockaddr*)&client_address,
+                        &client_addrlength);
+                    if (connfd < 0) {
+                        if (errno != EAGAIN) {
+                            LOG_ERROR("%s:errno is:%d", "accpet", errno);
+                        }
+                        break;
+                    }
 
-                if (http_conn::m_user_count >= MAX_FD) {
-                    LOG_ERROR("%s", "Internal server busy");
-                    close(connfd);  // 关闭
-                    continue;
-                }
+                    if (http_conn::m_user_count >= MAX_FD) {
+                        LOG_ERROR("%s", "Internal server busy");
+                        close(connfd);  // 关闭
+                        continue;
+                    }
 
-                users[connfd].init(connfd, client_address);
-
-                // 初始化client_data数据
-                // 创建定时器，设置回调函数和超时是按，绑定用户数据，将定时器添加到链表里面
-                users_timer[connfd].address = client_address;
-                users_timer[connfd].sockfd  = connfd;
-                util_timer* timer           = new util_timer;
-                timer->user_data            = &users_timer[connfd];
-                timer->cb_func              = cb_func;
-                time_t cur                  = time(NULL);
-                timer->expire               = cur + 3 * TIMESLOT;
-                users_timer[connfd].timer   = timer;
-                timer_list.add_timer(timer);
+                    users[connfd].init(connfd, client_address);
+
+                    // 初始化client_data数据
+                    // 创建定时器，设置回调函数和超时是按，绑定用户数据，将定时器添加到链表里面
+                    users_timer[connfd].address = client_address;
+                    users_timer[connfd].sockfd  = connfd;
+                    util_timer* timer           = new util_timer;
+                    timer->user_data            = &users_timer[connfd];
+                    timer->cb_func              = cb_func;
+                    users_timer[connfd].timer   = timer;
+                    timer_list.add(timer);
+                } while (listen_et);
             }
             // 读写关闭或者读关闭或者错误
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
@@ -215,7 +418,7 @@ int main()
                 util_timer* timer = users_timer[sockfd].timer;
                 timer->cb_func(&users_timer[sockfd]);
                 if (timer) {
-                    timer_list.del_timer(timer);
+                    timer_list.del(timer);
                 }
             }
             // 处理定时器信号
@@ -245,6 +448,11 @@ int main()
                             //  kill命令的默认行为是将SIGTERM信号发送到进程。
                             case SIGTERM: {
                                 stop_never = true;
+                                break;
+                            }
+                            case SIGUSR1: {
+                                dump_trace = true;
+                                break;
                             }
                         }
                     }
@@ -254,27 +462,33 @@ int main()
             else if (events[i].events & EPOLLIN) {
                 util_timer* timer = users_timer[sockfd].timer;
                 if (users[sockfd].read()) {
-                    // 大端ip转为点分十进制数
-                    LOG_INFO(
+                    // 每个请求的信息记录在访问日志里，这里只在调试时输出
+                    LOG_DEBUG(
                         "deal with the client(%s)",
-                        inet_ntoa(users[sockfd].get_address()->sin_addr));
+                        client_ip(users[sockfd].get_address(), ip));
                     Log::get_instance()->flush();
-                    pool->append(users + sockfd);
-
-                    if (timer) {
+                    WS_PROBE1(enqueue, sockfd);
+                    users[sockfd].enqueue();
+                    if (!pool->append(users + sockfd)) {
+                        // 线程池的队列满了，交不出去的连接直接关闭，
+                        // 先清掉排队标记，否则定时器会一直等工作线程
+                        users[sockfd].close_conn(false);
+                        timer->cb_func(&users_timer[sockfd]);
+                        if (timer) {
+                            timer_list.del(timer);
+                        }
+                    }
+                    else if (timer) {
                         // 刷新时间，往后延迟三个单位
-                        time_t cur    = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_list.adjust_timer(timer);
+                        // 连接已经交给工作线程，不能再读它的状态
+                        refresh_timer(timer, false);
                     }
                 }
                 else {
                     // 读取失败
                     timer->cb_func(&users_timer[sockfd]);
                     if (timer) {
-                        timer_list.del_timer(timer);
+                        timer_list.del(timer);
                     }
                 }
             }
@@ -282,24 +496,36 @@ int main()
             else if (events[i].events & EPOLLOUT) {
                 util_timer* timer = users_timer[sockfd].timer;
                 if (users[sockfd].write()) {
-                    LOG_INFO(
+                    LOG_DEBUG(
                         "send data to the client(%s)",
-                        inet_ntoa(users[sockfd].get_address()->sin_addr));
+                        client_ip(users[sockfd].get_address(), ip));
                     Log::get_instance()->flush();
-                    // 刷新时间，往后延迟三个单位
-                    if (timer) {
-                        time_t cur    = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_list.adjust_timer(timer);
+                    // 客户端流水线发来的下一个请求已经在缓冲区里，
+                    // 不用等EPOLLIN，直接交给线程池
+                    if (users[sockfd].pipelined()) {
+                        WS_PROBE1(enqueue, sockfd);
+                        users[sockfd].enqueue();
+                        if (!pool->append(users + sockfd)) {
+                            users[sockfd].close_conn(false);
+                            timer->cb_func(&users_timer[sockfd]);
+                            if (timer) {
+                                timer_list.del(timer);
+                            }
+                        }
+                        else if (timer) {
+                            refresh_timer(timer, false);
+                        }
+                    }
+                    // 刷新时间，响应发完的长连接改用空闲超时
+                    else if (timer) {
+                        refresh_timer(timer, users[sockfd].keepalive_idle());
                     }
                 }
                 else {
                     // 读取失败
                     timer->cb_func(&users_timer[sockfd]);
                     if (timer) {
-                        timer_list.del_timer(timer);
+                        timer_list.del(timer);
                     }
                 }
             }
@@ -309,7 +535,20 @@ int main()
             timer_handler();
             timeout = false;
         }
+        if (dump_trace) {
+            char path[64];
+            snprintf(path, sizeof(path), "trace_%ld.json", (long)time(NULL));
+            if (trace_dump_file(path)) {
+                LOG_INFO("trace dumped to %s", path);
+            }
+            else {
+                LOG_ERROR("dump trace to %s failed", path);
+            }
+            dump_trace = false;
+        }
     }
+    stat_shm_stop();
+    capture_close();
     close(epollfd);
     close(listenfd);
     close(pipefd[0]);
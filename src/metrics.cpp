@@ -0,0 +1,326 @@
+#include "metrics.h"
+#include "lock.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct gauge_entry {
+    const char*      name;
+    const char*      help;
+    metrics_gauge_fn fn;
+    void*            arg;
+};
+
+// 注册表: 所有线程的计数区和瞬时值，线程退出时计数区不释放，保留累计值
+static locker                       s_registry_lock;
+static std::vector<thread_metrics*> s_threads;
+static std::vector<gauge_entry>     s_gauges;
+
+thread_metrics* metrics_local()
+{
+    static thread_local thread_metrics* local = nullptr;
+    if (!local) {
+        thread_metrics* m = new thread_metrics();
+        memset((void*)m, 0, sizeof(*m));
+        s_registry_lock.lock();
+        s_threads.push_back(m);
+        s_registry_lock.unlock();
+        local = m;
+    }
+    return local;
+}
+
+void metrics_add_gauge(
+    const char*      name,
+    const char*      help,
+    metrics_gauge_fn fn,
+    void*            arg)
+{
+    s_registry_lock.lock();
+    s_gauges.push_back({name, help, fn, arg});
+    s_registry_lock.unlock();
+}
+
+static const char* counter_names[COUNTER_MAX] = {
+    "connections_accepted_total", "requests_total", "sent_bytes_total",
+    nullptr, nullptr, nullptr, nullptr};
+
+static const char* counter_help[COUNTER_MAX] = {
+    "Accepted connections.", "Completed requests.",
+    "Response bytes written to sockets.", nullptr, nullptr, nullptr, nullptr};
+
+static const char* histogram_names[HIST_MAX] = {
+    "accept_to_read_seconds", "queue_wait_seconds", "parse_seconds",
+    "do_request_seconds", "write_seconds"};
+
+static const char* histogram_help[HIST_MAX] = {
+    "Time from accept to the first request bytes.",
+    "Time a request waits in the thread pool queue.",
+    "Time parsing a request, excluding do_request.",
+    "Time spent in do_request.",
+    "Time from response generated to fully written."};
+
+static const char* route_names[ROUTE_MAX] = {
+    "other", "static", "media", "page", "login", "register", "diagnostics"};
+
+const char* metrics_route_name(METRICS_ROUTE route)
+{
+    return route_names[route];
+}
+
+__attribute__((format(printf, 2, 3))) static void append(
+    std::string& out,
+    const char*  format,
+    ...)
+{
+    char    line[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) {
+        out.append(line, n < (int)sizeof(line) ? n : sizeof(line) - 1);
+    }
+}
+
+// 把一个线程的直方图加到汇总里，buckets后面跟着sum
+static void sum_histogram(metrics_histogram& hist, uint64_t* buckets)
+{
+    for (int b = 0; b < METRICS_BUCKETS; ++b) {
+        buckets[b] += hist.buckets[b].load(std::memory_order_relaxed);
+    }
+    buckets[METRICS_BUCKETS] += hist.sum.load(std::memory_order_relaxed);
+}
+
+// 输出一个直方图，label为空或者是 key="value" 形式的额外标签
+static void append_histogram(
+    std::string&    out,
+    const char*     name,
+    const char*     label,
+    const uint64_t* buckets)
+{
+    const char* sep = label[0] ? "," : "";
+    // Prometheus的桶是累计的
+    uint64_t total = 0;
+    for (int b = 0; b < METRICS_BUCKETS - 1; ++b) {
+        total += buckets[b];
+        uint64_t bound = metrics_bucket_bound(b);
+        append(
+            out, "webserver_%s_bucket{%s%sle=\"%llu.%06llu\"} %llu\n", name,
+            label, sep, (unsigned long long)(bound / 1000000),
+            (unsigned long long)(bound % 1000000), (unsigned long long)total);
+    }
+    total += buckets[METRICS_BUCKETS - 1];
+    append(
+        out, "webserver_%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, sep,
+        (unsigned long long)total);
+    uint64_t sum = buckets[METRICS_BUCKETS];
+    const char* brace = label[0] ? "{" : "";
+    const char* close = label[0] ? "}" : "";
+    append(
+        out, "webserver_%s_sum%s%s%s %llu.%06llu\n", name, brace, label, close,
+        (unsigned long long)(sum / 1000000),
+        (unsigned long long)(sum % 1000000));
+    append(
+        out, "webserver_%s_count%s%s%s %llu\n", name, brace, label, close,
+        (unsigned long long)total);
+}
+
+// 汇总所有线程的计数，生成Prometheus文本格式
+static void render(std::string& out)
+{
+    const int                stride                = METRICS_BUCKETS + 1;
+    uint64_t                 counters[COUNTER_MAX] = {0};
+    uint64_t                 route_cpu[ROUTE_MAX]  = {0};
+    uint64_t                 route_slow[ROUTE_MAX] = {0};
+    std::vector<uint64_t>    buckets(HIST_MAX * stride, 0);
+    std::vector<uint64_t>    route_buckets(ROUTE_MAX * stride, 0);
+    std::vector<gauge_entry> gauges;
+
+    s_registry_lock.lock();
+    for (size_t t = 0; t < s_threads.size(); ++t) {
+        thread_metrics* m = s_threads[t];
+        for (int i = 0; i < COUNTER_MAX; ++i) {
+            counters[i] += m->counters[i].load(std::memory_order_relaxed);
+        }
+        for (int h = 0; h < HIST_MAX; ++h) {
+            sum_histogram(m->histograms[h], &buckets[h * stride]);
+        }
+        for (int r = 0; r < ROUTE_MAX; ++r) {
+            metrics_route& route = m->routes[r];
+            sum_histogram(route.duration, &route_buckets[r * stride]);
+            route_cpu[r] += route.cpu_us.load(std::memory_order_relaxed);
+            route_slow[r] += route.slow.load(std::memory_order_relaxed);
+        }
+    }
+    gauges = s_gauges;
+    s_registry_lock.unlock();
+
+    for (int i = 0; i < COUNTER_MAX; ++i) {
+        if (!counter_names[i]) {
+            continue;
+        }
+        append(
+            out, "# HELP webserver_%s %s\n", counter_names[i], counter_help[i]);
+        append(out, "# TYPE webserver_%s counter\n", counter_names[i]);
+        append(
+            out, "webserver_%s %llu\n", counter_names[i],
+            (unsigned long long)counters[i]);
+    }
+    append(
+        out, "# HELP webserver_responses_total Responses by status class.\n");
+    append(out, "# TYPE webserver_responses_total counter\n");
+    for (int i = COUNTER_STATUS_2XX; i <= COUNTER_STATUS_5XX; ++i) {
+        append(
+            out, "webserver_responses_total{code=\"%dxx\"} %llu\n",
+            i - COUNTER_STATUS_2XX + 2, (unsigned long long)counters[i]);
+    }
+
+    for (size_t i = 0; i < gauges.size(); ++i) {
+        append(
+            out, "# HELP webserver_%s %s\n", gauges[i].name, gauges[i].help);
+        append(out, "# TYPE webserver_%s gauge\n", gauges[i].name);
+        append(
+            out, "webserver_%s %ld\n", gauges[i].name,
+            gauges[i].fn(gauges[i].arg));
+    }
+
+    for (int h = 0; h < HIST_MAX; ++h) {
+        const char* name = histogram_names[h];
+        append(out, "# HELP webserver_%s %s\n", name, histogram_help[h]);
+        append(out, "# TYPE webserver_%s histogram\n", name);
+        append_histogram(out, name, "", &buckets[h * stride]);
+    }
+
+    // 按路由的耗时、CPU时间和慢请求数，没有请求的路由不输出
+    bool route_used[ROUTE_MAX];
+    for (int r = 0; r < ROUTE_MAX; ++r) {
+        route_used[r] = false;
+        for (int b = 0; b < METRICS_BUCKETS; ++b) {
+            route_used[r] = route_used[r] || route_buckets[r * stride + b];
+        }
+    }
+    char label[64];
+    append(
+        out,
+        "# HELP webserver_route_duration_seconds Time from the first request "
+        "bytes to the response fully written, by route.\n");
+    append(out, "# TYPE webserver_route_duration_seconds histogram\n");
+    for (int r = 0; r < ROUTE_MAX; ++r) {
+        if (!route_used[r]) {
+            continue;
+        }
+        snprintf(label, sizeof(label), "route=\"%s\"", route_names[r]);
+        append_histogram(
+            out, "route_duration_seconds", label, &route_buckets[r * stride]);
+    }
+    append(
+        out,
+        "# HELP webserver_route_cpu_seconds_total Reactor and worker thread "
+        "CPU time, by route.\n");
+    append(out, "# TYPE webserver_route_cpu_seconds_total counter\n");
+    for (int r = 0; r < ROUTE_MAX; ++r) {
+        if (!route_used[r]) {
+            continue;
+        }
+        append(
+            out, "webserver_route_cpu_seconds_total{route=\"%s\"} %llu.%06llu\n",
+            route_names[r], (unsigned long long)(route_cpu[r] / 1000000),
+            (unsigned long long)(route_cpu[r] % 1000000));
+    }
+    append(
+        out,
+        "# HELP webserver_route_slow_requests_total Requests over the slow "
+        "threshold, by route.\n");
+    append(out, "# TYPE webserver_route_slow_requests_total counter\n");
+    for (int r = 0; r < ROUTE_MAX; ++r) {
+        if (!route_used[r]) {
+            continue;
+        }
+        append(
+            out, "webserver_route_slow_requests_total{route=\"%s\"} %llu\n",
+            route_names[r], (unsigned long long)route_slow[r]);
+    }
+}
+
+// 名字超长时截断，超过max个时丢弃
+static void add_value(
+    metrics_value* out,
+    int            max,
+    int&           n,
+    bool           counter,
+    uint64_t       value,
+    const char*    format,
+    const char*    arg)
+{
+    if (n < max) {
+        snprintf(out[n].name, METRICS_NAME_LEN, format, arg);
+        out[n].counter = counter;
+        out[n].value   = value;
+        ++n;
+    }
+}
+
+int metrics_snapshot(metrics_value* out, int max)
+{
+    uint64_t                 counters[COUNTER_MAX]     = {0};
+    uint64_t                 route_requests[ROUTE_MAX] = {0};
+    uint64_t                 route_cpu[ROUTE_MAX]      = {0};
+    uint64_t                 route_slow[ROUTE_MAX]     = {0};
+    std::vector<gauge_entry> gauges;
+
+    s_registry_lock.lock();
+    for (size_t t = 0; t < s_threads.size(); ++t) {
+        thread_metrics* m = s_threads[t];
+        for (int i = 0; i < COUNTER_MAX; ++i) {
+            counters[i] += m->counters[i].load(std::memory_order_relaxed);
+        }
+        for (int r = 0; r < ROUTE_MAX; ++r) {
+            metrics_route& route = m->routes[r];
+            for (int b = 0; b < METRICS_BUCKETS; ++b) {
+                route_requests[r] +=
+                    route.duration.buckets[b].load(std::memory_order_relaxed);
+            }
+            route_cpu[r] += route.cpu_us.load(std::memory_order_relaxed);
+            route_slow[r] += route.slow.load(std::memory_order_relaxed);
+        }
+    }
+    gauges = s_gauges;
+    s_registry_lock.unlock();
+
+    int n = 0;
+    for (int i = 0; i < COUNTER_MAX; ++i) {
+        if (counter_names[i]) {
+            add_value(out, max, n, true, counters[i], "%s", counter_names[i]);
+        }
+    }
+    static const char* status_names[] = {"2xx", "3xx", "4xx", "5xx"};
+    for (int i = COUNTER_STATUS_2XX; i <= COUNTER_STATUS_5XX; ++i) {
+        add_value(
+            out, max, n, true, counters[i], "responses_%s_total",
+            status_names[i - COUNTER_STATUS_2XX]);
+    }
+    for (int r = 0; r < ROUTE_MAX; ++r) {
+        const char* name = route_names[r];
+        add_value(
+            out, max, n, true, route_requests[r], "route_%s_requests_total",
+            name);
+        add_value(
+            out, max, n, true, route_cpu[r], "route_%s_cpu_us_total", name);
+        add_value(out, max, n, true, route_slow[r], "route_%s_slow_total", name);
+    }
+    for (size_t i = 0; i < gauges.size(); ++i) {
+        long v = gauges[i].fn(gauges[i].arg);
+        add_value(out, max, n, false, v > 0 ? v : 0, "%s", gauges[i].name);
+    }
+    return n;
+}
+
+body_producer* new_metrics_producer()
+{
+    string_producer* p = new string_producer();
+    render(p->text());
+    return p;
+}
@@ -0,0 +1,247 @@
+#include "perf_counters.h"
+#include "lock.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+bool g_perf_enabled = false;
+
+struct perf_stage_stats {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> values[PERF_COUNTER_MAX];
+};
+
+// 一个线程的计数器组和各阶段的累计值，只有所属线程写
+struct alignas(64) perf_thread {
+    int              leader;                   // 组长的fd，-1表示一个都没打开
+    int              slot[PERF_COUNTER_MAX];   // 在组读取结果中的位置，-1不可用
+    int              count;                    // 组里的计数器数
+    int              error;                    // 组长打开失败的errno
+    perf_scope*      current;                  // 当前最内层的阶段
+    perf_stage_stats stages[PERF_STAGE_MAX];
+};
+
+static const char* counter_names[PERF_COUNTER_MAX] = {
+    "task_clock_ns", "cycles",        "instructions",
+    "cache_misses",  "branch_misses", "context_switches"};
+
+static const char* stage_names[PERF_STAGE_MAX] = {
+    "reactor_read", "reactor_write", "reactor_timer",
+    "parse",        "do_request",    "build_response"};
+
+static locker                    s_threads_lock;
+static std::vector<perf_thread*> s_threads;
+
+static int open_counter(uint32_t type, uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.read_format    = PERF_FORMAT_GROUP;
+    attr.disabled       = group < 0;  // 组长先关闭，全部打开后再一起启用
+    // 普通用户权限下硬件计数器只能统计用户态，软件计数器(时间、上下文切换)
+    // 统计本线程在内核里的部分也是允许的
+    attr.exclude_kernel = type == PERF_TYPE_HARDWARE;
+    attr.exclude_hv     = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static perf_thread* perf_local()
+{
+    static thread_local perf_thread* local = nullptr;
+    if (local) {
+        return local;
+    }
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[PERF_COUNTER_MAX] = {
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    };
+    perf_thread* t = new perf_thread();
+    memset((void*)t, 0, sizeof(*t));
+    t->leader = -1;
+    for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+        t->slot[i] = -1;
+        int fd     = open_counter(events[i].type, events[i].config, t->leader);
+        if (fd < 0) {
+            if (t->leader < 0) {
+                t->error = errno;
+            }
+            continue;
+        }
+        if (t->leader < 0) {
+            t->leader = fd;
+        }
+        t->slot[i] = t->count++;
+    }
+    if (t->leader >= 0) {
+        ioctl(t->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    s_threads_lock.lock();
+    s_threads.push_back(t);
+    s_threads_lock.unlock();
+    local = t;
+    return t;
+}
+
+// 一次系统调用读出整组计数器
+static bool read_counters(perf_thread* t, uint64_t* out)
+{
+    uint64_t buf[1 + PERF_COUNTER_MAX];
+    if (read(t->leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) {
+        return false;
+    }
+    for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+        out[i] = t->slot[i] >= 0 && t->slot[i] < (int)buf[0]
+                     ? buf[1 + t->slot[i]]
+                     : 0;
+    }
+    return true;
+}
+
+bool perf_scope::begin(PERF_STAGE stage)
+{
+    perf_thread* t = perf_local();
+    if (t->leader < 0 || !read_counters(t, m_start)) {
+        return false;
+    }
+    m_stage    = stage;
+    m_parent   = t->current;
+    t->current = this;
+    memset(m_child, 0, sizeof(m_child));
+    return true;
+}
+
+void perf_scope::end()
+{
+    perf_thread* t = perf_local();
+    uint64_t     now[PERF_COUNTER_MAX];
+    t->current = m_parent;
+    if (!read_counters(t, now)) {
+        return;
+    }
+    perf_stage_stats& s = t->stages[m_stage];
+    s.calls.store(
+        s.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+        uint64_t delta = now[i] - m_start[i];
+        uint64_t own   = delta > m_child[i] ? delta - m_child[i] : 0;
+        s.values[i].store(
+            s.values[i].load(std::memory_order_relaxed) + own,
+            std::memory_order_relaxed);
+        if (m_parent) {
+            m_parent->m_child[i] += delta;
+        }
+    }
+}
+
+__attribute__((format(printf, 2, 3))) static void append(
+    std::string& out,
+    const char*  format,
+    ...)
+{
+    char    line[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) {
+        out.append(line, n < (int)sizeof(line) ? n : sizeof(line) - 1);
+    }
+}
+
+static void render(std::string& out)
+{
+    if (!g_perf_enabled) {
+        out.append("perf counters are disabled, start the server with -p\n");
+        return;
+    }
+    uint64_t calls[PERF_STAGE_MAX]                   = {0};
+    uint64_t values[PERF_STAGE_MAX][PERF_COUNTER_MAX] = {{0}};
+    bool     available[PERF_COUNTER_MAX]              = {false};
+    int      threads = 0, failed = 0, error = 0;
+
+    s_threads_lock.lock();
+    for (size_t k = 0; k < s_threads.size(); ++k) {
+        perf_thread* t = s_threads[k];
+        ++threads;
+        if (t->leader < 0) {
+            ++failed;
+            error = t->error;
+            continue;
+        }
+        for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+            available[i] = available[i] || t->slot[i] >= 0;
+        }
+        for (int s = 0; s < PERF_STAGE_MAX; ++s) {
+            calls[s] += t->stages[s].calls.load(std::memory_order_relaxed);
+            for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+                values[s][i] +=
+                    t->stages[s].values[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    s_threads_lock.unlock();
+
+    append(
+        out, "# counters per stage, averaged per call, %d threads",
+        threads);
+    if (failed) {
+        append(out, ", %d without counters (%s)", failed, strerror(error));
+    }
+    out.append("\n# unavailable:");
+    for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+        if (!available[i]) {
+            append(out, " %s", counter_names[i]);
+        }
+    }
+    append(out, "\n%-16s %10s", "stage", "calls");
+    for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+        append(out, " %16s", counter_names[i]);
+    }
+    append(out, " %6s\n", "ipc");
+
+    for (int s = 0; s < PERF_STAGE_MAX; ++s) {
+        append(
+            out, "%-16s %10llu", stage_names[s], (unsigned long long)calls[s]);
+        for (int i = 0; i < PERF_COUNTER_MAX; ++i) {
+            if (!available[i]) {
+                append(out, " %16s", "-");
+                continue;
+            }
+            append(
+                out, " %16.1f",
+                calls[s] ? (double)values[s][i] / calls[s] : 0.0);
+        }
+        uint64_t cycles = values[s][PERF_CYCLES];
+        if (cycles) {
+            append(
+                out, " %6.2f\n",
+                (double)values[s][PERF_INSTRUCTIONS] / cycles);
+        }
+        else {
+            append(out, " %6s\n", "-");
+        }
+    }
+}
+
+body_producer* new_perf_producer()
+{
+    string_producer* p = new string_producer();
+    render(p->text());
+    return p;
+}
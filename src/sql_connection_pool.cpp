@@ -124,10 +124,10 @@ void connection_pool::DestroyPool()
 	lock.unlock();
 }
 
-//当前空闲的连接数
+//当前空闲的连接数，监控线程也会调用，不能和请求争用连接池的锁
 int connection_pool::GetFreeConn()
 {
-	return this->FreeConn;
+	return this->FreeConn.load(std::memory_order_relaxed);
 }
 
 connection_pool::~connection_pool()
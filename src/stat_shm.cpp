@@ -0,0 +1,125 @@
+#include "stat_shm.h"
+#include "access_log.h"
+#include "log.h"
+#include "metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static stat_segment*     s_seg = nullptr;
+static std::string       s_name;
+static int               s_interval_ms = 1000;
+static pthread_t         s_thread;
+static std::atomic<bool> s_stop(false);
+
+// 指标名整个复制进段里，两边的长度必须一致
+static_assert(
+    STAT_SHM_NAME_LEN == METRICS_NAME_LEN,
+    "stat field names and metric names must have the same length");
+
+// 汇总一次指标，在seqlock保护下写进共享内存段
+static void publish(metrics_value* values)
+{
+    int n = metrics_snapshot(values, STAT_SHM_MAX_FIELDS);
+    if (n > s_seg->nfields) {
+        n = s_seg->nfields;  // 启动之后注册的指标不发布
+    }
+    uint64_t seq = s_seg->seq.load(std::memory_order_relaxed);
+    s_seg->seq.store(seq + 1, std::memory_order_relaxed);
+    // 保证读者先看到奇数的seq，再看到新的值
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < n; ++i) {
+        s_seg->fields[i].value.store(
+            values[i].value, std::memory_order_relaxed);
+    }
+    s_seg->update_us.store(access_now_us(), std::memory_order_relaxed);
+    s_seg->seq.store(seq + 2, std::memory_order_release);
+}
+
+static void* publish_thread(void*)
+{
+    metrics_value values[STAT_SHM_MAX_FIELDS];
+    while (!s_stop.load(std::memory_order_relaxed)) {
+        publish(values);
+        usleep(s_interval_ms * 1000);
+    }
+    return nullptr;
+}
+
+bool stat_shm_start(const char* name, int interval_ms)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("shm_open %s failed: %s", name, strerror(errno));
+        return false;
+    }
+    if (ftruncate(fd, sizeof(stat_segment)) < 0) {
+        LOG_ERROR("ftruncate %s failed: %s", name, strerror(errno));
+        close(fd);
+        return false;
+    }
+    void* p = mmap(
+        nullptr, sizeof(stat_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+        0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        LOG_ERROR("mmap %s failed: %s", name, strerror(errno));
+        return false;
+    }
+    // 同名的段还在被别的进程发布，不能覆盖，也不能在退出时删掉它
+    stat_segment* seg = (stat_segment*)p;
+    if (seg->magic.load(std::memory_order_acquire) == STAT_SHM_MAGIC &&
+        seg->pid != getpid() && (kill(seg->pid, 0) == 0 || errno == EPERM)) {
+        LOG_ERROR("%s is in use by pid %d", name, (int)seg->pid);
+        munmap(p, sizeof(stat_segment));
+        return false;
+    }
+    s_seg         = seg;
+    s_name        = name;
+    s_interval_ms = interval_ms > 0 ? interval_ms : 1000;
+
+    // 上次崩溃留下的段先作废，读者看到magic不对会重新映射
+    s_seg->magic.store(0, std::memory_order_release);
+    metrics_value values[STAT_SHM_MAX_FIELDS];
+    int           n = metrics_snapshot(values, STAT_SHM_MAX_FIELDS);
+    for (int i = 0; i < n; ++i) {
+        memcpy(s_seg->fields[i].name, values[i].name, STAT_SHM_NAME_LEN);
+        s_seg->fields[i].counter = values[i].counter;
+    }
+    s_seg->version    = STAT_SHM_VERSION;
+    s_seg->pid        = getpid();
+    s_seg->nfields    = n;
+    s_seg->start_time = time(NULL);
+    s_seg->seq.store(0, std::memory_order_relaxed);
+    publish(values);
+    s_seg->magic.store(STAT_SHM_MAGIC, std::memory_order_release);
+
+    s_stop.store(false, std::memory_order_relaxed);
+    if (pthread_create(&s_thread, NULL, publish_thread, NULL) != 0) {
+        LOG_ERROR("%s", "create stat publish thread failed");
+        s_stop.store(true, std::memory_order_relaxed);  // 没有线程需要等
+        stat_shm_stop();
+        return false;
+    }
+    return true;
+}
+
+void stat_shm_stop()
+{
+    if (!s_seg) {
+        return;
+    }
+    if (!s_stop.exchange(true)) {
+        pthread_join(s_thread, NULL);
+    }
+    s_seg->magic.store(0, std::memory_order_release);
+    munmap(s_seg, sizeof(stat_segment));
+    shm_unlink(s_name.c_str());
+    s_seg = nullptr;
+}
@@ -0,0 +1,112 @@
+#include "trace.h"
+#include "lock.h"
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+bool g_trace_enabled = false;
+
+static locker                   s_rings_lock;
+static std::vector<trace_ring*> s_rings;
+
+trace_ring* trace_local()
+{
+    static thread_local trace_ring* local = nullptr;
+    if (!local) {
+        trace_ring* r  = new trace_ring();
+        r->thread_name = "thread";
+        r->head.store(0, std::memory_order_relaxed);
+        s_rings_lock.lock();
+        r->tid = s_rings.size() + 1;
+        s_rings.push_back(r);
+        s_rings_lock.unlock();
+        local = r;
+    }
+    return local;
+}
+
+void trace_set_thread_name(const char* name)
+{
+    if (g_trace_enabled) {
+        trace_local()->thread_name = name;
+    }
+}
+
+// 复制一个线程的事件: 先读head再复制，复制完再读一次head，
+// 期间可能被写线程覆盖的最旧的那部分丢弃，包括正在写的下一个槽位
+static void copy_ring(trace_ring* r, std::vector<trace_event>& out)
+{
+    uint64_t head  = r->head.load(std::memory_order_acquire);
+    uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    size_t   base  = out.size();
+    for (uint64_t i = first; i < head; ++i) {
+        out.push_back(r->events[i & (TRACE_RING_SIZE - 1)]);
+    }
+    // 保证上面的复制在第二次读head之前完成
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t now  = r->head.load(std::memory_order_relaxed);
+    uint64_t lost = 0;
+    if (now + 1 > first + TRACE_RING_SIZE) {
+        lost = now + 1 - first - TRACE_RING_SIZE;
+    }
+    if (lost > head - first) {
+        lost = head - first;
+    }
+    out.erase(out.begin() + base, out.begin() + base + lost);
+}
+
+static void render(std::string& out)
+{
+    std::vector<trace_ring*> rings;
+    s_rings_lock.lock();
+    rings = s_rings;
+    s_rings_lock.unlock();
+
+    int  pid = getpid();
+    char line[256];
+    out.append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t i = 0; i < rings.size(); ++i) {
+        trace_ring* r = rings[i];
+        int         n = snprintf(
+            line, sizeof(line),
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", pid, r->tid, r->thread_name);
+        out.append(line, n);
+        first = false;
+
+        std::vector<trace_event> events;
+        copy_ring(r, events);
+        for (size_t k = 0; k < events.size(); ++k) {
+            const trace_event& e = events[k];
+            n                    = snprintf(
+                line, sizeof(line),
+                ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%lld,\"dur\":%d,\"args\":{\"fd\":%d}}",
+                e.name, pid, r->tid, (long long)e.start_us, e.dur_us, e.fd);
+            out.append(line, n);
+        }
+    }
+    out.append("\n]}\n");
+}
+
+bool trace_dump_file(const char* path)
+{
+    std::string text;
+    render(text);
+    FILE* fp = fopen(path, "w");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+    return fclose(fp) == 0 && ok;
+}
+
+body_producer* new_trace_producer()
+{
+    string_producer* p = new string_producer();
+    render(p->text());
+    return p;
+}
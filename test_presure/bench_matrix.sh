@@ -0,0 +1,276 @@
+#!/bin/bash
+# 场景压测矩阵: 生成合成的网站根目录，对每个 线程数 x 触发模式 x 场景
+# 在回环地址上启动一次服务器(内存用户表，不连MySQL)，用wsload压测，
+# 同时从/proc采样服务器的CPU时间和内存，结果汇总成CSV和JSON
+#
+# 场景:
+#   static_small  大量小html文件轮流请求，含很深的路径
+#   static_large  几个MB级的图片和视频
+#   login         反复登录同一个用户
+#   register      每个请求注册一个新用户
+#   mixed         小文件、大文件、深路径和登录按比例混合
+#   idle          先建立大量空闲长连接，再压小文件
+#
+# 用法: bench_matrix.sh [-b 构建目录] [-o 输出目录] [-d 秒数] [-T "线程数..."]
+#                      [-e "触发模式..."] [-S "场景..."] [-c 连接数] [-i 空闲连接数]
+#                      [-P 端口]
+set -u
+
+BUILD_DIR=build
+OUT_DIR=bench_out
+DURATION=10
+THREADS="4 8"
+TRIG_MODES="1 3"
+SCENARIOS="static_small static_large login register mixed idle"
+CONNECTIONS=100
+IDLE_CONNS=50000
+PORT=10080
+LOAD_THREADS=2
+SMALL_FILES=1000
+LARGE_MB=8
+
+usage() {
+    sed -n '2,18p' "$0" | sed 's/^# \{0,1\}//'
+    exit 1
+}
+
+while getopts "b:o:d:T:e:S:c:i:P:h" opt; do
+    case $opt in
+        b) BUILD_DIR=$OPTARG ;;
+        o) OUT_DIR=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        T) THREADS=$OPTARG ;;
+        e) TRIG_MODES=$OPTARG ;;
+        S) SCENARIOS=$OPTARG ;;
+        c) CONNECTIONS=$OPTARG ;;
+        i) IDLE_CONNS=$OPTARG ;;
+        P) PORT=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+SERVER=$(cd "$BUILD_DIR" && pwd)/webserver
+WSLOAD=$(cd "$BUILD_DIR" && pwd)/wsload
+for bin in "$SERVER" "$WSLOAD"; do
+    if [ ! -x "$bin" ]; then
+        echo "missing $bin, build the project first" >&2
+        exit 1
+    fi
+done
+mkdir -p "$OUT_DIR"
+OUT_DIR=$(cd "$OUT_DIR" && pwd)
+DOC_ROOT=$OUT_DIR/root
+RUN_DIR=$OUT_DIR/run
+RAW_DIR=$OUT_DIR/raw
+LIST_DIR=$OUT_DIR/lists
+CLK_TCK=$(getconf CLK_TCK)
+
+# 空闲连接要很多文件描述符，服务器和wsload都从这里继承
+ulimit -n "$(ulimit -Hn)" 2>/dev/null
+
+# 合成的网站根目录，已经生成过就复用
+make_doc_root() {
+    if [ -f "$DOC_ROOT/.done" ]; then
+        return
+    fi
+    rm -rf "$DOC_ROOT"
+    mkdir -p "$DOC_ROOT/tiny" "$DOC_ROOT/media"
+    # 登录注册跳转的页面用仓库里的
+    for page in log.html logError.html welcome.html register.html \
+        registerError.html judge.html; do
+        cp "$SCRIPT_DIR/../root/$page" "$DOC_ROOT/"
+    done
+    # 小文件比gzip预压缩的下限还小，服务器启动时不会去压缩它们
+    local i
+    for ((i = 0; i < SMALL_FILES; i++)); do
+        printf '<html><body><p>tiny page %d</p></body></html>\n' "$i" \
+            >"$DOC_ROOT/tiny/t$i.html"
+    done
+    local deep=$DOC_ROOT/deep
+    for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16; do
+        deep=$deep/level$i
+    done
+    mkdir -p "$deep"
+    for i in 0 1 2 3 4 5 6 7; do
+        printf '<html><body>deep %d</body></html>\n' "$i" >"$deep/d$i.html"
+    done
+    head -c $((LARGE_MB * 1048576)) /dev/urandom >"$DOC_ROOT/media/big.mp4"
+    head -c $((LARGE_MB * 1048576 / 2)) /dev/urandom >"$DOC_ROOT/media/big.jpg"
+    head -c $((LARGE_MB * 1048576 / 4)) /dev/urandom >"$DOC_ROOT/media/big.mp3"
+    touch "$DOC_ROOT/.done"
+}
+
+# 每个场景一个wsload请求列表
+make_lists() {
+    mkdir -p "$LIST_DIR"
+    local deep_files
+    deep_files=$(cd "$DOC_ROOT" && find deep -name '*.html' | sort)
+    {
+        local i
+        for ((i = 0; i < SMALL_FILES; i++)); do
+            echo "/tiny/t$i.html"
+        done
+        for f in $deep_files; do
+            echo "/$f"
+        done
+    } >"$LIST_DIR/static_small"
+    printf '/media/big.mp4\n/media/big.jpg\n/media/big.mp3\n' \
+        >"$LIST_DIR/static_large"
+    echo "POST /2 user=bench&password=bench" >"$LIST_DIR/login"
+    echo "POST /3 user=r{seq}&password=bench" >"$LIST_DIR/register"
+    # 按请求数: 小文件70%，深路径10%，登录15%，大文件5%
+    {
+        local i
+        for ((i = 0; i < 14; i++)); do
+            echo "/tiny/t$((i * 37 % SMALL_FILES)).html"
+        done
+        echo "/$(echo "$deep_files" | head -1)"
+        echo "/$(echo "$deep_files" | tail -1)"
+        echo "POST /2 user=bench&password=bench"
+        echo "POST /2 user=bench&password=bench"
+        echo "POST /2 user=bench&password=wrong"
+        echo "/media/big.jpg"
+    } >"$LIST_DIR/mixed"
+    cp "$LIST_DIR/static_small" "$LIST_DIR/idle"
+}
+
+proc_cpu_ticks() {
+    # utime和stime是/proc/pid/stat里的第14和15个字段，命令名可能有空格
+    sed 's/.*) //' "/proc/$1/stat" | awk '{ print $12 + $13 }'
+}
+
+proc_status_kb() {
+    awk -v key="$2:" '$1 == key { print $2 }' "/proc/$1/status"
+}
+
+# 取wsload JSON里某个键的数值
+json_num() {
+    tr -d '\n' <"$1" | sed -n "s/.*\"$2\":\([0-9.]*\).*/\1/p"
+}
+
+wait_port() {
+    local i
+    for ((i = 0; i < 50; i++)); do
+        if (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+http_post() {
+    exec 3<>"/dev/tcp/127.0.0.1/$PORT" || return 1
+    printf 'POST %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n' "$1" >&3
+    printf 'Content-Length: %d\r\n\r\n%s' "${#2}" "$2" >&3
+    timeout 5 cat <&3 >/dev/null
+    exec 3>&-
+}
+
+start_server() {
+    mkdir -p "$RUN_DIR"
+    # 访问日志只记录错误和慢请求，不发布共享内存统计，空闲长连接不超时
+    (cd "$RUN_DIR" && exec "$SERVER" -P "$PORT" -r "$DOC_ROOT" -T "$1" \
+        -e "$2" -u -s 0 -l 2 -o "" -a 3600 -n 0 >server.out 2>&1) &
+    SERVER_PID=$!
+    if ! wait_port; then
+        echo "server did not start, see $RUN_DIR/server.out" >&2
+        kill "$SERVER_PID" 2>/dev/null
+        return 1
+    fi
+}
+
+stop_server() {
+    kill "$SERVER_PID" 2>/dev/null
+    wait "$SERVER_PID" 2>/dev/null
+}
+
+# 一次压测: 参数为 场景 线程数 触发模式
+run_one() {
+    local scenario=$1 threads=$2 trig=$3
+    local name=${scenario}_t${threads}_e${trig}
+    local raw=$RAW_DIR/$name.json
+    local idle=0
+    if [ "$scenario" = idle ]; then
+        idle=$IDLE_CONNS
+    fi
+    start_server "$threads" "$trig" || return 1
+    if [ "$scenario" = login ] || [ "$scenario" = mixed ]; then
+        http_post /3 "user=bench&password=bench"
+    fi
+
+    # 空闲连接建立的开销不算在压测里，等wsload开始压测再采样CPU
+    local ready=$RUN_DIR/ready ticks0 ticks1
+    rm -f "$ready"
+    "$WSLOAD" -c "$CONNECTIONS" -t "$LOAD_THREADS" -d "$DURATION" -i "$idle" \
+        -T 5000 -f "$LIST_DIR/$scenario" -R "$ready" -o "$raw" \
+        "http://127.0.0.1:$PORT/" &
+    local load_pid=$!
+    while [ ! -f "$ready" ] && kill -0 "$load_pid" 2>/dev/null; do
+        sleep 0.05
+    done
+    ticks0=$(proc_cpu_ticks "$SERVER_PID")
+    wait "$load_pid"
+    ticks1=$(proc_cpu_ticks "$SERVER_PID")
+    local rss hwm
+    rss=$(proc_status_kb "$SERVER_PID" VmRSS)
+    hwm=$(proc_status_kb "$SERVER_PID" VmHWM)
+    stop_server
+
+    local rps cpu_s cpu_us_req errors
+    rps=$(json_num "$raw" requests_per_s)
+    cpu_s=$(awk -v t=$((ticks1 - ticks0)) -v hz="$CLK_TCK" \
+        'BEGIN { printf "%.2f", t / hz }')
+    cpu_us_req=$(awk -v c="$cpu_s" -v r="$(json_num "$raw" requests)" \
+        'BEGIN { printf "%.1f", (r > 0 ? c * 1e6 / r : 0) }')
+    errors=$(awk -v a="$(json_num "$raw" connect)" -v b="$(json_num "$raw" io)" \
+        -v c="$(json_num "$raw" timeout)" 'BEGIN { print a + b + c }')
+    echo "$scenario,$threads,$trig,$rps,$(json_num "$raw" bytes_per_s)," \
+        "$(json_num "$raw" p50),$(json_num "$raw" p90),$(json_num "$raw" p99)," \
+        "$(json_num "$raw" p99.9),$(json_num "$raw" 2xx),$errors," \
+        "$idle,$(json_num "$raw" established),$cpu_s,$cpu_us_req,$rss,$hwm" |
+        tr -d ' ' >>"$OUT_DIR/results.csv"
+    {
+        [ -s "$OUT_DIR/results.json.tmp" ] && echo ","
+        printf '{"scenario":"%s","server_threads":%d,"trig_mode":%d,' \
+            "$scenario" "$threads" "$trig"
+        printf '"server_cpu_s":%s,"server_cpu_us_per_request":%s,' \
+            "$cpu_s" "$cpu_us_req"
+        printf '"server_rss_kb":%s,"server_peak_rss_kb":%s,"load":' \
+            "${rss:-0}" "${hwm:-0}"
+        cat "$raw"
+        printf '}'
+    } >>"$OUT_DIR/results.json.tmp"
+    printf '%-14s threads=%-2s trig=%s  %10s req/s  p99=%sus  cpu=%ss  rss=%skB\n' \
+        "$scenario" "$threads" "$trig" "$rps" "$(json_num "$raw" p99)" \
+        "$cpu_s" "$rss"
+}
+
+make_doc_root
+make_lists
+mkdir -p "$RAW_DIR"
+echo "scenario,server_threads,trig_mode,requests_per_s,bytes_per_s,p50_us,p90_us,p99_us,p999_us,responses_2xx,errors,idle_conns,idle_established,server_cpu_s,server_cpu_us_per_request,server_rss_kb,server_peak_rss_kb" \
+    >"$OUT_DIR/results.csv"
+: >"$OUT_DIR/results.json.tmp"
+trap 'kill $SERVER_PID 2>/dev/null; exit 1' INT TERM
+
+for threads in $THREADS; do
+    for trig in $TRIG_MODES; do
+        for scenario in $SCENARIOS; do
+            if [ ! -f "$LIST_DIR/$scenario" ]; then
+                echo "unknown scenario $scenario" >&2
+                continue
+            fi
+            run_one "$scenario" "$threads" "$trig"
+        done
+    done
+done
+
+{
+    echo "["
+    cat "$OUT_DIR/results.json.tmp"
+    echo "]"
+} >"$OUT_DIR/results.json"
+rm -f "$OUT_DIR/results.json.tmp"
+echo "results in $OUT_DIR/results.csv and $OUT_DIR/results.json"
@@ -0,0 +1,288 @@
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+// 压测工具共用的客户端部分: 延迟直方图和增量的HTTP响应解析
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <strings.h>
+#include <vector>
+
+// 延迟直方图，单位微秒: 小于64的值精确记录，之后每个2的幂区间再等分成64个桶，
+// 相对误差不超过1.6%
+class latency_hist {
+public:
+    static const int SUB     = 64;
+    static const int BUCKETS = SUB * 40;
+
+    latency_hist() : m_counts(BUCKETS, 0), m_total(0), m_sum(0), m_max(0) {}
+
+    void record(int64_t us)
+    {
+        if (us < 0) {
+            us = 0;
+        }
+        ++m_counts[index(us)];
+        ++m_total;
+        m_sum += us;
+        if ((uint64_t)us > m_max) {
+            m_max = us;
+        }
+    }
+    void merge(const latency_hist& other)
+    {
+        for (int i = 0; i < BUCKETS; ++i) {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        if (other.m_max > m_max) {
+            m_max = other.m_max;
+        }
+    }
+    // 第q分位(0到1)所在桶的中点
+    uint64_t percentile(double q) const
+    {
+        if (m_total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(q * m_total);
+        if (rank >= m_total) {
+            rank = m_total - 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += m_counts[i];
+            if (seen > rank) {
+                uint64_t v = middle(i);
+                return v < m_max ? v : m_max;
+            }
+        }
+        return m_max;
+    }
+    uint64_t min() const
+    {
+        for (int i = 0; i < BUCKETS; ++i) {
+            if (m_counts[i]) {
+                return lower(i);
+            }
+        }
+        return 0;
+    }
+    uint64_t max() const
+    {
+        return m_max;
+    }
+    double mean() const
+    {
+        return m_total ? (double)m_sum / m_total : 0;
+    }
+
+private:
+    static int index(uint64_t v)
+    {
+        if (v < (uint64_t)SUB) {
+            return (int)v;
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int i   = SUB * (msb - 5) + (int)((v >> (msb - 6)) & (SUB - 1));
+        return i < BUCKETS ? i : BUCKETS - 1;
+    }
+    static uint64_t lower(int i)
+    {
+        if (i < SUB) {
+            return i;
+        }
+        int msb = i / SUB + 5;
+        return (uint64_t)(SUB + i % SUB) << (msb - 6);
+    }
+    static uint64_t middle(int i)
+    {
+        if (i < SUB) {
+            return i;
+        }
+        int msb = i / SUB + 5;
+        return lower(i) + ((1ULL << (msb - 6)) >> 1);
+    }
+
+    std::vector<uint64_t> m_counts;
+    uint64_t              m_total;
+    uint64_t              m_sum;
+    uint64_t              m_max;
+};
+
+// 增量解析响应: 状态行和头部攒齐之后解析，响应体只计数不保存
+class response_parser {
+public:
+    enum RESULT { NEED_MORE, DONE, BAD };
+
+    response_parser()
+    {
+        reset();
+    }
+    void reset()
+    {
+        m_state     = HEADER;
+        m_head.clear();
+        m_remaining = 0;
+        m_status    = 0;
+        m_close     = false;
+    }
+    int status() const
+    {
+        return m_status;
+    }
+    // 服务器在这个响应之后会关闭连接
+    bool closing() const
+    {
+        return m_close;
+    }
+    // 读到EOF，没有长度的响应以此结束
+    bool finish_eof()
+    {
+        return m_state == BODY_EOF;
+    }
+
+    // 从data开始解析，used为用掉的字节数，响应结束时返回DONE
+    RESULT feed(const char* data, size_t len, size_t* used)
+    {
+        size_t pos = 0;
+        while (pos < len) {
+            if (m_state == HEADER || m_state == CHUNK_SIZE ||
+                m_state == CHUNK_TRAILER) {
+                // 按行处理，行不完整时攒在m_head里
+                const char* nl =
+                    (const char*)memchr(data + pos, '\n', len - pos);
+                size_t n = nl ? nl - (data + pos) + 1 : len - pos;
+                m_head.append(data + pos, n);
+                pos += n;
+                if (!nl) {
+                    if (m_head.size() > 65536) {
+                        return BAD;
+                    }
+                    break;
+                }
+                RESULT r = line();
+                if (r != NEED_MORE) {
+                    *used = pos;
+                    return r;
+                }
+                continue;
+            }
+            if (m_state == BODY_EOF) {
+                pos = len;
+                break;
+            }
+            // BODY 或 CHUNK_DATA
+            size_t n = len - pos < m_remaining ? len - pos : m_remaining;
+            pos += n;
+            m_remaining -= n;
+            if (m_remaining == 0) {
+                if (m_state == BODY) {
+                    *used = pos;
+                    return DONE;
+                }
+                m_state = CHUNK_SIZE;
+                m_head.clear();
+            }
+        }
+        *used = pos;
+        return NEED_MORE;
+    }
+
+private:
+    enum STATE { HEADER, BODY, BODY_EOF, CHUNK_SIZE, CHUNK_DATA, CHUNK_TRAILER };
+
+    // 处理m_head里的一个完整行
+    RESULT line()
+    {
+        std::string l = m_head;
+        m_head.clear();
+        while (!l.empty() && (l.back() == '\n' || l.back() == '\r')) {
+            l.pop_back();
+        }
+        if (m_state == CHUNK_SIZE) {
+            if (l.empty()) {
+                return NEED_MORE;  // 上一块数据之后的CRLF
+            }
+            m_remaining = strtoul(l.c_str(), nullptr, 16);
+            if (m_remaining == 0) {
+                m_state = CHUNK_TRAILER;
+            }
+            else {
+                m_state = CHUNK_DATA;
+            }
+            return NEED_MORE;
+        }
+        if (m_state == CHUNK_TRAILER) {
+            return l.empty() ? DONE : NEED_MORE;
+        }
+        // 头部
+        if (m_status == 0) {
+            if (strncmp(l.c_str(), "HTTP/1.", 7) != 0 || l.size() < 12) {
+                return BAD;
+            }
+            m_status  = atoi(l.c_str() + 9);
+            m_http10  = l[7] == '0';
+            m_close   = m_http10;
+            m_length  = -1;
+            m_chunked = false;
+            return NEED_MORE;
+        }
+        if (l.empty()) {
+            if (m_chunked) {
+                m_state = CHUNK_SIZE;
+            }
+            else if (m_length >= 0) {
+                m_remaining = m_length;
+                m_state     = BODY;
+                if (m_length == 0) {
+                    return DONE;
+                }
+            }
+            else {
+                m_state = BODY_EOF;
+                m_close = true;
+            }
+            return NEED_MORE;
+        }
+        const char* v = strchr(l.c_str(), ':');
+        if (!v) {
+            return NEED_MORE;
+        }
+        size_t key = v - l.c_str();
+        ++v;
+        while (*v == ' ' || *v == '\t') {
+            ++v;
+        }
+        if (key == 14 && strncasecmp(l.c_str(), "Content-Length", 14) == 0) {
+            m_length = atol(v);
+        }
+        else if (
+            key == 17 &&
+            strncasecmp(l.c_str(), "Transfer-Encoding", 17) == 0) {
+            m_chunked = strcasestr(v, "chunked") != nullptr;
+        }
+        else if (key == 10 && strncasecmp(l.c_str(), "Connection", 10) == 0) {
+            if (strcasestr(v, "close")) {
+                m_close = true;
+            }
+            else if (strcasestr(v, "keep-alive")) {
+                m_close = false;
+            }
+        }
+        return NEED_MORE;
+    }
+
+    STATE       m_state;
+    std::string m_head;
+    size_t      m_remaining;
+    int         m_status;
+    bool        m_close;
+    bool        m_http10;
+    long        m_length;
+    bool        m_chunked;
+};
+
+#endif
@@ -0,0 +1,795 @@
+// wsload: 基于epoll的多线程HTTP压测工具，代替每个客户端fork一个进程的webbench
+//
+// - 长连接(默认)或者每个请求新建连接(-K)
+// - 每个连接可以流水线发送多个请求(-p)
+// - POST请求体(-b)，{seq}会替换成递增的序号，用来给 /3 注册不同的用户名
+// - 闭环(默认): 每个连接收到响应后马上发下一个请求
+//   开环(-r): 按固定速率安排请求，延迟从"应该发出的时间"算起，
+//   服务器变慢时排队的时间也算进延迟，避免协调遗漏(coordinated omission)
+// - 请求列表(-f): 每行一个请求，按顺序轮流发送，用来混合不同的URL和方法
+// - 空闲连接(-i): 开始压测之前先建立这么多长连接，各发一个请求之后不再发送，
+//   看服务器在大量空闲长连接下的表现
+// - 延迟直方图，输出p50/p90/p99/p99.9，结果为一个JSON对象，方便不同构建之间比较
+//
+// 用法: wsload [选项] http://host:port/path
+#include "http_client.h"
+#include <arpa/inet.h>
+#include <atomic>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+// 一种请求，来自命令行或者请求列表文件的一行
+struct request_spec {
+    std::string method;
+    std::string path;
+    std::string body;
+};
+
+struct options {
+    std::string host;
+    int         port        = 80;
+    std::string path        = "/";
+    sockaddr_in addr;
+    int         threads     = 2;
+    int         connections = 10;
+    int         duration    = 10;  // 秒
+    int         depth       = 1;   // 每个连接同时在途的请求数
+    double      rate        = 0;   // 开环模式的总请求速率，0为闭环
+    bool        keepalive   = true;
+    std::string method      = "GET";
+    std::string body;
+    int         timeout_ms = 2000;  // 连接上这么久没有进展就算超时，重新连接
+    const char* json_path  = nullptr;
+    const char* list_path  = nullptr;
+    const char* ready_path = nullptr;  // 开始压测时创建这个文件
+    int         idle       = 0;   // 空闲长连接总数
+    int         idle_wait  = 60;  // 等空闲连接建立的最长秒数
+    std::vector<request_spec> requests;
+};
+
+static options           g_opt;
+static std::atomic<long> g_seq(0);   // 请求体里{seq}的序号
+static std::atomic<long> g_next(0);  // 轮到请求列表里的第几个
+static pthread_barrier_t g_ready;    // 各线程的空闲连接都建好之后一起开始
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct thread_result {
+    latency_hist latency;
+    long         requests       = 0;
+    long         bytes          = 0;
+    long         status[6]      = {0};  // 按状态码的百位
+    long         connects       = 0;
+    long         connect_errors = 0;
+    long         io_errors      = 0;  // 读写出错、解析失败、提前关闭
+    long         timeouts       = 0;
+    long         dropped        = 0;  // 开环模式下到结束时还没发出的请求
+    long         idle_ready     = 0;  // 开始压测时已经建好的空闲连接
+    long         idle_closed    = 0;  // 压测期间被服务器关闭的空闲连接
+    int64_t      start_ns       = 0;
+    int64_t      end_ns         = 0;
+};
+
+struct connection {
+    int                 index = 0;  // 在线程连接数组里的下标
+    int                 fd    = -1;
+    bool                idle  = false;  // 空闲连接，只发一个请求
+    bool                ready = false;  // 空闲连接收到了响应
+    bool                lost  = false;  // 空闲连接还没开始建立或者已被关闭，不重连
+    bool                connecting = false;
+    bool                want_out   = false;
+    std::string         out;
+    size_t              out_off = 0;
+    std::deque<int64_t> inflight;  // 在途请求的开始时间，按发送顺序
+    response_parser     parser;
+    int64_t             last_active = 0;
+};
+
+class worker {
+public:
+    worker(int id, int connections, int idle)
+        : m_id(id), m_conns(connections + idle), m_idle(idle)
+    {
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            m_conns[i].index = i;
+            m_conns[i].idle  = (int)i >= connections;
+            m_conns[i].lost  = m_conns[i].idle;
+        }
+    }
+
+    static void* run(void* arg)
+    {
+        ((worker*)arg)->loop();
+        return nullptr;
+    }
+    const thread_result& result() const
+    {
+        return m_result;
+    }
+
+private:
+    void loop();
+    bool open(connection& c);
+    void close(connection& c, bool error);
+    void update_events(connection& c);
+    void add_request(connection& c, int64_t start);
+    void fill(connection& c, int64_t now);
+    void dispatch();
+    bool flush(connection& c);
+    bool receive(connection& c, int64_t now);
+    void complete(connection& c, int64_t end);
+    void check_timeouts(int64_t now);
+    void poll(int timeout_ms);
+    bool setup_idle(int64_t deadline);
+
+    int                     m_id;
+    int                     m_epfd = -1;
+    std::vector<connection> m_conns;
+    int                     m_idle;  // m_conns末尾的空闲连接数
+    std::deque<int64_t>     m_backlog;  // 开环模式下到期还没发出的请求
+    bool                    m_open_loop = false;
+    thread_result           m_result;
+};
+
+static std::string build_request()
+{
+    const request_spec& spec =
+        g_opt.requests[g_next.fetch_add(1) % g_opt.requests.size()];
+    std::string body = spec.body;
+    size_t      p    = body.find("{seq}");
+    if (p != std::string::npos) {
+        body.replace(p, 5, std::to_string(g_seq.fetch_add(1)));
+    }
+    std::string req = spec.method + " " + spec.path + " HTTP/1.1\r\nHost: " +
+                      g_opt.host + "\r\nConnection: " +
+                      (g_opt.keepalive ? "keep-alive" : "close") + "\r\n";
+    if (!body.empty() || spec.method == "POST") {
+        req += "Content-Type: application/x-www-form-urlencoded\r\n"
+               "Content-Length: " +
+               std::to_string(body.size()) + "\r\n";
+    }
+    req += "\r\n";
+    req += body;
+    return req;
+}
+
+// 事件里同时带上连接下标和fd，重连之后旧fd残留的事件可以识别出来
+static uint64_t event_data(const connection& c)
+{
+    return (uint64_t)c.index << 32 | (uint32_t)c.fd;
+}
+
+bool worker::open(connection& c)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.fd < 0) {
+        ++m_result.connect_errors;
+        return false;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ++m_result.connects;
+    if (connect(c.fd, (sockaddr*)&g_opt.addr, sizeof(g_opt.addr)) < 0 &&
+        errno != EINPROGRESS) {
+        ++m_result.connect_errors;
+        ::close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    c.connecting  = true;
+    c.want_out    = true;
+    c.out_off     = 0;
+    c.last_active = now_ns();
+    c.parser.reset();
+    epoll_event ev;
+    ev.events   = EPOLLIN | EPOLLOUT;
+    ev.data.u64 = event_data(c);
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+// 关闭连接并重新连接。在途的请求: 出错时丢弃并记错误，
+// 服务器正常关闭时在新连接上重新发送; 闭环模式下再补满
+void worker::close(connection& c, bool error)
+{
+    if (c.fd >= 0) {
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+        ::close(c.fd);
+        c.fd = -1;
+    }
+    if (error) {
+        ++m_result.io_errors;
+        c.inflight.clear();
+    }
+    c.out.clear();
+    c.out_off = 0;
+    // 建好的空闲连接被服务器关掉就不再重连，只计数
+    if (c.idle && c.ready) {
+        c.ready = false;
+        c.lost  = true;
+        ++m_result.idle_closed;
+        return;
+    }
+    // 没有回应的请求在新连接上按原来的开始时间重新发送
+    std::deque<int64_t> pending;
+    pending.swap(c.inflight);
+    if (open(c)) {
+        for (size_t i = 0; i < pending.size(); ++i) {
+            add_request(c, pending[i]);
+        }
+        if (!m_open_loop) {
+            fill(c, now_ns());
+        }
+    }
+}
+
+void worker::update_events(connection& c)
+{
+    bool want = c.connecting || c.out_off < c.out.size();
+    if (want == c.want_out || c.fd < 0) {
+        return;
+    }
+    c.want_out = want;
+    uint32_t events = EPOLLIN;
+    if (want) {
+        events |= EPOLLOUT;
+    }
+    epoll_event ev;
+    ev.events   = events;
+    ev.data.u64 = event_data(c);
+    epoll_ctl(m_epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+void worker::add_request(connection& c, int64_t start)
+{
+    if (c.out_off == c.out.size()) {
+        c.out.clear();
+        c.out_off = 0;
+    }
+    c.out += build_request();
+    c.inflight.push_back(start);
+}
+
+// 闭环模式下把连接上的在途请求补满，空闲连接只发第一个请求
+void worker::fill(connection& c, int64_t now)
+{
+    if (c.idle) {
+        if (!c.ready && c.inflight.empty()) {
+            add_request(c, now);
+        }
+        return;
+    }
+    int depth = g_opt.keepalive ? g_opt.depth : 1;
+    while ((int)c.inflight.size() < depth) {
+        add_request(c, now);
+    }
+}
+
+// 开环模式下把到期的请求分给有空位的连接
+void worker::dispatch()
+{
+    int depth = g_opt.keepalive ? g_opt.depth : 1;
+    for (size_t i = 0; i < m_conns.size() && !m_backlog.empty(); ++i) {
+        connection& c = m_conns[i];
+        if (c.fd < 0 || c.idle) {
+            continue;
+        }
+        bool added = false;
+        while (!m_backlog.empty() && (int)c.inflight.size() < depth) {
+            add_request(c, m_backlog.front());
+            m_backlog.pop_front();
+            added = true;
+        }
+        if (added && !c.connecting && !flush(c)) {
+            close(c, true);
+        }
+    }
+}
+
+bool worker::flush(connection& c)
+{
+    while (c.out_off < c.out.size()) {
+        ssize_t n = send(
+            c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off,
+            MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            return false;
+        }
+        c.out_off += n;
+    }
+    update_events(c);
+    return true;
+}
+
+// 读完socket里的数据，返回false表示连接已经关闭
+bool worker::receive(connection& c, int64_t now)
+{
+    char buf[65536];
+    while (true) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                return true;
+            }
+            close(c, true);
+            return false;
+        }
+        if (n == 0) {
+            // 没有长度的响应以关闭连接结束; 响应收到一半就关闭是错误，
+            // 还没开始响应时关闭(比如长连接超时)则在新连接上重发
+            bool error = false;
+            if (c.parser.finish_eof() && !c.inflight.empty()) {
+                complete(c, now_ns());
+            }
+            else if (c.parser.status() != 0) {
+                error = true;
+            }
+            close(c, error);
+            return false;
+        }
+        c.last_active = now;
+        m_result.bytes += n;
+        size_t pos = 0;
+        while (pos < (size_t)n) {
+            size_t                  used = 0;
+            response_parser::RESULT r =
+                c.parser.feed(buf + pos, n - pos, &used);
+            pos += used;
+            if (r == response_parser::BAD || c.inflight.empty()) {
+                close(c, true);
+                return false;
+            }
+            if (r == response_parser::NEED_MORE) {
+                break;
+            }
+            int64_t end = now_ns();
+            complete(c, end);
+            bool closing = c.parser.closing() || !g_opt.keepalive;
+            c.parser.reset();
+            if (closing) {
+                close(c, false);
+                return false;
+            }
+            if (!m_open_loop) {
+                fill(c, end);
+            }
+        }
+    }
+}
+
+// 一个请求收到了完整的响应，空闲连接建立时的请求不计入结果
+void worker::complete(connection& c, int64_t end)
+{
+    if (c.idle) {
+        c.ready = true;
+    }
+    else {
+        m_result.latency.record((end - c.inflight.front()) / 1000);
+        ++m_result.requests;
+        ++m_result.status[c.parser.status() / 100 % 6];
+    }
+    c.inflight.pop_front();
+}
+
+void worker::check_timeouts(int64_t now)
+{
+    int64_t limit = (int64_t)g_opt.timeout_ms * 1000000;
+    for (size_t i = 0; i < m_conns.size(); ++i) {
+        connection& c = m_conns[i];
+        if (c.lost) {
+            continue;
+        }
+        if (c.fd >= 0 && (c.connecting || !c.inflight.empty()) &&
+            now - c.last_active > limit) {
+            m_result.timeouts += c.inflight.size();
+            c.inflight.clear();
+            close(c, false);
+        }
+        else if (c.fd < 0 && open(c) && !m_open_loop) {
+            fill(c, now);  // 之前重连失败的连接
+        }
+    }
+}
+
+// 等一轮事件并处理
+void worker::poll(int timeout_ms)
+{
+    epoll_event events[256];
+    int         n   = epoll_wait(m_epfd, events, 256, timeout_ms);
+    int64_t     now = now_ns();
+    for (int i = 0; i < n; ++i) {
+        uint64_t    data = events[i].data.u64;
+        connection& c    = m_conns[data >> 32];
+        if (c.fd < 0 || (uint32_t)c.fd != (uint32_t)data) {
+            continue;  // 本批事件里前面已经关闭或重连过
+        }
+        if (c.connecting && (events[i].events & (EPOLLOUT | EPOLLERR))) {
+            int       err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) {
+                ++m_result.connect_errors;
+                epoll_ctl(m_epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+                ::close(c.fd);
+                c.fd = -1;  // 下一次检查超时的时候重连
+                continue;
+            }
+            c.connecting  = false;
+            c.last_active = now;
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) &&
+            !receive(c, now)) {
+            continue;
+        }
+        if (!c.connecting && !flush(c)) {
+            close(c, true);
+        }
+    }
+}
+
+// 建立本线程的空闲连接，全部收到响应或者到期限时返回，返回是否全部建好
+// 同时在建立的连接不超过IDLE_BATCH个，一下子发起几万个连接会把服务器的
+// 监听队列挤满，丢掉的SYN要等重传，连接超时之后又重连，越来越慢
+bool worker::setup_idle(int64_t deadline)
+{
+    static const int IDLE_BATCH = 128;
+    size_t first  = m_conns.size() - m_idle;
+    size_t opened = first;
+    int64_t last_check = now_ns();
+    while (true) {
+        int64_t now     = now_ns();
+        int     pending = 0;
+        for (size_t i = first; i < opened; ++i) {
+            pending += !m_conns[i].ready && !m_conns[i].lost;
+        }
+        while (pending < IDLE_BATCH && opened < m_conns.size()) {
+            m_conns[opened].lost = false;
+            if (open(m_conns[opened])) {
+                fill(m_conns[opened], now);
+            }
+            ++opened;
+            ++pending;
+        }
+        if (pending == 0 || now >= deadline) {
+            return pending == 0;
+        }
+        if (now - last_check > 100000000) {
+            check_timeouts(now);
+            last_check = now;
+        }
+        poll(100);
+    }
+}
+
+void worker::loop()
+{
+    m_epfd      = epoll_create1(EPOLL_CLOEXEC);
+    m_open_loop = g_opt.rate > 0;
+    if (m_idle > 0) {
+        setup_idle(now_ns() + (int64_t)g_opt.idle_wait * 1000000000);
+    }
+    // 空闲连接建好之后才开始压测，外面的脚本可以等ready文件再采样服务器
+    if (pthread_barrier_wait(&g_ready) == PTHREAD_BARRIER_SERIAL_THREAD &&
+        g_opt.ready_path) {
+        FILE* f = fopen(g_opt.ready_path, "w");
+        if (f) {
+            fclose(f);
+        }
+    }
+    // 建立空闲连接的开销不算在结果里
+    long idle_ready = 0;
+    for (size_t i = m_conns.size() - m_idle; i < m_conns.size(); ++i) {
+        idle_ready += m_conns[i].ready;
+    }
+    m_result            = thread_result();
+    m_result.idle_ready = idle_ready;
+
+    int64_t start = now_ns();
+    int64_t end   = start + (int64_t)g_opt.duration * 1000000000;
+    // 开环模式: 每个线程承担总速率的一份，各线程的起点错开
+    int64_t interval = 0, next = 0;
+    if (m_open_loop) {
+        interval = (int64_t)(1e9 * g_opt.threads / g_opt.rate);
+        next     = start + interval * m_id / g_opt.threads;
+    }
+    for (size_t i = 0; i < m_conns.size() - m_idle; ++i) {
+        if (open(m_conns[i]) && !m_open_loop) {
+            fill(m_conns[i], start);
+        }
+    }
+
+    int64_t last_check = start;
+    while (true) {
+        int64_t now = now_ns();
+        if (now >= end) {
+            break;
+        }
+        if (m_open_loop) {
+            while (next <= now) {
+                m_backlog.push_back(next);
+                next += interval;
+            }
+            dispatch();
+        }
+        if (now - last_check > 100000000) {
+            check_timeouts(now);
+            last_check = now;
+        }
+        int64_t wake = end;
+        if (m_open_loop && next < wake) {
+            wake = next;
+        }
+        int timeout = (int)((wake - now + 999999) / 1000000);
+        if (timeout > 100) {
+            timeout = 100;
+        }
+        poll(timeout);
+    }
+    m_result.dropped  = m_backlog.size();
+    m_result.start_ns = start;
+    m_result.end_ns   = now_ns();
+    for (size_t i = 0; i < m_conns.size(); ++i) {
+        if (m_conns[i].fd >= 0) {
+            ::close(m_conns[i].fd);
+        }
+    }
+    ::close(m_epfd);
+}
+
+// 请求列表文件: 每行 [方法] 路径 [请求体]，方法省略为GET，#开头的行忽略
+static bool load_requests(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        return false;
+    }
+    char line[8192];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char* p = line + strspn(line, " \t");
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        request_spec spec;
+        spec.method = "GET";
+        if (*p != '/') {
+            size_t n    = strcspn(p, " \t");
+            spec.method = std::string(p, n);
+            p += n;
+            p += strspn(p, " \t");
+        }
+        size_t n  = strcspn(p, " \t");
+        spec.path = std::string(p, n);
+        p += n;
+        p += strspn(p, " \t");
+        spec.body = p;
+        if (spec.path.empty()) {
+            continue;
+        }
+        g_opt.requests.push_back(spec);
+    }
+    fclose(f);
+    return !g_opt.requests.empty();
+}
+
+// 大量空闲连接需要的文件描述符比默认的软限制多
+static void raise_fd_limit(int need)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)need) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)need ? rl.rlim_max : need;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static bool parse_url(const char* url)
+{
+    const char* p = url;
+    if (strncmp(p, "http://", 7) == 0) {
+        p += 7;
+    }
+    const char* slash = strchr(p, '/');
+    std::string hostport = slash ? std::string(p, slash - p) : std::string(p);
+    g_opt.path           = slash ? slash : "/";
+    size_t colon         = hostport.rfind(':');
+    if (colon != std::string::npos) {
+        g_opt.port = atoi(hostport.c_str() + colon + 1);
+        hostport.resize(colon);
+    }
+    g_opt.host = hostport;
+
+    addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(g_opt.host.c_str(), nullptr, &hints, &res) != 0 || !res) {
+        return false;
+    }
+    g_opt.addr          = *(sockaddr_in*)res->ai_addr;
+    g_opt.addr.sin_port = htons(g_opt.port);
+    freeaddrinfo(res);
+    return true;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(
+        stderr,
+        "usage: %s [options] http://host:port/path\n"
+        "  -c  连接数，默认10\n"
+        "  -t  线程数，默认2\n"
+        "  -d  持续秒数，默认10\n"
+        "  -p  每个连接流水线的请求数，默认1\n"
+        "  -r  开环模式的总请求速率(每秒)，默认0为闭环\n"
+        "  -K  不用长连接，每个请求新建连接\n"
+        "  -m  请求方法，默认GET，有请求体时为POST\n"
+        "  -b  请求体，{seq}替换为递增序号，如 'user=u{seq}&password=p'\n"
+        "  -T  连接上没有进展的超时毫秒数，默认2000\n"
+        "  -f  请求列表文件，每行 [方法] 路径 [请求体]，代替URL里的路径\n"
+        "  -i  开始之前建立的空闲长连接数，默认0\n"
+        "  -I  等空闲连接建立的最长秒数，默认60\n"
+        "  -R  空闲连接建好、开始压测时创建这个文件\n"
+        "  -o  JSON结果写到文件，默认标准输出\n",
+        prog);
+}
+
+int main(int argc, char* argv[])
+{
+    int  opt;
+    bool method_set = false;
+    while ((opt = getopt(argc, argv, "c:t:d:p:r:Km:b:T:f:i:I:R:o:h")) != -1) {
+        switch (opt) {
+            case 'c': g_opt.connections = atoi(optarg); break;
+            case 't': g_opt.threads = atoi(optarg); break;
+            case 'd': g_opt.duration = atoi(optarg); break;
+            case 'p': g_opt.depth = atoi(optarg); break;
+            case 'r': g_opt.rate = atof(optarg); break;
+            case 'K': g_opt.keepalive = false; break;
+            case 'm':
+                g_opt.method = optarg;
+                method_set   = true;
+                break;
+            case 'b': g_opt.body = optarg; break;
+            case 'T': g_opt.timeout_ms = atoi(optarg); break;
+            case 'f': g_opt.list_path = optarg; break;
+            case 'i': g_opt.idle = atoi(optarg); break;
+            case 'I': g_opt.idle_wait = atoi(optarg); break;
+            case 'R': g_opt.ready_path = optarg; break;
+            case 'o': g_opt.json_path = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1 || g_opt.connections <= 0 || g_opt.threads <= 0 ||
+        g_opt.duration <= 0 || g_opt.depth <= 0 || g_opt.idle < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!g_opt.body.empty() && !method_set) {
+        g_opt.method = "POST";
+    }
+    if (g_opt.threads > g_opt.connections) {
+        g_opt.threads = g_opt.connections;
+    }
+    if (!parse_url(argv[optind])) {
+        fprintf(stderr, "cannot resolve %s\n", argv[optind]);
+        return 1;
+    }
+    if (g_opt.list_path) {
+        if (!load_requests(g_opt.list_path)) {
+            fprintf(stderr, "cannot load requests from %s\n", g_opt.list_path);
+            return 1;
+        }
+    }
+    else {
+        request_spec spec = {g_opt.method, g_opt.path, g_opt.body};
+        g_opt.requests.push_back(spec);
+    }
+    raise_fd_limit(g_opt.connections + g_opt.idle + 64);
+
+    std::vector<worker*>   workers;
+    std::vector<pthread_t> tids(g_opt.threads);
+    for (int i = 0; i < g_opt.threads; ++i) {
+        int n = g_opt.connections / g_opt.threads +
+                (i < g_opt.connections % g_opt.threads ? 1 : 0);
+        int idle = g_opt.idle / g_opt.threads +
+                   (i < g_opt.idle % g_opt.threads ? 1 : 0);
+        workers.push_back(new worker(i, n, idle));
+    }
+    pthread_barrier_init(&g_ready, nullptr, g_opt.threads);
+    for (int i = 0; i < g_opt.threads; ++i) {
+        pthread_create(&tids[i], nullptr, worker::run, workers[i]);
+    }
+    thread_result total;
+    for (int i = 0; i < g_opt.threads; ++i) {
+        pthread_join(tids[i], nullptr);
+        const thread_result& r = workers[i]->result();
+        if (i == 0 || r.start_ns < total.start_ns) {
+            total.start_ns = r.start_ns;
+        }
+        if (r.end_ns > total.end_ns) {
+            total.end_ns = r.end_ns;
+        }
+        total.latency.merge(r.latency);
+        total.requests += r.requests;
+        total.bytes += r.bytes;
+        for (int s = 0; s < 6; ++s) {
+            total.status[s] += r.status[s];
+        }
+        total.connects += r.connects;
+        total.connect_errors += r.connect_errors;
+        total.io_errors += r.io_errors;
+        total.timeouts += r.timeouts;
+        total.dropped += r.dropped;
+        total.idle_ready += r.idle_ready;
+        total.idle_closed += r.idle_closed;
+        delete workers[i];
+    }
+    pthread_barrier_destroy(&g_ready);
+    // 只算压测阶段，不含建立空闲连接的时间
+    double seconds = (total.end_ns - total.start_ns) / 1e9;
+
+    FILE* out = g_opt.json_path ? fopen(g_opt.json_path, "w") : stdout;
+    if (!out) {
+        perror(g_opt.json_path);
+        return 1;
+    }
+    fprintf(
+        out,
+        "{\"url\":\"http://%s:%d%s\",\"method\":\"%s\",\"threads\":%d,"
+        "\"connections\":%d,\"pipeline\":%d,\"keepalive\":%s,"
+        "\"mode\":\"%s\",\"target_rate\":%.1f,\"duration_s\":%.3f,\n"
+        " \"requests\":%ld,\"requests_per_s\":%.1f,\"bytes\":%ld,"
+        "\"bytes_per_s\":%.1f,\"connects\":%ld,\n"
+        " \"status\":{\"1xx\":%ld,\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,"
+        "\"5xx\":%ld,\"other\":%ld},\n"
+        " \"errors\":{\"connect\":%ld,\"io\":%ld,\"timeout\":%ld,"
+        "\"not_sent\":%ld},\n"
+        " \"idle\":{\"connections\":%d,\"established\":%ld,\"closed\":%ld},\n"
+        " \"latency_us\":{\"min\":%llu,\"mean\":%.1f,\"p50\":%llu,"
+        "\"p90\":%llu,\"p99\":%llu,\"p99.9\":%llu,\"max\":%llu}}\n",
+        g_opt.host.c_str(), g_opt.port, g_opt.path.c_str(),
+        g_opt.method.c_str(), g_opt.threads, g_opt.connections, g_opt.depth,
+        g_opt.keepalive ? "true" : "false",
+        g_opt.rate > 0 ? "open" : "closed", g_opt.rate, seconds,
+        total.requests, total.requests / seconds, total.bytes,
+        total.bytes / seconds, total.connects, total.status[1],
+        total.status[2], total.status[3], total.status[4], total.status[5],
+        total.status[0], total.connect_errors, total.io_errors,
+        total.timeouts, total.dropped, g_opt.idle, total.idle_ready,
+        total.idle_closed,
+        (unsigned long long)total.latency.min(), total.latency.mean(),
+        (unsigned long long)total.latency.percentile(0.5),
+        (unsigned long long)total.latency.percentile(0.9),
+        (unsigned long long)total.latency.percentile(0.99),
+        (unsigned long long)total.latency.percentile(0.999),
+        (unsigned long long)total.latency.max());
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
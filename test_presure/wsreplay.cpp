@@ -0,0 +1,689 @@
+// wsreplay: 重放服务器用 -C 抓取的流量
+//
+// - 抓取文件里的每个连接在重放时也用一个连接，连接上的请求按顺序发送，
+//   收到完整的响应之后才发下一个
+// - 每个请求按抓取时的时间点发出，-s 调整速度: 2为两倍速，0为不等待，
+//   前一个响应回来就发下一个。服务器变慢时请求会比计划晚发，晚了多少单独统计
+// - -n 把整个抓取文件同时重放多份，每份用自己的连接，成倍放大负载
+// - 延迟从请求发出到响应收完，按请求类别分别统计: GET/HEAD的静态文件按扩展名
+//   归类，比如"GET *.html"，其他请求按方法和路径，比如"POST /2CGISQL.cgi"
+// - 结果为一个JSON对象
+//
+// 用法: wsreplay [选项] capture_file http://host:port
+#include "capture.h"
+#include "http_client.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+struct options {
+    const char* capture    = nullptr;
+    const char* json_path  = nullptr;
+    sockaddr_in addr;
+    double      speed      = 1;
+    int         copies     = 1;
+    int         threads    = 2;
+    int         timeout_ms = 5000;  // 等响应超过这么久就放弃这个请求
+};
+
+// 抓取文件里切分出来的一个请求
+struct replay_request {
+    int64_t     offset_us;  // 第一个字节被读到的时间
+    std::string data;
+    int         cls;  // 在g_classes里的下标
+};
+
+struct replay_conn_trace {
+    std::vector<replay_request> requests;
+};
+
+static options                        g_opt;
+static std::vector<replay_conn_trace> g_traces;
+static std::vector<std::string>       g_classes;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// 一个类别的结果
+struct class_result {
+    latency_hist latency;
+    long         status[6] = {0};  // 按状态码的百位
+};
+
+struct thread_result {
+    std::vector<class_result> classes;
+    latency_hist              lag;  // 比计划晚发出的时间
+    long                      requests       = 0;
+    long                      bytes          = 0;
+    long                      connects       = 0;
+    long                      connect_errors = 0;
+    long                      io_errors      = 0;
+    long                      timeouts       = 0;
+};
+
+struct connection {
+    int                           index = 0;
+    int                           fd    = -1;
+    const replay_conn_trace*      trace = nullptr;
+    size_t                        next  = 0;  // 下一个要发的请求
+    bool                          connecting = false;
+    bool                          inflight   = false;
+    bool                          want_out   = false;
+    std::string                   out;
+    size_t                        out_off = 0;
+    int64_t                       sent_ns = 0;
+    int64_t                       last_active = 0;
+    response_parser               parser;
+};
+
+class worker {
+public:
+    explicit worker(int id) : m_id(id) {}
+
+    void add(const replay_conn_trace* t)
+    {
+        connection c;
+        c.index = m_conns.size();
+        c.trace = t;
+        m_conns.push_back(c);
+    }
+    static void* run(void* arg)
+    {
+        ((worker*)arg)->loop();
+        return nullptr;
+    }
+    const thread_result& result() const
+    {
+        return m_result;
+    }
+
+private:
+    void    loop();
+    bool    open(connection& c);
+    void    close(connection& c);
+    void    update_events(connection& c);
+    void    send_next(connection& c, int64_t now);
+    bool    flush(connection& c);
+    void    receive(connection& c);
+    void    finish_request(connection& c, bool ok);
+    int64_t due(const connection& c) const;
+    void    poll(int timeout_ms);
+
+    int                     m_id;
+    int                     m_epfd  = -1;
+    int64_t                 m_start = 0;
+    int                     m_done  = 0;  // 请求都发完了的连接数
+    std::vector<connection> m_conns;
+    thread_result           m_result;
+};
+
+static uint64_t event_data(const connection& c)
+{
+    return (uint64_t)c.index << 32 | (uint32_t)c.fd;
+}
+
+// 连接上下一个请求计划发出的时间
+int64_t worker::due(const connection& c) const
+{
+    if (g_opt.speed <= 0) {
+        return m_start;
+    }
+    return m_start +
+           (int64_t)(c.trace->requests[c.next].offset_us * 1000 / g_opt.speed);
+}
+
+bool worker::open(connection& c)
+{
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.fd < 0) {
+        ++m_result.connect_errors;
+        return false;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ++m_result.connects;
+    if (connect(c.fd, (sockaddr*)&g_opt.addr, sizeof(g_opt.addr)) < 0 &&
+        errno != EINPROGRESS) {
+        ++m_result.connect_errors;
+        ::close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    c.connecting = true;
+    c.want_out   = true;
+    epoll_event ev;
+    ev.events   = EPOLLIN | EPOLLOUT;
+    ev.data.u64 = event_data(c);
+    epoll_ctl(m_epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+void worker::close(connection& c)
+{
+    if (c.fd >= 0) {
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+        ::close(c.fd);
+        c.fd = -1;
+    }
+    c.connecting = false;
+    c.out.clear();
+    c.out_off = 0;
+    c.parser.reset();
+}
+
+void worker::update_events(connection& c)
+{
+    bool want = c.connecting || c.out_off < c.out.size();
+    if (want == c.want_out || c.fd < 0) {
+        return;
+    }
+    c.want_out = want;
+    uint32_t events = EPOLLIN;
+    if (want) {
+        events |= EPOLLOUT;
+    }
+    epoll_event ev;
+    ev.events   = events;
+    ev.data.u64 = event_data(c);
+    epoll_ctl(m_epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+// 发出连接上的下一个请求，服务器已经关闭的连接先重连
+void worker::send_next(connection& c, int64_t now)
+{
+    if (c.fd < 0 && !open(c)) {
+        finish_request(c, false);
+        return;
+    }
+    const replay_request& r = c.trace->requests[c.next];
+    c.out                   = r.data;
+    c.out_off               = 0;
+    c.inflight              = true;
+    c.sent_ns               = now;
+    c.last_active           = now;
+    if (g_opt.speed > 0) {
+        m_result.lag.record((now - due(c)) / 1000);
+    }
+    if (!c.connecting && !flush(c)) {
+        ++m_result.io_errors;
+        close(c);
+        finish_request(c, false);
+    }
+}
+
+bool worker::flush(connection& c)
+{
+    while (c.out_off < c.out.size()) {
+        ssize_t n = send(
+            c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off,
+            MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                break;
+            }
+            return false;
+        }
+        c.out_off += n;
+    }
+    update_events(c);
+    return true;
+}
+
+// 一个请求结束，ok为收到了完整的响应
+void worker::finish_request(connection& c, bool ok)
+{
+    if (ok) {
+        class_result& cr = m_result.classes[c.trace->requests[c.next].cls];
+        cr.latency.record((now_ns() - c.sent_ns) / 1000);
+        ++cr.status[c.parser.status() / 100 % 6];
+        ++m_result.requests;
+    }
+    c.inflight = false;
+    if (++c.next == c.trace->requests.size()) {
+        close(c);
+        ++m_done;
+    }
+}
+
+void worker::receive(connection& c)
+{
+    char buf[65536];
+    while (c.fd >= 0) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                return;
+            }
+            ++m_result.io_errors;
+            close(c);
+            if (c.inflight) {
+                finish_request(c, false);
+            }
+            return;
+        }
+        if (n == 0) {
+            // 没有长度的响应以关闭连接结束，其他情况下在途的请求算失败
+            bool ok = c.inflight && c.parser.finish_eof();
+            if (c.inflight && !ok) {
+                ++m_result.io_errors;
+            }
+            if (c.inflight) {
+                finish_request(c, ok);
+            }
+            close(c);
+            return;
+        }
+        c.last_active = now_ns();
+        m_result.bytes += n;
+        size_t                  used = 0;
+        response_parser::RESULT r    = c.parser.feed(buf, n, &used);
+        if (r == response_parser::BAD || !c.inflight) {
+            ++m_result.io_errors;
+            close(c);
+            if (c.inflight) {
+                finish_request(c, false);
+            }
+            return;
+        }
+        if (r == response_parser::DONE) {
+            bool closing = c.parser.closing();
+            finish_request(c, true);
+            c.parser.reset();
+            if (closing) {
+                close(c);
+            }
+        }
+    }
+}
+
+void worker::poll(int timeout_ms)
+{
+    epoll_event events[256];
+    int         n = epoll_wait(m_epfd, events, 256, timeout_ms);
+    for (int i = 0; i < n; ++i) {
+        uint64_t    data = events[i].data.u64;
+        connection& c    = m_conns[data >> 32];
+        if (c.fd < 0 || (uint32_t)c.fd != (uint32_t)data) {
+            continue;
+        }
+        if (c.connecting && (events[i].events & (EPOLLOUT | EPOLLERR))) {
+            int       err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) {
+                ++m_result.connect_errors;
+                close(c);
+                if (c.inflight) {
+                    finish_request(c, false);
+                }
+                continue;
+            }
+            c.connecting = false;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+            receive(c);
+            if (c.fd < 0) {
+                continue;
+            }
+        }
+        if (!c.connecting && !flush(c)) {
+            ++m_result.io_errors;
+            close(c);
+            if (c.inflight) {
+                finish_request(c, false);
+            }
+        }
+    }
+}
+
+void worker::loop()
+{
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    m_result.classes.resize(g_classes.size());
+    m_start           = now_ns();
+    int64_t limit     = (int64_t)g_opt.timeout_ms * 1000000;
+    while (m_done < (int)m_conns.size()) {
+        int64_t now  = now_ns();
+        int64_t wake = now + 100000000;
+        for (size_t i = 0; i < m_conns.size(); ++i) {
+            connection& c = m_conns[i];
+            if (c.next == c.trace->requests.size()) {
+                continue;
+            }
+            if (c.inflight) {
+                if (now - c.last_active > limit) {
+                    ++m_result.timeouts;
+                    close(c);
+                    finish_request(c, false);
+                }
+                continue;
+            }
+            int64_t t = due(c);
+            if (t <= now) {
+                send_next(c, now);
+            }
+            else if (t < wake) {
+                wake = t;
+            }
+        }
+        int timeout = (int)((wake - now + 999999) / 1000000);
+        poll(timeout > 100 ? 100 : timeout);
+    }
+    ::close(m_epfd);
+}
+
+// 请求类别，见文件开头
+static int classify(const std::string& req)
+{
+    size_t      sp1    = req.find(' ');
+    size_t      sp2    = req.find(' ', sp1 + 1);
+    std::string method = req.substr(0, sp1);
+    std::string path   = sp1 == std::string::npos
+                             ? std::string()
+                             : req.substr(sp1 + 1, sp2 - sp1 - 1);
+    path               = path.substr(0, path.find('?'));
+    std::string name   = method + " " + path;
+    size_t      slash  = path.rfind('/');
+    size_t      dot    = path.rfind('.');
+    if ((method == "GET" || method == "HEAD") && dot != std::string::npos &&
+        (slash == std::string::npos || dot > slash)) {
+        name = method + " *" + path.substr(dot);
+    }
+    for (size_t i = 0; i < g_classes.size(); ++i) {
+        if (g_classes[i] == name) {
+            return i;
+        }
+    }
+    g_classes.push_back(name);
+    return g_classes.size() - 1;
+}
+
+// 一个连接读到的字节流和每段数据的时间
+struct capture_stream {
+    std::string          data;
+    std::vector<size_t>  chunk_start;
+    std::vector<int64_t> chunk_us;
+};
+
+// 按头部结束的空行和Content-Length切分请求，每个请求的时间为
+// 它第一个字节所在的那段数据的时间。HTTP/2连接和最后不完整的请求丢掉
+static void split_requests(const capture_stream& s, replay_conn_trace& t)
+{
+    static const char H2_PREFACE[] = "PRI * HTTP/2.0";
+    if (s.data.compare(0, sizeof(H2_PREFACE) - 1, H2_PREFACE) == 0) {
+        return;
+    }
+    size_t pos   = 0;
+    size_t chunk = 0;
+    while (pos < s.data.size()) {
+        if (s.data[pos] == '\r' || s.data[pos] == '\n') {
+            ++pos;
+            continue;
+        }
+        size_t end = s.data.find("\r\n\r\n", pos);
+        if (end == std::string::npos) {
+            return;
+        }
+        end += 4;
+        std::string head = s.data.substr(pos, end - pos);
+        for (size_t i = 0; i < head.size(); ++i) {
+            head[i] = tolower((unsigned char)head[i]);
+        }
+        size_t body = 0;
+        size_t cl   = head.find("\r\ncontent-length:");
+        if (cl != std::string::npos) {
+            body = strtoul(head.c_str() + cl + 17, NULL, 10);
+        }
+        if (end + body > s.data.size()) {
+            return;
+        }
+        while (chunk + 1 < s.chunk_start.size() &&
+               s.chunk_start[chunk + 1] <= pos) {
+            ++chunk;
+        }
+        replay_request r;
+        r.offset_us = s.chunk_us[chunk];
+        r.data      = s.data.substr(pos, end + body - pos);
+        r.cls       = classify(r.data);
+        t.requests.push_back(r);
+        pos = end + body;
+    }
+}
+
+static bool load_capture(const char* path, long* skipped)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    capture_file_header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 ||
+        memcmp(h.magic, CAPTURE_MAGIC, sizeof(h.magic)) != 0) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        fclose(f);
+        return false;
+    }
+    std::map<uint32_t, capture_stream> streams;
+    capture_record                     r;
+    std::vector<char>                  buf;
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        buf.resize(r.len);
+        if (r.len && fread(buf.data(), 1, r.len, f) != r.len) {
+            break;  // 服务器异常退出时最后一条记录可能不完整
+        }
+        capture_stream& s = streams[r.conn];
+        s.chunk_start.push_back(s.data.size());
+        s.chunk_us.push_back(r.offset_us);
+        s.data.append(buf.data(), r.len);
+    }
+    fclose(f);
+
+    // 按连接的第一个请求的时间排序，连接号就是建立的顺序
+    for (std::map<uint32_t, capture_stream>::iterator it = streams.begin();
+         it != streams.end(); ++it) {
+        replay_conn_trace t;
+        split_requests(it->second, t);
+        if (t.requests.empty()) {
+            ++*skipped;
+            continue;
+        }
+        g_traces.push_back(t);
+    }
+    return true;
+}
+
+static void raise_fd_limit(int need)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)need) {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)need ? rl.rlim_max : need;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static bool parse_url(const char* url)
+{
+    const char* p = url;
+    if (strncmp(p, "http://", 7) == 0) {
+        p += 7;
+    }
+    std::string hostport(p, strcspn(p, "/"));
+    int         port  = 80;
+    size_t      colon = hostport.rfind(':');
+    if (colon != std::string::npos) {
+        port = atoi(hostport.c_str() + colon + 1);
+        hostport.resize(colon);
+    }
+    addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(hostport.c_str(), nullptr, &hints, &res) != 0 || !res) {
+        return false;
+    }
+    g_opt.addr          = *(sockaddr_in*)res->ai_addr;
+    g_opt.addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    return true;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(
+        stderr,
+        "usage: %s [options] capture_file http://host:port\n"
+        "  -s  重放速度，1为原来的时间间隔，2为两倍速，0为不等待，默认1\n"
+        "  -n  同时重放几份，默认1\n"
+        "  -t  线程数，默认2\n"
+        "  -T  等响应的超时毫秒数，默认5000\n"
+        "  -o  JSON结果写到文件，默认标准输出\n",
+        prog);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:t:T:o:h")) != -1) {
+        switch (opt) {
+            case 's': g_opt.speed = atof(optarg); break;
+            case 'n': g_opt.copies = atoi(optarg); break;
+            case 't': g_opt.threads = atoi(optarg); break;
+            case 'T': g_opt.timeout_ms = atoi(optarg); break;
+            case 'o': g_opt.json_path = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 2 || g_opt.copies <= 0 || g_opt.threads <= 0 ||
+        g_opt.speed < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    g_opt.capture = argv[optind];
+    if (!parse_url(argv[optind + 1])) {
+        fprintf(stderr, "cannot resolve %s\n", argv[optind + 1]);
+        return 1;
+    }
+    long skipped = 0;
+    if (!load_capture(g_opt.capture, &skipped)) {
+        return 1;
+    }
+    if (g_traces.empty()) {
+        fprintf(stderr, "no HTTP/1 requests in %s\n", g_opt.capture);
+        return 1;
+    }
+
+    // 连接轮流分给各个线程，每份用自己的连接
+    long conns = (long)g_traces.size() * g_opt.copies;
+    if (g_opt.threads > conns) {
+        g_opt.threads = conns;
+    }
+    raise_fd_limit(conns + 64);
+    std::vector<worker*> workers;
+    for (int i = 0; i < g_opt.threads; ++i) {
+        workers.push_back(new worker(i));
+    }
+    for (long i = 0; i < conns; ++i) {
+        workers[i % g_opt.threads]->add(&g_traces[i % g_traces.size()]);
+    }
+
+    int64_t                start = now_ns();
+    std::vector<pthread_t> tids(g_opt.threads);
+    for (int i = 0; i < g_opt.threads; ++i) {
+        pthread_create(&tids[i], nullptr, worker::run, workers[i]);
+    }
+    thread_result total;
+    total.classes.resize(g_classes.size());
+    for (int i = 0; i < g_opt.threads; ++i) {
+        pthread_join(tids[i], nullptr);
+        const thread_result& r = workers[i]->result();
+        for (size_t k = 0; k < g_classes.size(); ++k) {
+            total.classes[k].latency.merge(r.classes[k].latency);
+            for (int s = 0; s < 6; ++s) {
+                total.classes[k].status[s] += r.classes[k].status[s];
+            }
+        }
+        total.lag.merge(r.lag);
+        total.requests += r.requests;
+        total.bytes += r.bytes;
+        total.connects += r.connects;
+        total.connect_errors += r.connect_errors;
+        total.io_errors += r.io_errors;
+        total.timeouts += r.timeouts;
+        delete workers[i];
+    }
+    double duration = (now_ns() - start) / 1e9;
+
+    FILE* out = stdout;
+    if (g_opt.json_path) {
+        out = fopen(g_opt.json_path, "w");
+        if (!out) {
+            perror(g_opt.json_path);
+            return 1;
+        }
+    }
+    fprintf(
+        out,
+        "{\"connections\":%ld,\"skipped_connections\":%ld,\"speed\":%g,"
+        "\"copies\":%d,\"duration_s\":%.3f,\"requests\":%ld,"
+        "\"requests_per_s\":%.1f,\"bytes\":%ld,\"connects\":%ld,"
+        "\"connect_errors\":%ld,\"io_errors\":%ld,\"timeouts\":%ld,"
+        "\"lag_us\":{\"p50\":%llu,\"p99\":%llu,\"max\":%llu},\"classes\":[",
+        conns, skipped, g_opt.speed, g_opt.copies, duration, total.requests,
+        duration > 0 ? total.requests / duration : 0.0, total.bytes,
+        total.connects, total.connect_errors, total.io_errors, total.timeouts,
+        (unsigned long long)total.lag.percentile(0.5),
+        (unsigned long long)total.lag.percentile(0.99),
+        (unsigned long long)total.lag.max());
+    for (size_t k = 0; k < g_classes.size(); ++k) {
+        const class_result& c = total.classes[k];
+        long                n = 0;
+        for (int s = 0; s < 6; ++s) {
+            n += c.status[s];
+        }
+        // 类别名来自请求行，转义引号和反斜杠
+        std::string name;
+        for (size_t i = 0; i < g_classes[k].size(); ++i) {
+            char ch = g_classes[k][i];
+            if (ch == '"' || ch == '\\') {
+                name += '\\';
+            }
+            name += (unsigned char)ch < 0x20 ? '?' : ch;
+        }
+        fprintf(
+            out,
+            "%s{\"class\":\"%s\",\"requests\":%ld,\"mean_us\":%.1f,"
+            "\"p50_us\":%llu,\"p90_us\":%llu,\"p99_us\":%llu,\"max_us\":%llu,"
+            "\"status\":{\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,\"5xx\":%ld}}",
+            k ? "," : "", name.c_str(), n, c.latency.mean(),
+            (unsigned long long)c.latency.percentile(0.5),
+            (unsigned long long)c.latency.percentile(0.9),
+            (unsigned long long)c.latency.percentile(0.99),
+            (unsigned long long)c.latency.max(), c.status[2], c.status[3],
+            c.status[4], c.status[5]);
+    }
+    fprintf(out, "]}\n");
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+// 单元测试共用的检查宏: 失败时打印位置继续往下跑，
+// main最后用TEST_RESULT()返回，有失败时退出码为1，由ctest运行
+
+static int g_test_checks   = 0;
+static int g_test_failures = 0;
+
+#define CHECK(cond)                                                       \
+    do {                                                                  \
+        ++g_test_checks;                                                  \
+        if (!(cond)) {                                                    \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,        \
+                    __LINE__, #cond);                                     \
+            ++g_test_failures;                                            \
+        }                                                                 \
+    } while (0)
+
+#define TEST_RESULT()                                                     \
+    (printf("%d checks, %d failed\n", g_test_checks, g_test_failures),    \
+     g_test_failures ? 1 : 0)
+
+#endif
@@ -0,0 +1,57 @@
+#include "gzip_static.h"
+#include "test.h"
+
+// Accept-Encoding的解析，见gzip_static.cpp的accept_gzip
+
+int main()
+{
+    // 列出了gzip
+    CHECK(accept_gzip("gzip"));
+    CHECK(accept_gzip("GZIP"));
+    CHECK(accept_gzip("gzip, deflate, br"));
+    CHECK(accept_gzip("deflate, gzip"));
+    CHECK(accept_gzip("br,gzip"));
+    CHECK(accept_gzip("  gzip  "));
+
+    // q值按数字解析
+    CHECK(accept_gzip("gzip;q=0.5"));
+    CHECK(accept_gzip("gzip;q=1"));
+    CHECK(accept_gzip("gzip;q=1.000"));
+    CHECK(accept_gzip("gzip;q=0.001"));
+    CHECK(accept_gzip("gzip ; q=0.8, br"));
+    CHECK(accept_gzip("gzip;Q=0.5"));
+    CHECK(!accept_gzip("gzip;q=0"));
+    CHECK(!accept_gzip("gzip; q=0"));
+    CHECK(!accept_gzip("gzip;q=0.000"));
+    CHECK(!accept_gzip("gzip;q=0.0"));
+    CHECK(!accept_gzip("gzip ;q = 0"));
+    CHECK(!accept_gzip("br, gzip;q=0, deflate"));
+
+    // q值格式不对的按0处理
+    CHECK(!accept_gzip("gzip;q=2"));
+    CHECK(!accept_gzip("gzip;q=1.5"));
+    CHECK(!accept_gzip("gzip;q=0.5000"));
+    CHECK(!accept_gzip("gzip;q=abc"));
+    CHECK(!accept_gzip("gzip;q="));
+
+    // 其他参数不影响
+    CHECK(accept_gzip("gzip;level=1"));
+    CHECK(!accept_gzip("gzip;level=1;q=0"));
+
+    // 编码名要精确匹配
+    CHECK(!accept_gzip("x-gzip"));
+    CHECK(!accept_gzip("gzipx"));
+    CHECK(!accept_gzip("deflate;gzip"));
+    CHECK(!accept_gzip("identity"));
+    CHECK(!accept_gzip(""));
+    CHECK(!accept_gzip(" , ,"));
+
+    // 没有列出gzip时看 *
+    CHECK(accept_gzip("*"));
+    CHECK(accept_gzip("br, *;q=0.1"));
+    CHECK(!accept_gzip("*;q=0"));
+    CHECK(!accept_gzip("gzip;q=0, *"));
+    CHECK(accept_gzip("*;q=0, gzip"));
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,207 @@
+#include "h2_session.h"
+#include "log.h"
+#include "test.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// HTTP/2会话对错误帧的处理: 长度不对的帧、idle流上的帧。
+// 这些帧都不会走到http_conn，会话的连接传空指针，
+// 输出经过socketpair读回来按帧解析
+
+struct frame {
+    uint8_t     type;
+    uint8_t     flags;
+    uint32_t    stream_id;
+    std::string payload;
+};
+
+static uint32_t get_u32(const char* p)
+{
+    const uint8_t* u = (const uint8_t*)p;
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+           ((uint32_t)u[2] << 8) | u[3];
+}
+
+static std::string make_frame(
+    uint8_t     type,
+    uint8_t     flags,
+    uint32_t    stream_id,
+    const char* payload,
+    uint32_t    len)
+{
+    std::string out;
+    out += (char)(len >> 16);
+    out += (char)(len >> 8);
+    out += (char)len;
+    out += (char)type;
+    out += (char)flags;
+    out += (char)(stream_id >> 24);
+    out += (char)(stream_id >> 16);
+    out += (char)(stream_id >> 8);
+    out += (char)stream_id;
+    out.append(payload, len);
+    return out;
+}
+
+// 客户端的连接前言加上一个空的SETTINGS帧
+static std::string preface()
+{
+    return std::string(h2_session::PREFACE, h2_session::PREFACE_LEN) +
+           make_frame(4, 0, 0, "", 0);
+}
+
+// 把input交给一个新会话处理，返回process()的结果，发出的帧放进frames
+static bool run(const std::string& input, std::vector<frame>& frames)
+{
+    int sv[2];
+    frames.clear();
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        return false;
+    }
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    bool ok;
+    {
+        h2_session session(nullptr, sv[0]);
+        session.feed(input.data(), input.size());
+        ok = session.process();
+        if (ok) {
+            session.send_to(sv[0]);
+        }
+    }
+    std::string out;
+    char        buf[4096];
+    int         n;
+    while ((n = recv(sv[1], buf, sizeof(buf), 0)) > 0) {
+        out.append(buf, n);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    size_t pos = 0;
+    while (out.size() - pos >= 9) {
+        const char* p   = out.data() + pos;
+        uint32_t    len = ((uint8_t)p[0] << 16) | ((uint8_t)p[1] << 8) |
+                       (uint8_t)p[2];
+        frame f;
+        f.type      = p[3];
+        f.flags     = p[4];
+        f.stream_id = get_u32(p + 5) & 0x7fffffff;
+        f.payload.assign(p + 9, len);
+        frames.push_back(f);
+        pos += 9 + len;
+    }
+    return ok;
+}
+
+// 找到type类型的帧返回其错误码，GOAWAY的错误码在负载第4字节起，
+// RST_STREAM的在开头，没有返回-1
+static long error_of(const std::vector<frame>& frames, uint8_t type)
+{
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type != type) {
+            continue;
+        }
+        if (type == 7 && frames[i].payload.size() >= 8) {
+            return get_u32(frames[i].payload.data() + 4);
+        }
+        if (type == 3 && frames[i].payload.size() >= 4) {
+            return get_u32(frames[i].payload.data());
+        }
+    }
+    return -1;
+}
+
+static const uint8_t DATA = 0, HEADERS = 1, PRIORITY = 2, RST_STREAM = 3,
+                     SETTINGS = 4, PING = 6, GOAWAY = 7, WINDOW_UPDATE = 8;
+static const long PROTOCOL_ERROR = 1, FLOW_CONTROL_ERROR = 3,
+                  FRAME_SIZE_ERROR = 6;
+
+static void test_frame_lengths()
+{
+    std::vector<frame> f;
+    const char         zeros[16] = {0};
+
+    // 帧头里的长度16385超过默认最大帧长度16384
+    std::string huge = preface();
+    huge += std::string("\x00\x40\x01\x06\x00\x00\x00\x00\x00", 9);
+    CHECK(!run(huge, f) && error_of(f, GOAWAY) == FRAME_SIZE_ERROR);
+
+    CHECK(!run(preface() + make_frame(PING, 0, 0, zeros, 7), f) &&
+          error_of(f, GOAWAY) == FRAME_SIZE_ERROR);
+    CHECK(!run(preface() + make_frame(RST_STREAM, 0, 1, zeros, 3), f) &&
+          error_of(f, GOAWAY) == FRAME_SIZE_ERROR);
+    CHECK(!run(preface() + make_frame(WINDOW_UPDATE, 0, 0, "\0\0\0", 3), f) &&
+          error_of(f, GOAWAY) == FRAME_SIZE_ERROR);
+    CHECK(!run(preface() + make_frame(SETTINGS, 0, 0, zeros, 5), f) &&
+          error_of(f, GOAWAY) == FRAME_SIZE_ERROR);
+    CHECK(!run(preface() + make_frame(SETTINGS, 1, 0, zeros, 6), f) &&
+          error_of(f, GOAWAY) == FRAME_SIZE_ERROR);
+    CHECK(!run(preface() + make_frame(GOAWAY, 0, 0, zeros, 4), f) &&
+          error_of(f, GOAWAY) == FRAME_SIZE_ERROR);
+    // PRIORITY长度不对只是流错误
+    CHECK(run(preface() + make_frame(PRIORITY, 0, 1, zeros, 4), f) &&
+          error_of(f, RST_STREAM) == FRAME_SIZE_ERROR &&
+          error_of(f, GOAWAY) == -1);
+
+    // 帧还没收完，等待更多数据
+    std::string part = preface() + make_frame(PING, 0, 0, zeros, 8);
+    part.resize(part.size() - 3);
+    CHECK(run(part, f) && error_of(f, GOAWAY) == -1);
+
+    // 正常的PING原样回一个ACK
+    CHECK(run(preface() + make_frame(PING, 0, 0, "pingdata", 8), f));
+    bool acked = false;
+    for (size_t i = 0; i < f.size(); ++i) {
+        acked = acked || (f[i].type == PING && f[i].flags == 1 &&
+                          f[i].payload == "pingdata");
+    }
+    CHECK(acked);
+}
+
+static void test_idle_streams()
+{
+    std::vector<frame> f;
+    // idle流上的DATA是连接错误，不是RST_STREAM
+    CHECK(!run(preface() + make_frame(DATA, 0, 1, "abc", 3), f) &&
+          error_of(f, GOAWAY) == PROTOCOL_ERROR &&
+          error_of(f, RST_STREAM) == -1);
+    CHECK(!run(preface() + make_frame(DATA, 1, 5, "", 0), f) &&
+          error_of(f, GOAWAY) == PROTOCOL_ERROR);
+    CHECK(!run(preface() + make_frame(DATA, 0, 0, "abc", 3), f) &&
+          error_of(f, GOAWAY) == PROTOCOL_ERROR);
+    CHECK(!run(preface() + make_frame(RST_STREAM, 0, 3, "\0\0\0\x08", 4), f) &&
+          error_of(f, GOAWAY) == PROTOCOL_ERROR);
+    CHECK(!run(preface() + make_frame(WINDOW_UPDATE, 0, 3, "\0\0\0\x01", 4),
+               f) &&
+          error_of(f, GOAWAY) == PROTOCOL_ERROR);
+    // 服务端不接受偶数id的流
+    CHECK(!run(preface() + make_frame(HEADERS, 4, 2, "\x82", 1), f) &&
+          error_of(f, GOAWAY) == PROTOCOL_ERROR);
+}
+
+static void test_initial_window()
+{
+    std::vector<frame> f;
+    // 流1只有请求头，请求没有结束，不会生成响应
+    std::string open = preface() + make_frame(HEADERS, 4, 1, "\x82", 1);
+    // INITIAL_WINDOW_SIZE改成65536，已有的流窗口加1
+    std::string grow = make_frame(SETTINGS, 0, 0, "\0\x04\0\x01\0\0", 6);
+    CHECK(run(open + grow, f) && error_of(f, GOAWAY) == -1);
+    // 流1的窗口先加到2^31-1，再加1就溢出了
+    std::string full = make_frame(WINDOW_UPDATE, 0, 1, "\x7f\xff\0\0", 4);
+    CHECK(!run(open + full + grow, f) &&
+          error_of(f, GOAWAY) == FLOW_CONTROL_ERROR);
+    CHECK(run(open + full, f) && error_of(f, GOAWAY) == -1);
+}
+
+int main()
+{
+    // 会话的警告不需要写日志
+    Log::get_instance()->set_level(4);
+    test_frame_lengths();
+    test_idle_streams();
+    test_initial_window();
+    return TEST_RESULT();
+}
@@ -0,0 +1,176 @@
+#include "hpack.h"
+#include "test.h"
+#include <string.h>
+
+// HPACK解码器: 整数和字符串的边界情况、Huffman、动态表的插入和淘汰，
+// 例子取自RFC 7541附录C
+
+static bool decode(
+    hpack_decoder& d,
+    const char*    bytes,
+    size_t         len,
+    header_list&   headers)
+{
+    headers.clear();
+    return d.decode((const uint8_t*)bytes, len, headers);
+}
+
+static bool has(
+    const header_list& headers,
+    size_t             i,
+    const char*        name,
+    const char*        value)
+{
+    return i < headers.size() && headers[i].first == name &&
+           headers[i].second == value;
+}
+
+// 增量索引的字面量，名字和值都是不超过126字节的原始字符串
+static std::string literal_indexed(
+    const std::string& name,
+    const std::string& value)
+{
+    std::string out(1, '\x40');
+    out += (char)name.size();
+    out += name;
+    out += (char)value.size();
+    out += value;
+    return out;
+}
+
+static void test_integers()
+{
+    hpack_decoder d;
+    header_list   h;
+    // 7位前缀放得下的索引
+    CHECK(decode(d, "\x82", 1, h) && has(h, 0, ":method", "GET"));
+    // 4位前缀放不下，15 + 16 = 31 content-type
+    CHECK(decode(d, "\x0f\x10\x03" "abc", 6, h) &&
+          has(h, 0, "content-type", "abc"));
+    // 下标0和超出两张表的下标
+    CHECK(!decode(d, "\x80", 1, h));
+    CHECK(!decode(d, "\xbe", 1, h));
+    CHECK(!decode(d, "\xff\x00", 2, h));
+    // 多字节整数在中途结束
+    CHECK(!decode(d, "\xff", 1, h));
+    CHECK(!decode(d, "\xff\x80", 2, h));
+    // 延续字节太多，溢出
+    CHECK(!decode(d, "\xff\xff\xff\xff\xff\xff\x01", 7, h));
+}
+
+static void test_strings()
+{
+    hpack_decoder d;
+    header_list   h;
+    // 字面量长度超过剩余的数据
+    CHECK(!decode(d, "\x0f\x10\x05" "ab", 5, h));
+    CHECK(!decode(d, "\x00\x01" "a", 3, h));
+    // 长度本身就被截断
+    CHECK(!decode(d, "\x0f\x10", 2, h));
+    CHECK(!decode(d, "\x0f\x10\x7f", 3, h));
+    // 空字符串
+    CHECK(decode(d, "\x0f\x10\x00", 3, h) && has(h, 0, "content-type", ""));
+
+    // Huffman: 'a'是00011，用全1填充到一个字节
+    CHECK(decode(d, "\x0f\x10\x81\x1f", 4, h) &&
+          has(h, 0, "content-type", "a"));
+    // 填充不是全1
+    CHECK(!decode(d, "\x0f\x10\x81\x18", 4, h));
+    // 填充超过7位
+    CHECK(!decode(d, "\x0f\x10\x82\x1f\xff", 5, h));
+    // 字符串里出现EOS
+    CHECK(!decode(d, "\x0f\x10\x84\xff\xff\xff\xff", 7, h));
+    // Huffman数据被截断
+    CHECK(!decode(d, "\x0f\x10\x86\xf1\xe3", 5, h));
+}
+
+// RFC 7541 C.4: 同一个解码器上连续三个请求，使用Huffman和动态表
+static void test_rfc_requests()
+{
+    hpack_decoder d;
+    header_list   h;
+    const char    r1[] = "\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b"
+                         "\xa0\xab\x90\xf4\xff";
+    CHECK(decode(d, r1, sizeof(r1) - 1, h) && h.size() == 4);
+    CHECK(has(h, 0, ":method", "GET"));
+    CHECK(has(h, 1, ":scheme", "http"));
+    CHECK(has(h, 2, ":path", "/"));
+    CHECK(has(h, 3, ":authority", "www.example.com"));
+
+    const char r2[] = "\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf";
+    CHECK(decode(d, r2, sizeof(r2) - 1, h) && h.size() == 5);
+    CHECK(has(h, 3, ":authority", "www.example.com"));
+    CHECK(has(h, 4, "cache-control", "no-cache"));
+
+    const char r3[] = "\x82\x87\x85\xbf\x40\x88\x25\xa8\x49\xe9\x5b\xa9\x7d"
+                      "\x7f\x89\x25\xa8\x49\xe9\x5b\xb8\xe8\xb4\xbf";
+    CHECK(decode(d, r3, sizeof(r3) - 1, h) && h.size() == 5);
+    CHECK(has(h, 1, ":scheme", "https"));
+    CHECK(has(h, 2, ":path", "/index.html"));
+    CHECK(has(h, 3, ":authority", "www.example.com"));
+    CHECK(has(h, 4, "custom-key", "custom-value"));
+    // 动态表: 62 custom-key, 63 cache-control, 64 :authority
+    CHECK(decode(d, "\xbe\xbf\xc0", 3, h) && h.size() == 3);
+    CHECK(has(h, 0, "custom-key", "custom-value"));
+    CHECK(has(h, 1, "cache-control", "no-cache"));
+    CHECK(has(h, 2, ":authority", "www.example.com"));
+}
+
+static void test_eviction()
+{
+    // 每项4+4+32=40字节，上限100放得下两项
+    hpack_decoder d(100);
+    header_list   h;
+    std::string   block = literal_indexed("nam1", "val1") +
+                        literal_indexed("nam2", "val2") +
+                        literal_indexed("nam3", "val3");
+    CHECK(decode(d, block.data(), block.size(), h) && h.size() == 3);
+    CHECK(decode(d, "\xbe\xbf", 2, h));
+    CHECK(has(h, 0, "nam3", "val3"));
+    CHECK(has(h, 1, "nam2", "val2"));
+    // 最早的一项已经被淘汰
+    CHECK(!decode(d, "\xc0", 1, h));
+
+    // 缩小上限淘汰到放得下为止，缩到0清空
+    CHECK(decode(d, "\x3f\x0a\xbe", 3, h) && has(h, 0, "nam3", "val3"));
+    CHECK(!decode(d, "\xbf", 1, h));
+    CHECK(decode(d, "\x20", 1, h) && h.empty());
+    CHECK(!decode(d, "\xbe", 1, h));
+    // 不能超过构造时允许的上限100，101 = 31 + 70
+    CHECK(!decode(d, "\x3f\x46", 2, h));
+    CHECK(decode(d, "\x3f\x45", 2, h));
+
+    // 比整个表还大的项: 表被清空，头部照常输出
+    hpack_decoder small(40);
+    block = literal_indexed("nam1", "val1");
+    CHECK(decode(small, block.data(), block.size(), h));
+    block = literal_indexed("longer-name", "value");
+    CHECK(decode(small, block.data(), block.size(), h) &&
+          has(h, 0, "longer-name", "value"));
+    CHECK(!decode(small, "\xbe", 1, h));
+}
+
+static void test_encoder()
+{
+    hpack_decoder d;
+    header_list   h;
+    std::string   out;
+    hpack_encode_status(out, 404);
+    hpack_encode_status(out, 418);
+    hpack_encode_header(out, HPACK_CONTENT_LENGTH, "12", 2);
+    CHECK(decode(d, out.data(), out.size(), h) && h.size() == 3);
+    CHECK(has(h, 0, ":status", "404"));
+    CHECK(has(h, 1, ":status", "418"));
+    CHECK(has(h, 2, "content-length", "12"));
+    CHECK(out[0] == '\x8d');  // 404直接引用静态表
+}
+
+int main()
+{
+    test_integers();
+    test_strings();
+    test_rfc_requests();
+    test_eviction();
+    test_encoder();
+    return TEST_RESULT();
+}
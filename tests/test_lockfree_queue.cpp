@@ -0,0 +1,136 @@
+#include "lockfree_queue.h"
+#include "test.h"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+// 无锁队列的容量: 环形数组向上取整到2的幂，可入队的元素数仍是构造时的容量；
+// 多个生产者并发入队时一个消费者取出的元素不丢、不重，每个生产者内部有序
+
+static void test_capacity()
+{
+    lockfree_queue<int> q(3);
+    CHECK(q.max_size() == 3);
+    CHECK(q.empty());
+    CHECK(q.push(1));
+    CHECK(q.push(2));
+    CHECK(q.push(3));
+    CHECK(q.full());
+    CHECK(q.size() == 3);
+    // 数组有4个槽位，第4个也不能放
+    CHECK(!q.push(4));
+    CHECK(q.size() == 3);
+
+    int item = 0;
+    CHECK(q.try_pop(item) && item == 1);
+    CHECK(!q.full());
+    CHECK(q.push(4));
+    CHECK(!q.push(5));
+
+    // 绕过数组末尾之后顺序不变
+    std::vector<int> items;
+    CHECK(q.pop_all(items));
+    CHECK(items.size() == 3 && items[0] == 2 && items[1] == 3 &&
+          items[2] == 4);
+    CHECK(q.empty());
+
+    // 容量本身是2的幂时可以放满
+    lockfree_queue<int> p(4);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(p.push(i));
+    }
+    CHECK(!p.push(4));
+
+    // 超时等待，有元素时不等，队列为空返回false
+    items.clear();
+    CHECK(p.pop_all(items, 0) && items.size() == 4);
+    items.clear();
+    CHECK(!p.pop_all(items, 1));
+    CHECK(items.empty());
+}
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static const int PRODUCERS    = 4;
+static const int PER_PRODUCER = 50000;
+
+struct producer_arg {
+    lockfree_queue<int>* queue;
+    int                  id;
+};
+
+// 元素为 生产者编号 * PER_PRODUCER + 序号，队列满时让出CPU重试
+static void* produce(void* args)
+{
+    producer_arg* arg = (producer_arg*)args;
+    for (int i = 0; i < PER_PRODUCER; ++i) {
+        while (!arg->queue->push(arg->id * PER_PRODUCER + i)) {
+            sched_yield();
+        }
+    }
+    return nullptr;
+}
+
+static void test_concurrent()
+{
+    // 容量远小于元素总数，生产者会频繁遇到队列满
+    lockfree_queue<int> q(64);
+    pthread_t           tids[PRODUCERS];
+    producer_arg        args[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; ++i) {
+        args[i].queue = &q;
+        args[i].id    = i;
+        pthread_create(&tids[i], NULL, produce, &args[i]);
+    }
+
+    // 每个生产者下一个应该取到的序号，不连续说明丢失、重复或乱序。
+    // 出错时也要继续取，否则生产者会卡在队列满上。带超时的出队在生产者
+    // 占了位置还没写完时也会返回false，连续两秒取不到才算有丢失
+    int              next[PRODUCERS] = {0};
+    bool             ordered         = true;
+    int              got             = 0;
+    long long        last            = now_ms();
+    std::vector<int> items;
+    while (got < PRODUCERS * PER_PRODUCER && now_ms() - last < 2000) {
+        // pop和pop_all交替使用
+        items.clear();
+        int item = 0;
+        if (got % 2 ? !q.pop(item, 100) : !q.pop_all(items, 100)) {
+            continue;
+        }
+        last = now_ms();
+        if (got % 2) {
+            items.push_back(item);
+        }
+        for (size_t i = 0; i < items.size(); ++i) {
+            int id = items[i] / PER_PRODUCER;
+            if (id < 0 || id >= PRODUCERS ||
+                items[i] % PER_PRODUCER != next[id]) {
+                ordered = false;
+                continue;
+            }
+            ++next[id];
+        }
+        got += items.size();
+    }
+    for (int i = 0; i < PRODUCERS; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    CHECK(ordered);
+    for (int i = 0; i < PRODUCERS; ++i) {
+        CHECK(next[i] == PER_PRODUCER);
+    }
+    CHECK(q.empty());
+}
+
+int main()
+{
+    test_capacity();
+    test_concurrent();
+    return TEST_RESULT();
+}
@@ -0,0 +1,68 @@
+#include "log_mmap.h"
+#include "test.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 内存映射日志文件关闭时截断到实际写入的长度，映射失败也不能截错
+
+static long file_size(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (long)st.st_size : -1;
+}
+
+int main()
+{
+    char dir[] = "/tmp/test_log_mmap_XXXXXX";
+    if (!mkdtemp(dir)) {
+        return 1;
+    }
+    std::string a = std::string(dir) + "/a.log";
+    std::string b = std::string(dir) + "/b.log";
+
+    // 正常写入，关闭后去掉预分配的部分
+    log_mmap_file f;
+    CHECK(f.open(a.c_str()));
+    CHECK(f.append("hello\n", 6));
+    f.close();
+    CHECK(file_size(a) == 6);
+    // 重新打开接着追加
+    CHECK(f.open(a.c_str()));
+    CHECK(f.append("world\n", 6));
+    f.close();
+    CHECK(file_size(a) == 12);
+
+    // b已经有5MB，文件大小限制6MB，打开时映射下一个窗口会失败
+    std::string big(5 * 1024 * 1024, 'x');
+    FILE*       fp = fopen(b.c_str(), "w");
+    fwrite(big.data(), 1, big.size(), fp);
+    fclose(fp);
+    signal(SIGXFSZ, SIG_IGN);
+    struct rlimit rl = {6 * 1024 * 1024, 6 * 1024 * 1024};
+    setrlimit(RLIMIT_FSIZE, &rl);
+
+    CHECK(f.open(a.c_str()));
+    CHECK(f.append("again\n", 6));
+    CHECK(!f.open(b.c_str()));
+    // 不能按上一个文件的写入位置截断
+    CHECK(file_size(a) == 18);
+    CHECK(file_size(b) == (long)big.size());
+
+    // 写满窗口之后映射下一个窗口失败，截断到已经写入的长度
+    CHECK(f.open(a.c_str()));
+    std::string chunk(log_mmap_file::WINDOW_SIZE - 18, 'y');
+    CHECK(f.append(chunk.data(), chunk.size()));
+    CHECK(!f.append("z", 1));
+    f.close();
+    CHECK(file_size(a) == (long)log_mmap_file::WINDOW_SIZE);
+
+    unlink(a.c_str());
+    unlink(b.c_str());
+    rmdir(dir);
+    return TEST_RESULT();
+}
@@ -0,0 +1,255 @@
+// 把二进制日志还原成和文本日志一样的格式
+// 用法: logdecode 日志文件... ，结果输出到标准输出
+#include "log_binary.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+struct site_info {
+    int         level;
+    std::string format;
+    std::string signature;
+};
+
+// 解码过程中的一个参数
+struct arg_value {
+    char        tag;
+    uint64_t    bits;  // 整数、指针的值或者double的位
+    std::string str;
+};
+
+static const char* level_name(int level)
+{
+    switch (level) {
+        case 0: return "[debug]:";
+        case 2: return "[warn]:";
+        case 3: return "[erro]:";
+        default: return "[info]:";
+    }
+}
+
+// 按格式串和参数类型重新用snprintf格式化。格式串里的长度修饰符被忽略，
+// 整数统一按64位输出，因为写入时已经统一成了64位
+static void render(
+    const std::string&            format,
+    const std::vector<arg_value>& args,
+    std::string&                  out)
+{
+    size_t next = 0;
+    char   buf[LOG_BINARY_MAX_STRING + 64];
+    for (size_t i = 0; i < format.size(); ++i) {
+        char c = format[i];
+        if (c != '%') {
+            out.push_back(c);
+            continue;
+        }
+        if (i + 1 < format.size() && format[i + 1] == '%') {
+            out.push_back('%');
+            ++i;
+            continue;
+        }
+        // 标志、宽度和精度原样保留
+        std::string spec = "%";
+        size_t      j    = i + 1;
+        while (j < format.size() && strchr("-+ #0123456789.", format[j])) {
+            spec.push_back(format[j++]);
+        }
+        while (j < format.size() && strchr("hlLqjzt", format[j])) {
+            ++j;
+        }
+        if (j >= format.size()) {
+            out.append(format, i, std::string::npos);
+            return;
+        }
+        char conv = format[j];
+        i         = j;
+        if (next >= args.size()) {
+            out.append("<missing>");
+            continue;
+        }
+        const arg_value& a = args[next++];
+        int              n;
+        if (a.tag == 's') {
+            spec.push_back('s');
+            n = snprintf(buf, sizeof(buf), spec.c_str(), a.str.c_str());
+        }
+        else if (a.tag == 'd') {
+            double d;
+            memcpy(&d, &a.bits, 8);
+            spec.push_back(strchr("eEfFgGaA", conv) ? conv : 'f');
+            n = snprintf(buf, sizeof(buf), spec.c_str(), d);
+        }
+        else if (conv == 'p' || a.tag == 'p') {
+            n = snprintf(buf, sizeof(buf), "%p", (void*)(uintptr_t)a.bits);
+        }
+        else if (conv == 'c') {
+            spec.push_back('c');
+            n = snprintf(buf, sizeof(buf), spec.c_str(), (int)a.bits);
+        }
+        else if (strchr("uxXo", conv)) {
+            spec.append("ll");
+            spec.push_back(conv);
+            n = snprintf(
+                buf, sizeof(buf), spec.c_str(), (unsigned long long)a.bits);
+        }
+        else {
+            spec.append("lld");
+            n = snprintf(buf, sizeof(buf), spec.c_str(), (long long)a.bits);
+        }
+        if (n > 0) {
+            out.append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+        }
+    }
+}
+
+// 解码一个文件，格式错误返回false
+static bool decode(const char* data, size_t len, FILE* out)
+{
+    std::vector<site_info> sites;
+    std::vector<arg_value> args;
+    std::string            line;
+    uint64_t               base = 0;  // 最近一条TIME记录的秒数
+    size_t                 pos  = 0;
+    while (pos < len) {
+        // 追加写入的文件里可能有多个文件头，每个文件头之后调用点重新编号
+        if (len - pos >= LOG_BINARY_MAGIC_LEN &&
+            memcmp(data + pos, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) == 0) {
+            sites.clear();
+            pos += LOG_BINARY_MAGIC_LEN;
+            continue;
+        }
+        uint8_t type = data[pos];
+        // 内存映射的日志文件在进程崩溃后会留下预分配的0字节，跳过
+        if (type == 0) {
+            ++pos;
+            continue;
+        }
+        if (type == LOG_RECORD_SITE) {
+            if (len - pos < 15) {
+                return false;
+            }
+            uint32_t id;
+            uint16_t fmt_len, file_len;
+            memcpy(&id, data + pos + 1, 4);
+            memcpy(&fmt_len, data + pos + 10, 2);
+            memcpy(&file_len, data + pos + 12, 2);
+            uint8_t nargs = data[pos + 14];
+            size_t  total = 15 + nargs + fmt_len + file_len;
+            if (len - pos < total) {
+                return false;
+            }
+            site_info s;
+            s.level = data[pos + 5];
+            s.signature.assign(data + pos + 15, nargs);
+            s.format.assign(data + pos + 15 + nargs, fmt_len);
+            if (sites.size() <= id) {
+                sites.resize(id + 1);
+            }
+            sites[id] = s;
+            pos += total;
+        }
+        else if (type == LOG_RECORD_TIME) {
+            if (len - pos < (size_t)LOG_TIME_RECORD_LEN) {
+                return false;
+            }
+            memcpy(&base, data + pos + 1, 8);
+            pos += LOG_TIME_RECORD_LEN;
+        }
+        else if (type == LOG_RECORD_EVENT) {
+            const char* p   = data + pos + 1;
+            const char* end = data + len;
+            uint64_t    id, usec;
+            if (!(p = log_get_varint(p, end, &id)) ||
+                !(p = log_get_varint(p, end, &usec))) {
+                return false;
+            }
+            if (id >= sites.size()) {
+                fprintf(stderr, "unknown log site %lu\n", (unsigned long)id);
+                return false;
+            }
+            const site_info& s = sites[id];
+            args.clear();
+            for (size_t k = 0; k < s.signature.size(); ++k) {
+                arg_value a;
+                a.tag = s.signature[k];
+                if (a.tag == 's') {
+                    uint64_t n;
+                    if (!(p = log_get_varint(p, end, &n)) ||
+                        (uint64_t)(end - p) < n) {
+                        return false;
+                    }
+                    a.str.assign(p, n);
+                    p += n;
+                }
+                else if (a.tag == 'i' || a.tag == 'u') {
+                    if (!(p = log_get_varint(p, end, &a.bits))) {
+                        return false;
+                    }
+                    if (a.tag == 'i') {  // zigzag
+                        a.bits = (a.bits >> 1) ^ (0 - (a.bits & 1));
+                    }
+                }
+                else {
+                    if (end - p < 8) {
+                        return false;
+                    }
+                    memcpy(&a.bits, p, 8);
+                    p += 8;
+                }
+                args.push_back(a);
+            }
+            pos = p - data;
+
+            time_t    sec = base + usec / 1000000;
+            struct tm my_tm;
+            localtime_r(&sec, &my_tm);
+            char prefix[64];
+            int  n = snprintf(
+                prefix, sizeof(prefix), "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
+                my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec,
+                (long)(usec % 1000000), level_name(s.level));
+            line.assign(prefix, n);
+            render(s.format, args, line);
+            line.push_back('\n');
+            fwrite(line.data(), 1, line.size(), out);
+        }
+        else {
+            fprintf(stderr, "bad record type %u at offset %zu\n", type, pos);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s binary_log...\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i) {
+        FILE* fp = fopen(argv[i], "rb");
+        if (!fp) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        std::vector<char> data;
+        char              buf[65536];
+        size_t            n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        fclose(fp);
+        if (!decode(data.data(), data.size(), stdout)) {
+            fprintf(stderr, "%s: truncated or corrupt log\n", argv[i]);
+            ret = 1;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,172 @@
+// 实时查看服务器的统计，类似varnishstat: 只读映射服务器发布的共享内存段，
+// 每隔一段时间打印各指标的当前值和每秒的变化率，不给服务器发任何请求
+// 用法: webserver-stat [-P 端口 | -n 段名] [-i 刷新秒数] [-1]
+//   -1 只打印一次，变化率为启动以来的平均值
+#include "stat_shm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static const stat_segment* attach(const char* name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    void* p = mmap(nullptr, sizeof(stat_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+    const stat_segment* seg = (const stat_segment*)p;
+    if (seg->magic.load(std::memory_order_acquire) != STAT_SHM_MAGIC ||
+        seg->version != STAT_SHM_VERSION) {
+        munmap(p, sizeof(stat_segment));
+        return nullptr;
+    }
+    return seg;
+}
+
+static void detach(const stat_segment* seg)
+{
+    munmap((void*)seg, sizeof(stat_segment));
+}
+
+static bool server_running(const stat_segment* seg)
+{
+    return kill(seg->pid, 0) == 0 || errno == EPERM;
+}
+
+static void usage(const char* prog)
+{
+    fprintf(
+        stderr,
+        "usage: %s [-P port | -n shm_name] [-i seconds] [-1]\n"
+        "  -P  服务器的监听端口，默认10000\n"
+        "  -n  共享内存段的名字，默认%s_端口\n"
+        "  -i  刷新间隔秒数，默认1\n"
+        "  -1  只打印一次\n",
+        prog, STAT_SHM_DEFAULT);
+}
+
+// 打印一屏，prev为空时变化率按启动以来的平均值计算
+static void print_screen(
+    const stat_segment* seg,
+    const uint64_t*     values,
+    const uint64_t*     prev,
+    double              seconds,
+    bool                clear)
+{
+    time_t now = time(NULL);
+    long   up  = now - seg->start_time;
+    if (clear) {
+        printf("\033[H\033[2J");
+    }
+    printf(
+        "webserver pid %d  up %ldd %02ld:%02ld:%02ld%s\n\n", seg->pid,
+        up / 86400, up / 3600 % 24, up / 60 % 60, up % 60,
+        server_running(seg) ? "" : "  (not running)");
+    printf("%-40s %16s %12s\n", "NAME", "VALUE", "RATE/s");
+    for (int i = 0; i < seg->nfields; ++i) {
+        const stat_field& f = seg->fields[i];
+        if (!f.counter) {
+            printf(
+                "%-40s %16llu %12s\n", f.name, (unsigned long long)values[i],
+                "");
+            continue;
+        }
+        uint64_t base = prev ? prev[i] : 0;
+        double   rate =
+            seconds > 0 && values[i] >= base ? (values[i] - base) / seconds : 0;
+        printf(
+            "%-40s %16llu %12.1f\n", f.name, (unsigned long long)values[i],
+            rate);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* name     = nullptr;
+    int         port     = 10000;
+    int         interval = 1;
+    bool        once     = false;
+    int         opt;
+    while ((opt = getopt(argc, argv, "P:n:i:1h")) != -1) {
+        switch (opt) {
+            case 'P': port = atoi(optarg); break;
+            case 'n': name = optarg; break;
+            case 'i': interval = atoi(optarg); break;
+            case '1': once = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (interval <= 0) {
+        interval = 1;
+    }
+    std::string default_name = stat_shm_default_name(port);
+    if (!name) {
+        name = default_name.c_str();
+    }
+
+    const stat_segment* seg = attach(name);
+    if (!seg) {
+        fprintf(
+            stderr, "%s: cannot attach %s, is the server running?\n", argv[0],
+            name);
+        return 1;
+    }
+    std::vector<uint64_t> values(STAT_SHM_MAX_FIELDS), prev(STAT_SHM_MAX_FIELDS);
+    int64_t               update_us = 0, prev_us = 0;
+    if (!stat_shm_read(seg, values.data(), &update_us)) {
+        fprintf(stderr, "%s: %s is stale\n", argv[0], name);
+        detach(seg);
+        return 1;
+    }
+    if (once) {
+        print_screen(
+            seg, values.data(), nullptr, time(NULL) - seg->start_time, false);
+        detach(seg);
+        return 0;
+    }
+
+    bool tty = isatty(STDOUT_FILENO);
+    int  pid = seg->pid;
+    prev     = values;
+    prev_us  = update_us;
+    while (true) {
+        sleep(interval);
+        // 服务器重启后段被重新初始化，重新映射，之前的值作废
+        if (seg->magic.load(std::memory_order_acquire) != STAT_SHM_MAGIC ||
+            seg->pid != pid) {
+            detach(seg);
+            while (!(seg = attach(name))) {
+                sleep(interval);
+            }
+            pid = seg->pid;
+            stat_shm_read(seg, prev.data(), &prev_us);
+            continue;
+        }
+        // 服务器在更新中途退出，等它重启后重新初始化段
+        if (!stat_shm_read(seg, values.data(), &update_us)) {
+            fprintf(stderr, "%s: %s is stale\n", argv[0], name);
+            continue;
+        }
+        // 服务器还没有发布新的值，等下一次，免得变化率忽高忽低
+        if (update_us == prev_us && server_running(seg)) {
+            continue;
+        }
+        // 变化率按服务器发布的时间计算，不受本进程调度的影响
+        print_screen(
+            seg, values.data(), prev.data(), (update_us - prev_us) / 1e6, tty);
+        prev    = values;
+        prev_us = update_us;
+    }
+}